@@ -9,108 +9,434 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
-#define hash_size(s) ((s) + ((s) >> 1))
+/* Always keep an empty slot in the index so that probing terminates */
+#define hash_size(s) ((s) + ((s) >> 1) + 1)
 #define hash_freed ((void *)1)
 #define hash_hash(d, i) (d->value.hash.hash[i])
 #define hash_first(d, h) (h % hash_size(d->value.hash.size))
 #define hash_next(d, i) (((i + 1) == hash_size(d->value.hash.size)) ? 0 : i + 1)
 
+/*
+ * Memoized digest of a container. The memo links to the memo of the
+ * container holding it, whose digest depends on it: resetting a memo
+ * resets those above. A memo is valid only if the memos of the
+ * containers it holds are, so the reset stops at the first invalid one.
+ * Memos are counted references, a link never dangles even if the
+ * element was replaced without being unlinked and its holder freed.
+ */
+struct has_memo_t {
+    has_digest_t  digest;
+    has_memo_t   *up;     /* Memo of the container holding the owner */
+    size_t        refs;   /* Owner and memos linked to this one */
+    bool          valid;
+};
+
+/* Header of the index of a live hash, in front of its slots */
+typedef struct {
+    has_memo_t *memo;   /* Memoized digest (valid if HAS_DIGEST is set) */
+    size_t      freed;  /* Slots of removed entries */
+} has_hash_header_t;
+#define hash_header(d) ((has_hash_header_t *)(d)->value.hash.hash - 1)
+/* Slots of removed entries are reclaimed before the last empty one */
+#define hash_crowded(d) (hash_header(d)->freed > 0 &&                   \
+                         (d)->value.hash.count + hash_header(d)->freed >= \
+                         hash_size((d)->value.hash.size) - 1)
+
+#define has_frozen(e) ((e)->flags & HAS_FROZEN)
+/* Resolves the self-relative offset stored in field f of a frozen element */
+#define has_offset(f) ((void *)((char *)&(f) + (intptr_t)(f)))
+#define has_relative(f) ((f) ? has_offset(f) : NULL)
+#define has_resolve(e, f) (has_frozen(e) ? has_relative(f) : (void *)(f))
+/* Memo of a hash or array element with HAS_DIGEST set */
+#define has_memo(e) (*(((e)->type == has_hash) ? &(hash_header(e)->memo) : \
+                       &((e)->value.array.memo)))
+/* Resets the memoized digests of a modified container and above */
+#define has_touch(e) do {                       \
+        if((e)->flags & HAS_DIGEST) {           \
+            has_memo_reset(has_memo(e));        \
+        }                                       \
+    } while(0)
+/* Unlinks an element removed from its container */
+#define has_detach(e) do {                      \
+        if((e) && ((e)->flags & HAS_DIGEST)) {  \
+            has_memo_link(has_memo(e), NULL);   \
+        }                                       \
+    } while(0)
+static void has_memo_reset(has_memo_t *m);
+static void has_memo_release(has_memo_t *m);
+static void has_memo_link(has_memo_t *m, has_memo_t *up);
+/* Initial size of the stacks of iterative traversals */
+#define WALK_STACK 32
+/* Checks the type of a container, building its content if lazy */
+#define has_ready(e, t) ((e) && (e)->type == (t) && has_materialize(e) == 0)
+
+#ifdef HAS_COUNTERS
+static long counters[has_number + 1];
+/* Only individually allocated elements are counted */
+#define has_count(e, d) do {                                            \
+        if((e)->owner) {                                                \
+            __atomic_add_fetch(&counters[(e)->type], (d), __ATOMIC_RELAXED); \
+        }                                                               \
+    } while(0)
+#else
+#define has_count(e, d) do { } while(0)
+#endif
+/* Sets the type of e being initialized, keeping the counters in sync.
+   The flags of caller storage are not trusted. */
+#define has_retype(e, t) do {                   \
+        (e)->flags = 0;                         \
+        has_count(e, -1);                       \
+        (e)->type = (t);                        \
+        has_count(e, 1);                        \
+    } while(0)
+
+static void * has_default_allocate(void *context, size_t size)
+{
+    return malloc(size);
+}
+
+static void * has_default_reallocate(void *context, void *pointer, size_t size)
+{
+    return realloc(pointer, size);
+}
+
+static void has_default_release(void *context, void *pointer)
+{
+    free(pointer);
+}
+
+static has_allocator_t allocator = {
+    has_default_allocate, has_default_reallocate, has_default_release, NULL
+};
+
+void has_set_allocator(const has_allocator_t *a)
+{
+    if(a) {
+        allocator = *a;
+    } else {
+        allocator.allocate = has_default_allocate;
+        allocator.reallocate = has_default_reallocate;
+        allocator.release = has_default_release;
+        allocator.context = NULL;
+    }
+}
+
+void * has_mem_alloc(size_t size)
+{
+    return allocator.allocate(allocator.context, size);
+}
+
+void * has_mem_calloc(size_t count, size_t size)
+{
+    void *r;
+    if(size && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    if((r = allocator.allocate(allocator.context, count * size)) != NULL) {
+        memset(r, 0, count * size);
+    }
+    return r;
+}
+
+void * has_mem_realloc(void *pointer, size_t size)
+{
+    return allocator.reallocate(allocator.context, pointer, size);
+}
+
+void has_mem_free(void *pointer)
+{
+    if(pointer) {
+        allocator.release(allocator.context, pointer);
+    }
+}
+
 has_t * has_new(size_t count)
 {
-    has_t *r = calloc(sizeof(has_t), count);
+    has_t *r = has_mem_calloc(sizeof(has_t), count);
     if(r && count == 1) {
         r->owner = 1;
+        has_count(r, 1);
     }
     return r;
 }
 
-void has_free(has_t *e)
+/* Frees e and its scalars, pushing the containers it holds. Those
+   that cannot be pushed are freed by a nested has_free() call. */
+static void has_free_content(has_t *e, has_t ***stack, size_t *size,
+                            size_t *count, has_t **local)
 {
-    if(e == NULL) {
-        return;
+    has_t **t, *v;
+    size_t i, n;
+
+#define PUSH(x)                                                         \
+    if((v = (x)) == NULL || has_frozen(v)) {                            \
+    } else if(v->type != has_hash && v->type != has_array) {            \
+        has_free_content(v, stack, size, count, local);                 \
+    } else {                                                            \
+        if(*count == *size) {                                           \
+            n = 2 * *size;                                              \
+            t = (*stack == local) ? has_mem_alloc(n * sizeof(*t)) :     \
+                has_mem_realloc(*stack, n * sizeof(*t));                \
+            if(t == NULL) {                                             \
+                has_free(v);                                            \
+                v = NULL;                                               \
+            } else {                                                    \
+                if(*stack == local) {                                   \
+                    memcpy(t, local, *size * sizeof(*t));               \
+                }                                                       \
+                *stack = t;                                             \
+                *size = n;                                              \
+            }                                                           \
+        }                                                               \
+        if(v) {                                                         \
+            (*stack)[(*count)++] = v;                                   \
+        }                                                               \
     }
 
-    if(e->type == has_hash) {
-        int i;
+    if(e->flags & HAS_DIGEST) {
+        has_memo(e)->valid = false;
+        has_memo_release(has_memo(e));
+    }
+    if(e->flags & HAS_LAZY) {
+        if(e->value.lazy.release) {
+            e->value.lazy.release(&(e->value.lazy));
+        }
+    } else if(e->type == has_hash) {
         for(i = 0; i < e->value.hash.size; i++) {
             if(e->value.hash.entries[i].key.pointer) {
                 if(e->value.hash.entries[i].key.owner) {
-                    free(e->value.hash.entries[i].key.pointer);
-                }
-                if(e->value.hash.entries[i].value) {
-                    has_free(e->value.hash.entries[i].value);
+                    has_mem_free(e->value.hash.entries[i].key.pointer);
                 }
+                PUSH(e->value.hash.entries[i].value);
             }
         }
-        free(e->value.hash.entries);
-        free(e->value.hash.hash);
+        has_mem_free(e->value.hash.entries);
+        if(e->value.hash.hash) {
+            has_mem_free(hash_header(e));
+        }
     } else if(e->type == has_array) {
-        int i;
         for(i = 0; i < e->value.array.count; i++) {
-            has_free(e->value.array.elements[i]);
+            PUSH(e->value.array.elements[i]);
         }
-        free(e->value.array.elements);
-    } else if(e->type == has_string && 
+        has_mem_free(e->value.array.elements);
+    } else if((e->type == has_string || e->type == has_number) &&
               e->value.string.owner) {
-        free(e->value.string.pointer);
+        has_mem_free(e->value.string.pointer);
     }
+#undef PUSH
     if(e->owner) {
-        free(e);
+        has_count(e, -1);
+        has_mem_free(e);
+    }
+}
+
+/* Iterative, the depth of the structure is not limited by the call
+   stack */
+void has_free(has_t *e)
+{
+    has_t *local[WALK_STACK], **stack = local;
+    size_t size = WALK_STACK, count = 0;
+
+    if(e == NULL || has_frozen(e)) {
+        return;
+    }
+
+    stack[count++] = e;
+    while(count > 0) {
+        e = stack[--count];
+        has_free_content(e, &stack, &size, &count, local);
+    }
+    if(stack != local) {
+        has_mem_free(stack);
     }
 }
 
 void has_set_owner(has_t *e, bool owner)
 {
-    if(e) {
+    if(e && !has_frozen(e)) {
+        has_count(e, -1);
         e->owner = owner ? 1 : 0;
+        has_count(e, 1);
+    }
+}
+
+typedef struct {
+    has_t  *e;      /* Element being traversed */
+    has_t  *v;      /* Value whose traversal is in progress */
+    size_t  i;      /* Next position in entries or elements */
+    int     j;      /* Index of the current entry */
+    bool    begun;  /* Begin event was sent */
+} has_walk_frame_t;
+
+struct has_walker_t {
+    has_walk_frame_t *frames;
+    size_t            size;
+    bool              owner; /* Frames were allocated on the heap */
+};
+
+has_walker_t * has_walker_new(void)
+{
+    return has_mem_calloc(sizeof(has_walker_t), 1);
+}
+
+void has_walker_free(has_walker_t *w)
+{
+    if(w) {
+        if(w->owner) {
+            has_mem_free(w->frames);
+        }
+        has_mem_free(w);
+    }
+}
+
+static int has_walker_grow(has_walker_t *w)
+{
+    size_t s = w->size ? w->size * 2 : WALK_STACK;
+    has_walk_frame_t *t;
+
+    if(w->owner) {
+        t = has_mem_realloc(w->frames, s * sizeof(has_walk_frame_t));
+    } else if((t = has_mem_alloc(s * sizeof(has_walk_frame_t))) != NULL && w->size) {
+        memcpy(t, w->frames, w->size * sizeof(has_walk_frame_t));
+    }
+    if(t == NULL) {
+        return -1;
     }
+    w->frames = t;
+    w->size = s;
+    w->owner = true;
+    return 0;
 }
 
 /* I don't like to use macros to often */
-#define WF(r, call) if((r = (call)) != 0) { return r; } 
+#define WF(r, call) if((r = (call)) != 0 && r != HAS_WALK_SKIP) { return r; }
 
-int has_walk(has_t *e, has_walk_function_t f, void *p)
+int has_walker_walk(has_walker_t *w, has_t *e, has_walk_function_t f, void *p)
 {
-    int i, j, r;
+    size_t depth;
+    int r;
 
-    if(e == NULL) {
+    if(w == NULL || e == NULL || (w->size == 0 && has_walker_grow(w) < 0)) {
         return -1;
     }
 
-    if(e->type == has_hash) {
-        WF(r, f(e, has_walk_hash_begin, 0, NULL, 0, NULL, p));
-        for(i = 0, j = 0; i < e->value.hash.size; i++) {
-            has_hash_entry_t *l = &(e->value.hash.entries[i]);
-            if(l->key.pointer) {
-                WF(r, f(e, has_walk_hash_key, j, l->key.pointer,
-                        l->key.size, NULL, p));
-                WF(r, f(e, has_walk_hash_value_begin, j, NULL, 0, l->value, p));
-                WF(r, has_walk(l->value, f, p));
-                WF(r, f(e, has_walk_hash_value_end, j, NULL, 0, l->value, p));
-                j++;
+    memset(w->frames, 0, sizeof(has_walk_frame_t));
+    w->frames[0].e = e;
+    depth = 1;
+
+    while(depth > 0) {
+        has_walk_frame_t *fr = &(w->frames[depth - 1]);
+        has_t *c = fr->e, *v = NULL;
+
+        if(!fr->begun && has_materialize(c) < 0) {
+            return -1;
+        }
+
+        if(c->type == has_hash) {
+            has_hash_entry_t *entries = has_resolve(c, c->value.hash.entries), *l;
+            if(!fr->begun) {
+                fr->begun = true;
+                WF(r, f(c, has_walk_hash_begin, 0, NULL, 0, NULL, p));
+                if(r == HAS_WALK_SKIP) {
+                    fr->i = c->value.hash.size;
+                }
+            } else if(fr->v) {
+                WF(r, f(c, has_walk_hash_value_end, fr->j, NULL, 0, fr->v, p));
+                fr->v = NULL;
+                fr->j++;
+            }
+
+            while(fr->i < c->value.hash.size && entries[fr->i].key.pointer == NULL) {
+                fr->i++;
             }
+            if(fr->i == c->value.hash.size) {
+                WF(r, f(c, has_walk_hash_end, 0, NULL, 0, NULL, p));
+                depth--;
+                continue;
+            }
+
+            l = &(entries[fr->i++]);
+            v = has_resolve(c, l->value);
+            WF(r, f(c, has_walk_hash_key, fr->j, has_resolve(c, l->key.pointer),
+                    l->key.size, NULL, p));
+            WF(r, f(c, has_walk_hash_value_begin, fr->j, NULL, 0, v, p));
+            if(r == HAS_WALK_SKIP) {
+                WF(r, f(c, has_walk_hash_value_end, fr->j, NULL, 0, v, p));
+                fr->j++;
+                continue;
+            }
+        } else if(c->type == has_array) {
+            has_t **elements = has_resolve(c, c->value.array.elements);
+            if(!fr->begun) {
+                fr->begun = true;
+                WF(r, f(c, has_walk_array_begin, 0, NULL, 0, NULL, p));
+                if(r == HAS_WALK_SKIP) {
+                    fr->i = c->value.array.count;
+                }
+            } else if(fr->v) {
+                WF(r, f(c, has_walk_array_entry_end, fr->j, NULL, 0, fr->v, p));
+                fr->v = NULL;
+            }
+
+            if(fr->i >= c->value.array.count) {
+                WF(r, f(c, has_walk_array_end, 0, NULL, 0, NULL, p));
+                depth--;
+                continue;
+            }
+
+            fr->j = fr->i++;
+            v = has_resolve(c, elements[fr->j]);
+            WF(r, f(c, has_walk_array_entry_begin, fr->j, NULL, 0, v, p));
+            if(r == HAS_WALK_SKIP) {
+                WF(r, f(c, has_walk_array_entry_end, fr->j, NULL, 0, v, p));
+                continue;
+            }
+        } else {
+            if(c->type == has_string) {
+                WF(r, f(c, has_walk_string, 0,
+                        has_resolve(c, c->value.string.pointer),
+                        c->value.string.size, NULL, p));
+            } else {
+                WF(r, f(c, has_walk_other, 0, NULL, 0, NULL, p));
+            }
+            depth--;
+            continue;
         }
-        WF(r, f(e, has_walk_hash_end, 0, NULL, 0, NULL, p));
-    } else if(e->type == has_array) {
-        WF(r, f(e, has_walk_array_begin, 0, NULL, 0, NULL, p));
-        for(i = 0; i < e->value.array.count; i++) {
-            has_t *cur = e->value.array.elements[i];
-            WF(r, f(e, has_walk_array_entry_begin, i, NULL, 0, cur, p));
-            WF(r, has_walk(cur, f, p));
-            WF(r, f(e, has_walk_array_entry_end, i, NULL, 0, cur, p));
-        }
-        WF(r, f(e, has_walk_array_end, 0, NULL, 0, NULL, p));
-    } else if(e->type == has_string) {
-        WF(r, f(e, has_walk_string, 0, e->value.string.pointer,
-             e->value.string.size, NULL, p));
-    } else {
-        WF(r, f(e, has_walk_other, 0, NULL, 0, NULL, p));
+
+        /* Descend into v, the parent resumes once it is traversed */
+        if(v == NULL) {
+            return -1;
+        }
+        fr->v = v;
+        if(depth == w->size && has_walker_grow(w) < 0) {
+            return -1;
+        }
+        fr = &(w->frames[depth++]);
+        memset(fr, 0, sizeof(has_walk_frame_t));
+        fr->e = v;
     }
     return 0;
 }
 #undef WF
 
+int has_walk(has_t *e, has_walk_function_t f, void *p)
+{
+    has_walk_frame_t frames[WALK_STACK];
+    has_walker_t w;
+    int r;
+
+    w.frames = frames;
+    w.size = WALK_STACK;
+    w.owner = false;
+    r = has_walker_walk(&w, e, f, p);
+    if(w.owner) {
+        has_mem_free(w.frames);
+    }
+    return r;
+}
+
 has_t * has_hash_new(size_t size)
 {
     has_t *r = has_new(1), *s = NULL;
@@ -124,19 +450,24 @@ has_t * has_hash_new(size_t size)
 
 has_t * has_hash_init(has_t *hash, size_t size)
 {
-    has_hash_entry_t *e, **h;
+    has_hash_entry_t *e;
+    has_hash_header_t *h;
 
     if(hash == NULL ||
-       ((e = calloc(sizeof(has_hash_entry_t), size)) == NULL) ||
-       ((h = calloc(sizeof(has_hash_entry_t *), hash_size(size))) == NULL)) {
+       ((e = has_mem_calloc(sizeof(has_hash_entry_t), size)) == NULL)) {
+        return NULL;
+    }
+    if((h = has_mem_calloc(1, sizeof(has_hash_header_t) +
+                           hash_size(size) * sizeof(has_hash_entry_t *))) == NULL) {
+        has_mem_free(e);
         return NULL;
     }
 
-    hash->type = has_hash;
+    has_retype(hash, has_hash);
     hash->value.hash.size = size;
     hash->value.hash.count = 0;
     hash->value.hash.entries = e;
-    hash->value.hash.hash = h;
+    hash->value.hash.hash = (has_hash_entry_t **)(h + 1);
     return hash;
 }
 
@@ -145,63 +476,112 @@ inline bool has_is_hash(has_t *e)
     return (e && e->type == has_hash) ? true : false;
 }
 
+/* Searches the entry matching key (of digest h), also works on frozen
+   hashes. The index of the slot is stored in slot if found. */
+static has_hash_entry_t *has_hash_lookup(has_t *hash, const char *key,
+                                         size_t size, uint32_t h, size_t *slot)
+{
+    size_t             i;
+    has_hash_entry_t **t, *e;
+
+    if(!has_ready(hash, has_hash)) {
+        return NULL;
+    }
+
+    t = has_resolve(hash, hash->value.hash.hash);
+    for(i = hash_first(hash, h); (e = t[i]) ; i = hash_next(hash, i)) {
+        if(e == hash_freed) {                          /* Check freed */
+            continue;
+        }
+        if(has_frozen(hash)) {
+            e = has_offset(t[i]);
+        }
+        if((e->hash == h) &&                           /* Check hash */
+           (e->key.size == size) &&                    /* Check key size */
+           (memcmp(has_frozen(hash) ? has_offset(e->key.pointer) :
+                   e->key.pointer, key, size) == 0)) { /* Full key compare */
+            if(slot) {
+                *slot = i;
+            }
+            return e;
+        }
+    }
+    return NULL;
+}
+
+int has_hash_count(has_t *hash)
+{
+    return has_ready(hash, has_hash) ? hash->value.hash.count : 0;
+}
+
+/* Rebuilds the index from the entries, dropping the slots of removed
+   ones */
+static void has_hash_reindex(has_t *hash)
+{
+    size_t i, j;
+    has_hash_entry_t *e;
+
+    memset(hash->value.hash.hash, 0,
+           hash_size(hash->value.hash.size) * sizeof(has_hash_entry_t *));
+    hash_header(hash)->freed = 0;
+    for(i = 0; i < hash->value.hash.size; i++) {
+        e = &(hash->value.hash.entries[i]);
+        if(e->key.pointer == NULL) {
+            continue;
+        }
+        j = hash_first(hash, e->hash);
+        while(hash_hash(hash, j) != NULL) {
+            j = hash_next(hash, j);
+        }
+        hash_hash(hash, j) = e;
+    }
+}
+
 has_t * has_hash_set_o(has_t *hash, char *key, size_t size, has_t *value, bool owner)
 {
     size_t            i, j;
     has_hash_entry_t *e = NULL;
-    int32_t           h;
+    uint32_t          h;
 
-    if(hash == NULL || hash->type != has_hash) {
+    if(!has_ready(hash, has_hash) || has_frozen(hash)) {
         return NULL;
     }
 
+    has_touch(hash);
     h = has_hash_function(key, size);
     /* Search for a value with same key */
-
-    for(i = hash_first(hash, h); (e = hash_hash(hash, i)) ; i = hash_next(hash, i)) {
-        if((e != hash_freed) &&                        /* Check freed */
-           (e->hash == h) &&                           /* Check hash */
-           (e->key.size == size) &&                    /* Check key size */
-           (memcmp(e->key.pointer, key, size) == 0)) { /* Full key compare */
-            has_free(e->value);       /* Free the value */
-            e->value = value;
-            if(e->key.owner) {
-                free(e->key.pointer); /* Free the key if we own it */
-            }
-            e->key.pointer = key;
-            e->key.owner = owner;
-            return hash;
+    if((e = has_hash_lookup(hash, key, size, h, NULL)) != NULL) {
+        has_free(e->value);       /* Free the value */
+        e->value = value;
+        if(e->key.owner) {
+            has_mem_free(e->key.pointer); /* Free the key if we own it */
         }
+        e->key.pointer = key;
+        e->key.owner = owner;
+        return hash;
     }
 
     if(hash->value.hash.size == hash->value.hash.count) {
-        has_hash_entry_t **t;
+        has_hash_header_t *t;
         i = hash->value.hash.size * sizeof(has_hash_entry_t);
-        if((e = calloc(2* i, 1)) == NULL) {
+        if((e = has_mem_calloc(2* i, 1)) == NULL) {
             return NULL;
         }
         memcpy(e, hash->value.hash.entries, i);
-        free(hash->value.hash.entries);
+        has_mem_free(hash->value.hash.entries);
         hash->value.hash.entries = e;
 
         i = 2 * hash->value.hash.size;
-        if((t = calloc(hash_size(i), sizeof(has_hash_entry_t *))) == NULL) {
+        if((t = has_mem_calloc(1, sizeof(has_hash_header_t) +
+                               hash_size(i) * sizeof(has_hash_entry_t *))) == NULL) {
             return NULL;
         }
-        free(hash->value.hash.hash);
-        hash->value.hash.hash = t;
+        *t = *hash_header(hash);
+        has_mem_free(hash_header(hash));
+        hash->value.hash.hash = (has_hash_entry_t **)(t + 1);
 
         hash->value.hash.size *= 2;
-
-        /* Rebuild hash table */
-        for(i = 0 ; i < hash->value.hash.count ; i++) {
-            e = &(hash->value.hash.entries[i]);
-            j = hash_first(hash, e->hash);
-            while(hash_hash(hash, j) != NULL && hash_hash(hash, j) != hash_freed) {
-                j = hash_next(hash, j);
-            }
-            hash_hash(hash, j) = e;
-        }
+        has_hash_reindex(hash);
     }
 
     /* Insert key in the first empty slot. Start at
@@ -224,10 +604,16 @@ has_t * has_hash_set_o(has_t *hash, char *key, size_t size, has_t *value, bool o
     while(hash_hash(hash, j) != NULL && hash_hash(hash, j) != hash_freed) {
         j = hash_next(hash, j);
     }
+    if(hash_hash(hash, j) == hash_freed) {
+        hash_header(hash)->freed--;
+    }
     hash_hash(hash, j) = e;
 
     /* Increase counter */
     hash->value.hash.count++;
+    if(hash_crowded(hash)) {
+        has_hash_reindex(hash);
+    }
     return hash;
 }
 
@@ -248,7 +634,7 @@ has_t * has_hash_set_str_o(has_t *hash, char *string, has_t *value, bool owner)
 
 has_t *has_hash_add(has_t *h, has_t *k, has_t *v)
 {
-    if(h == NULL || h->type != has_hash ||
+    if(!has_ready(h, has_hash) ||
        k == NULL || k->type != has_string) {
         return NULL;
     } else {
@@ -263,7 +649,7 @@ has_t *has_hash_add(has_t *h, has_t *k, has_t *v)
         if((r = has_hash_set_o(h, s, l, v, owner)) == NULL) {
             has_free(v);
             if(owner) {
-                free(s);
+                has_mem_free(s);
             }
         }
         return r;
@@ -272,27 +658,12 @@ has_t *has_hash_add(has_t *h, has_t *k, has_t *v)
 
 bool has_hash_exists(has_t *hash, const char *key, size_t size)
 {
-    size_t            i;
-    uint32_t          h;
-    has_hash_entry_t *e = NULL;
-    bool              r = false;
-
     if(!hash) {
-        return r;
-    }
-
-    h = has_hash_function(key, size);
-    for(i = hash_first(hash, h); (e = hash_hash(hash, i)) ; i = hash_next(hash, i)) {
-        if((e != hash_freed) &&                        /* Check freed */
-           (e->hash == h) &&                           /* Check hash */
-           (e->key.size == size) &&                    /* Check key size */
-           (memcmp(e->key.pointer, key, size) == 0)) { /* Full key compare */
-            r = true;
-            break;
-        }
+        return false;
     }
 
-    return r;
+    return has_hash_lookup(hash, key, size,
+                           has_hash_function(key, size), NULL) ? true : false;
 }
 
 bool has_hash_exists_str(has_t *hash, const char *string)
@@ -302,27 +673,15 @@ bool has_hash_exists_str(has_t *hash, const char *string)
 
 has_t * has_hash_get(has_t *hash, const char *key, size_t size)
 {
-    size_t            i;
-    uint32_t          h;
-    has_hash_entry_t *e = NULL;
-    has_t            *r = NULL;
-
-    if(!hash) {
-        return r;
-    }
+    has_hash_entry_t *e;
 
-    h = has_hash_function(key, size);
-    for(i = hash_first(hash, h); (e = hash_hash(hash, i)) ; i = hash_next(hash, i)) {
-        if((e != hash_freed) &&                        /* Check freed */
-           (e->hash == h) &&                           /* Check hash */
-           (e->key.size == size) &&                    /* Check key size */
-           (memcmp(e->key.pointer, key, size) == 0)) { /* Full key compare */
-            r = e->value;
-            break;
-        }
+    if(!hash || (e = has_hash_lookup(hash, key, size,
+                                     has_hash_function(key, size),
+                                     NULL)) == NULL) {
+        return NULL;
     }
 
-    return r;
+    return has_resolve(hash, e->value);
 }
 
 has_t * has_hash_get_str(has_t *hash, const char *string)
@@ -330,6 +689,49 @@ has_t * has_hash_get_str(has_t *hash, const char *string)
     return has_hash_get(hash, string, strlen(string));
 }
 
+has_t * has_hash_get_hashed(has_t *hash, const char *key, size_t size,
+                            uint32_t digest)
+{
+    has_hash_entry_t *e;
+
+    if(!hash || (e = has_hash_lookup(hash, key, size, digest, NULL)) == NULL) {
+        return NULL;
+    }
+
+    return has_resolve(hash, e->value);
+}
+
+bool has_hash_iterate(has_t *hash, size_t *index, const char **key,
+                      size_t *size, has_t **value)
+{
+    has_hash_entry_t *entries;
+    size_t i;
+
+    if(!has_ready(hash, has_hash) || index == NULL) {
+        return false;
+    }
+
+    entries = has_resolve(hash, hash->value.hash.entries);
+    for(i = *index; i < hash->value.hash.size; i++) {
+        has_hash_entry_t *e = &(entries[i]);
+        if(e->key.pointer) {
+            if(key) {
+                *key = has_resolve(hash, e->key.pointer);
+            }
+            if(size) {
+                *size = e->key.size;
+            }
+            if(value) {
+                *value = has_resolve(hash, e->value);
+            }
+            *index = i + 1;
+            return true;
+        }
+    }
+    *index = i;
+    return false;
+}
+
 has_t * has_hash_remove(has_t *hash, const char *key, size_t size)
 {
     size_t            i;
@@ -337,37 +739,38 @@ has_t * has_hash_remove(has_t *hash, const char *key, size_t size)
     has_t            *r = NULL;
     uint32_t          h;
 
-    if(hash == NULL) {
+    if(!has_ready(hash, has_hash) || has_frozen(hash)) {
         return NULL;
     }
 
     h = has_hash_function(key, size);
-    for(i = hash_first(hash, h); (e = hash_hash(hash, i)) ; i = hash_next(hash, i)) {
-        if((e != hash_freed) &&                        /* Check freed */
-           (e->hash == h) &&                           /* Check hash */
-           (e->key.size == size) &&                    /* Check key size */
-           (memcmp(e->key.pointer, key, size) == 0)) { /* Full key compare */
-            if(e->key.owner) {
-                free(e->key.pointer);
-            }
-            r = e->value;
-
-            /* Lazy free */
-            hash->value.hash.hash[i] = hash_freed;
-            hash->value.hash.count--;
-            e->hash = 0;
-            e->key.size = 0;
-            e->key.pointer = NULL;
-            break;
+    if((e = has_hash_lookup(hash, key, size, h, &i)) != NULL) {
+        has_touch(hash);
+        if(e->key.owner) {
+            has_mem_free(e->key.pointer);
         }
+        r = e->value;
+        has_detach(r);
+
+        /* Lazy free */
+        hash->value.hash.hash[i] = hash_freed;
+        hash_header(hash)->freed++;
+        hash->value.hash.count--;
+        e->hash = 0;
+        e->key.size = 0;
+        e->key.pointer = NULL;
     }
 
-    /* Resilver when hash is empty */
+    /* Resilver when hash is empty, or when removed entries leave too
+       few empty slots */
     if(hash->value.hash.count == 0) {
         memset(hash->value.hash.entries, 0,
                hash->value.hash.size * sizeof(has_hash_entry_t));
         memset(hash->value.hash.hash, 0,
                hash_size(hash->value.hash.size) * sizeof(has_hash_entry_t *));
+        hash_header(hash)->freed = 0;
+    } else if(hash_crowded(hash)) {
+        has_hash_reindex(hash);
     }
 
     return r;
@@ -400,27 +803,29 @@ int has_hash_keys_values(has_t *hash, char ***keys, size_t **lengths,
     size_t *l = NULL;
     has_t  **v = NULL;
     int     i, j;
+    has_hash_entry_t *entries;
 
-    if(hash == NULL || hash->type != has_hash ||
+    if(!has_ready(hash, has_hash) ||
        (keys == NULL && lengths == NULL && values == NULL) ||
        ((keys == NULL) != (lengths == NULL)) ||
        ((keys && lengths) &&
-        ((k = calloc(sizeof(char *), (hash->value.hash.count + 1))) == NULL ||
-         (l = calloc(sizeof(size_t), (hash->value.hash.count + 1))) == NULL)) ||
+        ((k = has_mem_calloc(sizeof(char *), (hash->value.hash.count + 1))) == NULL ||
+         (l = has_mem_calloc(sizeof(size_t), (hash->value.hash.count + 1))) == NULL)) ||
        ((values != NULL) &&
-        (v = calloc(sizeof(has_t *), (hash->value.hash.count + 1))) == NULL)) {
+        (v = has_mem_calloc(sizeof(has_t *), (hash->value.hash.count + 1))) == NULL)) {
         return -1;
     }
 
+    entries = has_resolve(hash, hash->value.hash.entries);
     for(i = 0, j = 0; j < hash->value.hash.count &&
             i < hash->value.hash.size; i++) {
-        if(hash->value.hash.entries[i].key.pointer) {
+        if(entries[i].key.pointer) {
             if(k && l) {
-                k[j] = hash->value.hash.entries[i].key.pointer;
-                l[j] = hash->value.hash.entries[i].key.size;
+                k[j] = has_resolve(hash, entries[i].key.pointer);
+                l[j] = entries[i].key.size;
             }
             if(v) {
-                v[j] = hash->value.hash.entries[i].value;
+                v[j] = has_resolve(hash, entries[i].value);
             }
             j++;
         }
@@ -452,7 +857,7 @@ int has_hash_values(has_t *hash, has_t ***values, int *count)
 static char *xstrndup(const char *str, int l)
 {
     char *r = NULL;
-    if(l >= 0 && (r = calloc(l + 1, 1)) != NULL) {
+    if(l >= 0 && (r = has_mem_calloc(l + 1, 1)) != NULL) {
         memcpy(r, str, l);
     }
     return r;
@@ -462,17 +867,19 @@ int has_hash_keys_str(has_t *hash, char ***keys, int *count)
 {
     char **k;
     int i, j;
+    has_hash_entry_t *entries;
 
-    if(hash == NULL || hash->type != has_hash || keys == NULL ||
-       (k = calloc(sizeof(char *), (hash->value.hash.count + 1))) == NULL) {
+    if(!has_ready(hash, has_hash) || keys == NULL ||
+       (k = has_mem_calloc(sizeof(char *), (hash->value.hash.count + 1))) == NULL) {
         return -1;
     }
 
+    entries = has_resolve(hash, hash->value.hash.entries);
     for(i = 0, j = 0; j < hash->value.hash.count &&
             i < hash->value.hash.size; i++) {
-        if(hash->value.hash.entries[i].key.pointer) {
-            if((k[j] = xstrndup(hash->value.hash.entries[i].key.pointer,
-                                hash->value.hash.entries[i].key.size)) == NULL) {
+        if(entries[i].key.pointer) {
+            if((k[j] = xstrndup(has_resolve(hash, entries[i].key.pointer),
+                                entries[i].key.size)) == NULL) {
                 break;
             }
             j++;
@@ -481,9 +888,9 @@ int has_hash_keys_str(has_t *hash, char ***keys, int *count)
 
     if(j != hash->value.hash.count) {
         for(i = 0 ; k[i]; i++) {
-            free(k[i]);
+            has_mem_free(k[i]);
         }
-        free(k);
+        has_mem_free(k);
         return -1;
     }
 
@@ -509,11 +916,11 @@ has_t * has_array_init(has_t *array, size_t size)
         return NULL;
     }
 
-    array->value.array.elements = calloc(sizeof(has_t *), size);
+    array->value.array.elements = has_mem_calloc(sizeof(has_t *), size);
     if(array->value.array.elements == NULL) {
         return NULL;
     }
-    array->type = has_array;
+    has_retype(array, has_array);
     array->value.array.size = size;
     array->value.array.count = 0;
     return array;
@@ -524,22 +931,25 @@ has_t * has_array_reallocate(has_t *array, size_t size)
     size_t n;
     has_t **new;
 
-    if(array == NULL || array->type != has_array) {
+    if(!has_ready(array, has_array) || has_frozen(array)) {
         return NULL;
     }
 
-    if((n = array->value.array.size) > size) {
+    if((n = array->value.array.size) >= size) {
         return array; /* Already big enough */
     }
 
+    if(n == 0) {
+        n = 1;
+    }
     while(n < size) { n *= 2; } /* Double until big enough */
-    new = realloc(array->value.array.elements, n * sizeof(has_t *));
+    new = has_mem_realloc(array->value.array.elements, n * sizeof(has_t *));
     if(new == NULL) {
         return NULL;
     }
 
     /* Zero new part */
-    memset(new + sizeof(has_t *) * array->value.array.size, 0,
+    memset(new + array->value.array.size, 0,
            sizeof(has_t *) * (n - array->value.array.size));
 
     array->value.array.elements = new;
@@ -550,42 +960,97 @@ has_t * has_array_reallocate(has_t *array, size_t size)
 
 has_t * has_array_push(has_t *array, has_t *value)
 {
-    if(array == NULL) {
+    if(!has_ready(array, has_array) || has_frozen(array)) {
         return NULL;
     }
 
     if(array->value.array.count == array->value.array.size &&
-       (has_array_reallocate(array, array->value.array.size * 2) == NULL)) {
+       (has_array_reallocate(array, array->value.array.count + 1) == NULL)) {
         return NULL;
     }
     array->value.array.elements[array->value.array.count] = value;
     array->value.array.count++;
+    has_touch(array);
     return array;
 }
 
 has_t * has_array_pop(has_t *array)
 {
     has_t *r = NULL;
-    if(array && array->type == has_array && array->value.array.count > 0) {
+    if(has_ready(array, has_array) && !has_frozen(array) &&
+       array->value.array.count > 0) {
         array->value.array.count--;
         r = array->value.array.elements[array->value.array.count];
         array->value.array.elements[array->value.array.count] = NULL;
+        has_detach(r);
+        has_touch(array);
+    }
+    return r;
+}
+
+has_t * has_array_insert(has_t *array, size_t index, has_t *value)
+{
+    has_t **elements;
+
+    if(!has_ready(array, has_array) || has_frozen(array) ||
+       index > array->value.array.count ||
+       (array->value.array.count == array->value.array.size &&
+        has_array_reallocate(array, array->value.array.count + 1) == NULL)) {
+        return NULL;
+    }
+
+    elements = array->value.array.elements;
+    memmove(elements + index + 1, elements + index,
+            (array->value.array.count - index) * sizeof(has_t *));
+    elements[index] = value;
+    array->value.array.count++;
+    has_touch(array);
+    return array;
+}
+
+has_t * has_array_remove(has_t *array, size_t index)
+{
+    has_t **elements, *r;
+
+    if(!has_ready(array, has_array) || has_frozen(array) ||
+       index >= array->value.array.count) {
+        return NULL;
     }
+
+    elements = array->value.array.elements;
+    r = elements[index];
+    array->value.array.count--;
+    memmove(elements + index, elements + index + 1,
+            (array->value.array.count - index) * sizeof(has_t *));
+    elements[array->value.array.count] = NULL;
+    has_detach(r);
+    has_touch(array);
     return r;
 }
 
+has_t * has_array_unshift(has_t *array, has_t *value)
+{
+    return has_array_insert(array, 0, value);
+}
+
+has_t * has_array_shift(has_t *array)
+{
+    return has_array_remove(array, 0);
+}
+
 has_t * has_array_set(has_t *array, size_t index, has_t *value)
 {
-    if(array == NULL || array->type != has_array) {
+    if(!has_ready(array, has_array) || has_frozen(array)) {
         return NULL;
     }
 
-    if(index > array->value.array.size &&
-       (has_array_reallocate(array, index) == NULL)) {
+    if(index >= array->value.array.size &&
+       (has_array_reallocate(array, index + 1) == NULL)) {
         return NULL;
     }
 
     array->value.array.elements[index] = value;
+    has_touch(array);
     if(index >= array->value.array.count) {
         array->value.array.count = index + 1;
     }
@@ -594,14 +1059,20 @@ has_t * has_array_set(has_t *array, size_t index, has_t *value)
 
 has_t * has_array_get(has_t *array, size_t index)
 {
-    return (array && array->type == has_array &&
-            array->value.array.count > index) ?
-        array->value.array.elements[index] : NULL;
+    has_t **elements;
+
+    if(!has_ready(array, has_array) ||
+       array->value.array.count <= index) {
+        return NULL;
+    }
+
+    elements = has_resolve(array, array->value.array.elements);
+    return has_resolve(array, elements[index]);
 }
 
 int has_array_count(has_t *array)
 {
-    return (array && array->type == has_array) ? array->value.array.count : 0;
+    return has_ready(array, has_array) ? array->value.array.count : 0;
 }
 
 has_t * has_string_init(has_t *string, char *pointer, size_t size, bool owner)
@@ -610,7 +1081,7 @@ has_t * has_string_init(has_t *string, char *pointer, size_t size, bool owner)
         return NULL;
     }
 
-    string->type = has_string;
+    has_retype(string, has_string);
     string->value.string.pointer = pointer;
     string->value.string.owner = owner;
     string->value.string.size = size;
@@ -647,7 +1118,19 @@ inline bool has_is_string(has_t *e)
     return (e && e->type == has_string) ? true : false;
 }
 
-has_t * has_null_new(int32_t value)
+const char * has_string_get(has_t *string, size_t *size)
+{
+    if(string == NULL || string->type != has_string) {
+        return NULL;
+    }
+
+    if(size) {
+        *size = string->value.string.size;
+    }
+    return has_resolve(string, string->value.string.pointer);
+}
+
+has_t * has_null_new()
 {
     return has_null_init(has_new(1));
 }
@@ -655,7 +1138,7 @@ has_t * has_null_new(int32_t value)
 has_t * has_null_init(has_t *null)
 {
     if(null) {
-        null->type = has_null;
+        has_retype(null, has_null);
     }
     return null;
 }
@@ -673,7 +1156,7 @@ has_t * has_int_new(int32_t value)
 has_t * has_int_init(has_t *integer, int32_t value)
 {
     if(integer) {
-        integer->type = has_integer;
+        has_retype(integer, has_integer);
         integer->value.integer = value;
     }
     return integer;
@@ -684,42 +1167,143 @@ inline bool has_is_int(has_t *e)
     return (e && e->type == has_integer) ? true : false;
 }
 
+/* Converts the text of a number element, integer is set if the whole
+   text is a 64-bit integer, fp if it is a number. Returns -1 if not. */
+static int has_number_convert(has_t *e, int64_t *integer, double *fp)
+{
+    char local[64], *buffer = local, *end;
+    size_t l;
+    const char *s = has_number_get(e, &l);
+    int r = -1;
+
+    if(s == NULL || l == 0 ||
+       (l >= sizeof(local) && (buffer = has_mem_alloc(l + 1)) == NULL)) {
+        return -1;
+    }
+    memcpy(buffer, s, l);
+    buffer[l] = '\0';
+    if(integer) {
+        long long v;
+        errno = 0;
+        v = strtoll(buffer, &end, 10);
+        if(end == buffer + l && errno == 0) {
+            *integer = v;
+            r = 0;
+        }
+    } else {
+        *fp = strtod(buffer, &end);
+        r = (end == buffer + l) ? 0 : -1;
+    }
+    if(buffer != local) {
+        has_mem_free(buffer);
+    }
+    return r;
+}
+
 int32_t has_int_get(has_t *integer)
 {
+    int64_t v;
+
+    if(integer && integer->type == has_number) {
+        return (has_number_convert(integer, &v, NULL) == 0 &&
+                v >= INT32_MIN && v <= INT32_MAX) ? (int32_t)v : 0;
+    }
     return (integer && integer->type == has_integer) ?  
         integer->value.integer : 0;
 }
 
-has_t * has_bool_new(bool value)
+has_t * has_int64_new(int64_t value)
 {
-    return has_bool_init(has_new(1), value);
+    return has_int64_init(has_new(1), value);
 }
 
-has_t * has_bool_init(has_t *boolean, bool value)
+has_t * has_int64_init(has_t *integer, int64_t value)
 {
-    if(boolean) {
-        boolean->type = has_boolean;
-        boolean->value.boolean = value;
+    if(integer) {
+        has_retype(integer, has_int64);
+        integer->value.integer64 = value;
     }
-    return boolean;
+    return integer;
 }
 
-bool has_bool_get(has_t *boolean)
+inline bool has_is_int64(has_t *e)
 {
-    return (boolean && boolean->type == has_boolean) ?  
-        boolean->value.boolean : 0;
+    return (e && e->type == has_int64) ? true : false;
 }
 
+int64_t has_int64_get(has_t *integer)
+{
+    int64_t v;
 
-has_t * has_double_new(double value)
+    if(integer && integer->type == has_int64) {
+        return integer->value.integer64;
+    } else if(integer && integer->type == has_number) {
+        return (has_number_convert(integer, &v, NULL) == 0) ? v : 0;
+    }
+    return (integer && integer->type == has_integer) ?
+        integer->value.integer : 0;
+}
+
+has_t * has_number_new(char *pointer, size_t size, bool owner)
 {
-    return has_double_init(has_new(1), value);
+    return has_number_init(has_new(1), pointer, size, owner);
 }
 
-has_t * has_double_init(has_t *fp, double value)
+has_t * has_number_init(has_t *number, char *pointer, size_t size, bool owner)
+{
+    if(has_string_init(number, pointer, size, owner)) {
+        has_retype(number, has_number);
+    }
+    return number;
+}
+
+inline bool has_is_number(has_t *e)
+{
+    return (e && e->type == has_number) ? true : false;
+}
+
+const char * has_number_get(has_t *number, size_t *size)
+{
+    if(number == NULL || number->type != has_number) {
+        return NULL;
+    }
+
+    if(size) {
+        *size = number->value.string.size;
+    }
+    return has_resolve(number, number->value.string.pointer);
+}
+
+has_t * has_bool_new(bool value)
+{
+    return has_bool_init(has_new(1), value);
+}
+
+has_t * has_bool_init(has_t *boolean, bool value)
+{
+    if(boolean) {
+        has_retype(boolean, has_boolean);
+        boolean->value.boolean = value;
+    }
+    return boolean;
+}
+
+bool has_bool_get(has_t *boolean)
+{
+    return (boolean && boolean->type == has_boolean) ?  
+        boolean->value.boolean : 0;
+}
+
+
+has_t * has_double_new(double value)
+{
+    return has_double_init(has_new(1), value);
+}
+
+has_t * has_double_init(has_t *fp, double value)
 {
     if(fp) {
-        fp->type = has_double;
+        has_retype(fp, has_double);
         fp->value.fp = value;
     }
     return fp;
@@ -727,6 +1311,11 @@ has_t * has_double_init(has_t *fp, double value)
 
 double has_double_get(has_t *fp)
 {
+    double v;
+
+    if(fp && fp->type == has_number) {
+        return (has_number_convert(fp, NULL, &v) == 0) ? v : 0.0;
+    }
     return (fp && fp->type == has_double) ?  
         fp->value.fp : 0.0;
 }
@@ -751,6 +1340,975 @@ inline bool has_is_pointer(has_t *e)
     return (e && e->type == has_pointer) ? true : false;
 }
 
+/* Containers being built by has_copy_walker() */
+typedef struct {
+    has_t      *e;
+    const char *key;
+    size_t      size;
+} has_copy_frame_t;
+
+typedef struct {
+    has_copy_frame_t *frames;
+    size_t            size;
+    size_t            count;
+    has_t            *last;  /* Last copied element */
+    bool              owner;
+} has_copy_state_t;
+
+static int has_copy_walker(has_t *cur, has_walk_t type, int index,
+                           const char *string, size_t size, has_t *element,
+                           void *pointer)
+{
+    has_copy_state_t *s = pointer;
+    has_copy_frame_t *fr = s->count ? &(s->frames[s->count - 1]) : NULL;
+    has_t *n;
+
+    switch(type) {
+        case has_walk_hash_begin:
+        case has_walk_array_begin:
+            if(s->count == s->size) {
+                size_t l = s->size ? s->size * 2 : WALK_STACK;
+                has_copy_frame_t *t = has_mem_realloc(s->frames, l * sizeof(*t));
+                if(t == NULL) {
+                    return -1;
+                }
+                s->frames = t;
+                s->size = l;
+            }
+            n = (type == has_walk_hash_begin) ?
+                has_hash_new(cur->value.hash.count ? cur->value.hash.count : 1) :
+                has_array_new(cur->value.array.count ? cur->value.array.count : 1);
+            if(n == NULL) {
+                return -1;
+            }
+            s->frames[s->count].e = n;
+            s->frames[s->count++].key = NULL;
+            return 0;
+        case has_walk_hash_key:
+            fr->key = string;
+            fr->size = size;
+            return 0;
+        case has_walk_hash_value_begin:
+        case has_walk_array_entry_begin:
+            if(element == NULL) {
+                s->last = NULL;
+                return HAS_WALK_SKIP;
+            }
+            return 0;
+        case has_walk_hash_value_end: {
+            char *k = (char *)fr->key;
+            if(s->owner && (k = xstrndup(fr->key, fr->size)) == NULL) {
+                has_free(s->last);
+                return -1;
+            }
+            if(has_hash_set_o(fr->e, k, fr->size, s->last, s->owner) == NULL) {
+                if(s->owner) {
+                    has_mem_free(k);
+                }
+                has_free(s->last);
+                return -1;
+            }
+            return 0;
+        }
+        case has_walk_array_entry_end:
+            if(has_array_push(fr->e, s->last) == NULL) {
+                has_free(s->last);
+                return -1;
+            }
+            return 0;
+        case has_walk_hash_end:
+        case has_walk_array_end:
+            s->last = fr->e;
+            s->count--;
+            return 0;
+        case has_walk_string: {
+            char *c = (char *)string;
+            if(s->owner && (c = xstrndup(string, size)) == NULL) {
+                return -1;
+            }
+            if((s->last = has_string_new_o(c, size, s->owner)) == NULL) {
+                if(s->owner) {
+                    has_mem_free(c);
+                }
+                return -1;
+            }
+            return 0;
+        }
+        default:
+            if((s->last = has_new(1)) == NULL) {
+                return -1;
+            }
+            if(cur->type == has_number) {
+                char *c;
+                size_t l;
+                string = has_number_get(cur, &l);
+                if((c = s->owner ? xstrndup(string, l) : (char *)string) == NULL) {
+                    has_free(s->last);
+                    return -1;
+                }
+                has_number_init(s->last, c, l, s->owner);
+                return 0;
+            }
+            has_retype(s->last, cur->type);
+            s->last->value = cur->value;
+            return 0;
+    }
+}
+
+has_t * has_copy(has_t *e, bool owner)
+{
+    has_copy_state_t s;
+
+    if(e == NULL) {
+        return NULL;
+    }
+
+    memset(&s, 0, sizeof(s));
+    s.owner = owner;
+    if(has_walk(e, has_copy_walker, &s) != 0) {
+        /* Elements built so far are attached to the root */
+        if(s.count > 0) {
+            has_free(s.frames[0].e);
+        }
+        has_mem_free(s.frames);
+        return NULL;
+    }
+    has_mem_free(s.frames);
+    return s.last;
+}
+
+/* Pairs of elements remaining to compare in has_equal() */
+typedef struct {
+    has_t *a;
+    has_t *b;
+} has_equal_pair_t;
+
+#define has_type(e) ((e) ? (e)->type : has_null)
+#define has_container(e) ((e) && ((e)->type == has_hash || (e)->type == has_array))
+
+static void has_memo_reset(has_memo_t *m)
+{
+    while(m && m->valid) {
+        m->valid = false;
+        m = m->up;
+    }
+}
+
+/* Drops a reference, a memo is freed with the links it holds once
+   neither its owner nor a memo below refers to it */
+static void has_memo_release(has_memo_t *m)
+{
+    has_memo_t *up;
+
+    while(m && --m->refs == 0) {
+        up = m->up;
+        has_mem_free(m);
+        m = up;
+    }
+}
+
+static void has_memo_link(has_memo_t *m, has_memo_t *up)
+{
+    if(up) {
+        up->refs++;
+    }
+    has_memo_release(m->up);
+    m->up = up;
+}
+
+static has_memo_t *has_memo_new(has_t *e)
+{
+    if(!(e->flags & HAS_DIGEST)) {
+        if((has_memo(e) = has_mem_calloc(1, sizeof(has_memo_t))) == NULL) {
+            return NULL;
+        }
+        has_memo(e)->refs = 1;
+        e->flags |= HAS_DIGEST;
+    }
+    return has_memo(e);
+}
+
+static bool has_memo_get(has_t *e, has_digest_t *digest)
+{
+    if(e == NULL || !(e->flags & HAS_DIGEST) || !has_memo(e)->valid) {
+        return false;
+    }
+    if(digest) {
+        *digest = has_memo(e)->digest;
+    }
+    return true;
+}
+
+static void has_memo_set(has_t *e, const has_digest_t *digest)
+{
+    has_memo(e)->digest = *digest;
+    has_memo(e)->valid = true;
+}
+
+bool has_digest_memoized(has_t *e, has_digest_t *digest)
+{
+    return has_memo_get(e, digest);
+}
+
+/* Compares types and scalar values, or sizes and digests (if
+   memoized) of containers */
+static bool has_equal_shallow(has_t *a, has_t *b)
+{
+    has_digest_t da, db;
+
+    if(a == b) {
+        return true;
+    }
+    if(has_type(a) != has_type(b)) {
+        return false;
+    }
+
+    switch(has_type(a)) {
+        case has_null:
+            return true;
+        case has_hash:
+        case has_array:
+            if(has_materialize(a) < 0 || has_materialize(b) < 0) {
+                return false;
+            }
+            if(has_type(a) == has_hash ?
+               (a->value.hash.count != b->value.hash.count) :
+               (a->value.array.count != b->value.array.count)) {
+                return false;
+            }
+            /* Memos are current, differing digests imply differences */
+            return (!has_memo_get(a, &da) || !has_memo_get(b, &db) ||
+                    (da.low == db.low && da.high == db.high));
+        case has_string: {
+            size_t l = a->value.string.size;
+            return (l == b->value.string.size) &&
+                (l == 0 || memcmp(has_string_get(a, NULL),
+                                  has_string_get(b, NULL), l) == 0);
+        }
+        case has_number: {
+            /* Same text, "1.0" and "1" differ */
+            size_t l = a->value.string.size;
+            return (l == b->value.string.size) &&
+                (l == 0 || memcmp(has_number_get(a, NULL),
+                                  has_number_get(b, NULL), l) == 0);
+        }
+        case has_integer:
+            return a->value.integer == b->value.integer;
+        case has_int64:
+            return a->value.integer64 == b->value.integer64;
+        case has_boolean:
+            return a->value.boolean == b->value.boolean;
+        case has_double:
+            return a->value.fp == b->value.fp;
+        case has_pointer:
+            return a->value.pointer == b->value.pointer;
+    }
+    return false;
+}
+
+bool has_equal(has_t *a, has_t *b)
+{
+    has_equal_pair_t local[WALK_STACK], *stack = local, *t;
+    size_t size = WALK_STACK, count = 0, i;
+    bool r = true;
+
+#define PUSH(x, y)                                                      \
+    if(count == size) {                                                 \
+        if((t = (stack == local) ? has_mem_alloc(2 * size * sizeof(*t)) : \
+            has_mem_realloc(stack, 2 * size * sizeof(*t))) == NULL) {   \
+            r = false;                                                  \
+            break;                                                      \
+        }                                                               \
+        if(stack == local) {                                            \
+            memcpy(t, local, sizeof(local));                            \
+        }                                                               \
+        stack = t;                                                      \
+        size *= 2;                                                      \
+    }                                                                   \
+    stack[count].a = (x);                                               \
+    stack[count++].b = (y);
+
+    if(!has_equal_shallow(a, b)) {
+        return false;
+    }
+    if(has_container(a) && a != b) {
+        stack[count].a = a;
+        stack[count++].b = b;
+    }
+
+    /* Scalars are compared in place, containers are pushed */
+    while(r && count > 0) {
+        count--;
+        a = stack[count].a;
+        b = stack[count].b;
+
+        if(a->type == has_hash) {
+            has_hash_entry_t *entries = has_resolve(a, a->value.hash.entries);
+            for(i = 0; i < a->value.hash.size; i++) {
+                has_hash_entry_t *l = &(entries[i]), *m;
+                has_t *va, *vb;
+                if(l->key.pointer == NULL) {
+                    continue;
+                }
+                if((m = has_hash_lookup(b, has_resolve(a, l->key.pointer),
+                                        l->key.size, l->hash, NULL)) == NULL) {
+                    r = false;
+                    break;
+                }
+                va = has_resolve(a, l->value);
+                vb = has_resolve(b, m->value);
+                if(!has_equal_shallow(va, vb)) {
+                    r = false;
+                    break;
+                }
+                if(has_container(va) && va != vb) {
+                    PUSH(va, vb);
+                }
+            }
+        } else {
+            has_t **ea = has_resolve(a, a->value.array.elements);
+            has_t **eb = has_resolve(b, b->value.array.elements);
+            for(i = 0; i < a->value.array.count; i++) {
+                has_t *va = has_resolve(a, ea[i]), *vb = has_resolve(b, eb[i]);
+                if(!has_equal_shallow(va, vb)) {
+                    r = false;
+                    break;
+                }
+                if(has_container(va) && va != vb) {
+                    PUSH(va, vb);
+                }
+            }
+        }
+    }
+#undef PUSH
+
+    if(stack != local) {
+        has_mem_free(stack);
+    }
+    return r;
+}
+
+/* Digest tags, also used as seeds */
+enum {
+    digest_null = 0x6e756c6c,
+    digest_hash,
+    digest_key,
+    digest_entry,
+    digest_array,
+    digest_string,
+    digest_integer,
+    digest_boolean,
+    digest_double,
+    digest_pointer,
+    digest_number
+};
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t has_digest_fmix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= UINT64_C(0xff51afd7ed558ccd);
+    k ^= k >> 33;
+    k *= UINT64_C(0xc4ceb9fe1a85ec53);
+    k ^= k >> 33;
+    return k;
+}
+
+static uint64_t has_digest_load(const uint8_t *p, size_t l)
+{
+    uint64_t r = 0;
+    while(l-- > 0) {
+        r = (r << 8) | p[l];
+    }
+    return r;
+}
+
+/*
+ * MurmurHash3_x64_128 by Austin Appleby (public domain), with
+ * little-endian loads so that digests do not depend on the platform.
+ */
+static void has_digest_bytes(uint32_t seed, const void *data, size_t len,
+                             has_digest_t *out)
+{
+    const uint8_t *p = data;
+    const uint64_t c1 = UINT64_C(0x87c37b91114253d5);
+    const uint64_t c2 = UINT64_C(0x4cf5ad432745937f);
+    uint64_t h1 = seed, h2 = seed, k1, k2;
+    size_t i, n = len / 16;
+
+    for(i = 0; i < n; i++, p += 16) {
+        k1 = has_digest_load(p, 8);
+        k2 = has_digest_load(p + 8, 8);
+
+        k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    n = len & 15;
+    if(n > 8) {
+        k2 = has_digest_load(p + 8, n - 8);
+        k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    if(n > 0) {
+        k1 = has_digest_load(p, n > 8 ? 8 : n);
+        k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len; h2 ^= len;
+    h1 += h2; h2 += h1;
+    h1 = has_digest_fmix(h1);
+    h2 = has_digest_fmix(h2);
+    h1 += h2; h2 += h1;
+    out->low = h1;
+    out->high = h2;
+}
+
+/* Digest of up to 4 words, serialized in little-endian order */
+static void has_digest_words(uint32_t tag, const uint64_t *words, int n,
+                             has_digest_t *out)
+{
+    uint8_t buffer[32] = { 0 };
+    int i, j;
+
+    for(i = 0; i < n; i++) {
+        for(j = 0; j < 8; j++) {
+            buffer[i * 8 + j] = (uint8_t)(words[i] >> (8 * j));
+        }
+    }
+    has_digest_bytes(tag, buffer, n * 8, out);
+}
+
+static void has_digest_scalar(has_t *e, has_digest_t *out)
+{
+    uint64_t w;
+
+    switch(has_type(e)) {
+        case has_string:
+            has_digest_bytes(digest_string, has_resolve(e, e->value.string.pointer),
+                             e->value.string.size, out);
+            return;
+        case has_number:
+            has_digest_bytes(digest_number, has_resolve(e, e->value.string.pointer),
+                             e->value.string.size, out);
+            return;
+        case has_integer:
+            w = (uint64_t)(int64_t)e->value.integer;
+            has_digest_words(digest_integer, &w, 1, out);
+            return;
+        case has_int64:
+            w = (uint64_t)e->value.integer64;
+            has_digest_words(digest_integer, &w, 1, out);
+            return;
+        case has_boolean:
+            w = e->value.boolean ? 1 : 0;
+            has_digest_words(digest_boolean, &w, 1, out);
+            return;
+        case has_double: {
+            /* Equal values must have the same digest: 0.0 == -0.0 */
+            double fp = (e->value.fp == 0.0) ? 0.0 : e->value.fp;
+            memcpy(&w, &fp, sizeof(w));
+            has_digest_words(digest_double, &w, 1, out);
+            return;
+        }
+        case has_pointer:
+            w = (uintptr_t)e->value.pointer;
+            has_digest_words(digest_pointer, &w, 1, out);
+            return;
+        default:
+            has_digest_words(digest_null, NULL, 0, out);
+            return;
+    }
+}
+
+/* Containers being digested by has_digest_walker() */
+typedef struct {
+    has_t        *e;
+    has_digest_t  accumulator;
+    has_digest_t  key;
+    bool          memoized;
+    bool          transient; /* The digest of e is not memoized */
+} has_digest_frame_t;
+
+typedef struct {
+    has_digest_frame_t *frames;
+    size_t              size;
+    size_t              count;
+    has_digest_t        last;  /* Digest of the last completed element */
+} has_digest_state_t;
+
+static int has_digest_walker(has_t *cur, has_walk_t type, int index,
+                             const char *string, size_t size, has_t *element,
+                             void *pointer)
+{
+    has_digest_state_t *s = pointer;
+    has_digest_frame_t *fr = s->count ? &(s->frames[s->count - 1]) : NULL;
+    uint64_t w[4];
+
+    switch(type) {
+        case has_walk_hash_begin:
+        case has_walk_array_begin: {
+            has_digest_t memo;
+            if(s->count == s->size) {
+                size_t n = s->size ? s->size * 2 : WALK_STACK;
+                has_digest_frame_t *t = has_mem_realloc(s->frames, n * sizeof(*t));
+                if(t == NULL) {
+                    return -1;
+                }
+                s->frames = t;
+                s->size = n;
+            }
+            fr = &(s->frames[s->count++]);
+            memset(fr, 0, sizeof(*fr));
+            fr->e = cur;
+            if(has_memo_get(cur, &memo)) {
+                fr->accumulator = memo;
+                fr->memoized = true;
+                return HAS_WALK_SKIP;
+            }
+            /* Created first, the memos of the containers held link to it */
+            fr->transient = has_frozen(cur) || has_memo_new(cur) == NULL;
+            return 0;
+        }
+        case has_walk_hash_key:
+            has_digest_bytes(digest_key, string, size, &(fr->key));
+            return 0;
+        case has_walk_hash_value_begin:
+        case has_walk_array_entry_begin:
+            if(element == NULL) {
+                /* NULL values are digested as null elements */
+                has_digest_scalar(NULL, &(s->last));
+                return HAS_WALK_SKIP;
+            }
+            return 0;
+        case has_walk_hash_value_end: {
+            has_digest_t d;
+            w[0] = fr->key.low; w[1] = fr->key.high;
+            w[2] = s->last.low; w[3] = s->last.high;
+            has_digest_words(digest_entry, w, 4, &d);
+            /* Commutative accumulation: insertion order is irrelevant */
+            fr->accumulator.low += d.low;
+            fr->accumulator.high += d.high;
+            return 0;
+        }
+        case has_walk_array_entry_end:
+            w[0] = fr->accumulator.low; w[1] = fr->accumulator.high;
+            w[2] = s->last.low; w[3] = s->last.high;
+            has_digest_words(digest_array, w, 4, &(fr->accumulator));
+            return 0;
+        case has_walk_hash_end:
+        case has_walk_array_end:
+            if(fr->memoized) {
+                s->last = fr->accumulator;
+            } else {
+                w[0] = (type == has_walk_hash_end) ?
+                    cur->value.hash.count : cur->value.array.count;
+                w[1] = fr->accumulator.low;
+                w[2] = fr->accumulator.high;
+                has_digest_words((type == has_walk_hash_end) ?
+                                 digest_hash : digest_array, w, 3, &(s->last));
+                if(!fr->transient) {
+                    has_memo_set(cur, &(s->last));
+                }
+            }
+            s->count--;
+            /* Links the memo to the one of the container holding cur.
+               Otherwise modifying cur would not reset the latter, which
+               is then not memoized. Frozen elements never change. */
+            if(s->count > 0 && !has_frozen(cur) && !fr[-1].transient) {
+                has_memo_t *m = (cur->flags & HAS_DIGEST) ? has_memo(cur) : NULL;
+                has_memo_t *up = has_memo(fr[-1].e);
+                if(m == NULL || !m->valid ||
+                   (m->up && m->up != up && m->up->valid)) {
+                    fr[-1].transient = true;
+                } else if(m->up != up) {
+                    has_memo_link(m, up);
+                }
+            }
+            return 0;
+        default:
+            has_digest_scalar(cur, &(s->last));
+            return 0;
+    }
+}
+
+int has_digest(has_t *e, has_digest_t *digest)
+{
+    has_digest_state_t s;
+    int r;
+
+    if(digest == NULL) {
+        return -1;
+    }
+    if(e == NULL) {
+        has_digest_scalar(NULL, digest);
+        return 0;
+    }
+
+    memset(&s, 0, sizeof(s));
+    r = has_walk(e, has_digest_walker, &s);
+    has_mem_free(s.frames);
+    if(r != 0) {
+        return -1;
+    }
+    *digest = s.last;
+    return 0;
+}
+
+has_t * has_lazy_new(has_types type, const has_lazy_t *lazy)
+{
+    has_t *r;
+
+    if((type != has_hash && type != has_array) || lazy == NULL ||
+       lazy->materialize == NULL || (r = has_new(1)) == NULL) {
+        return NULL;
+    }
+    has_retype(r, type);
+    r->flags |= HAS_LAZY;
+    r->value.lazy = *lazy;
+    return r;
+}
+
+int has_materialize(has_t *e)
+{
+    has_lazy_t lazy;
+
+    if(e == NULL || !(e->flags & HAS_LAZY)) {
+        return 0;
+    }
+    /* The callback fills an empty container */
+    lazy = e->value.lazy;
+    e->flags &= ~HAS_LAZY;
+    memset(&(e->value), 0, sizeof(e->value));
+    if(lazy.materialize(e, &lazy) < 0) {
+        e->flags |= HAS_LAZY;
+        e->value.lazy = lazy;
+        return -1;
+    }
+    return 0;
+}
+
+void has_digest_invalidate(has_t *e)
+{
+    if(e && !has_frozen(e)) {
+        has_touch(e);
+    }
+}
+
+static int has_memory_walker(has_t *cur, has_walk_t type, int index,
+                             const char *string, size_t size,
+                             has_t *element, void *pointer)
+{
+    has_memory_usage_t *u = pointer;
+    size_t i;
+
+    switch(type) {
+        case has_walk_hash_begin: {
+            has_hash_entry_t *entries = has_resolve(cur, cur->value.hash.entries);
+            u->nodes += sizeof(has_t);
+            u->hash_entries += cur->value.hash.size * sizeof(has_hash_entry_t);
+            u->hash_index += hash_size(cur->value.hash.size) * sizeof(has_hash_entry_t *) +
+                (has_frozen(cur) ? 0 : sizeof(has_hash_header_t));
+            for(i = 0; i < cur->value.hash.size; i++) {
+                if(entries[i].key.pointer == NULL) {
+                    continue;
+                }
+                if(entries[i].key.owner && !has_frozen(cur)) {
+                    u->owned_strings += entries[i].key.size;
+                } else {
+                    u->borrowed_strings += entries[i].key.size;
+                }
+            }
+            if(cur->flags & HAS_DIGEST) {
+                u->digests += sizeof(has_memo_t);
+            }
+            break;
+        }
+        case has_walk_array_begin:
+            u->nodes += sizeof(has_t);
+            u->array_elements += cur->value.array.count * sizeof(has_t *);
+            u->array_slack += (cur->value.array.size - cur->value.array.count) *
+                sizeof(has_t *);
+            if(cur->flags & HAS_DIGEST) {
+                u->digests += sizeof(has_memo_t);
+            }
+            break;
+        case has_walk_string:
+            u->nodes += sizeof(has_t);
+            if(cur->value.string.owner && !has_frozen(cur)) {
+                u->owned_strings += size;
+            } else {
+                u->borrowed_strings += size;
+            }
+            break;
+        case has_walk_other:
+            u->nodes += sizeof(has_t);
+            if(cur->type == has_number) {
+                if(cur->value.string.owner && !has_frozen(cur)) {
+                    u->owned_strings += cur->value.string.size;
+                } else {
+                    u->borrowed_strings += cur->value.string.size;
+                }
+            }
+            break;
+        case has_walk_hash_value_begin:
+        case has_walk_array_entry_begin:
+            /* Hash values can be NULL */
+            return element ? 0 : HAS_WALK_SKIP;
+        default:
+            break;
+    }
+    return 0;
+}
+
+int has_memory_usage(has_t *e, has_memory_usage_t *usage)
+{
+    if(usage == NULL) {
+        return -1;
+    }
+    memset(usage, 0, sizeof(has_memory_usage_t));
+    if(has_walk(e, has_memory_walker, usage) != 0) {
+        return -1;
+    }
+    usage->total = usage->nodes + usage->hash_entries + usage->hash_index +
+        usage->array_elements + usage->array_slack + usage->owned_strings +
+        usage->digests;
+    return 0;
+}
+
+int has_counters(has_counters_t *c)
+{
+    if(c == NULL) {
+        return -1;
+    }
+#ifdef HAS_COUNTERS
+    {
+        int i;
+        for(i = 0; i <= has_number; i++) {
+            c->elements[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+#else
+    memset(c, 0, sizeof(has_counters_t));
+    return -1;
+#endif
+}
+
+/* Frozen images: a header followed by has_t elements whose pointer
+   fields contain offsets relative to the field itself. All blocks are
+   aligned on 8 bytes. */
+
+#define IMAGE_MAGIC "has-img"
+#define IMAGE_CHECK 0x01020304
+#define image_align(s) (((s) + 7) & ~((size_t)7))
+
+typedef struct {
+    char     magic[8];
+    uint32_t check;    /* Byte order check */
+    uint16_t element;  /* sizeof(has_t) */
+    uint16_t pointer;  /* sizeof(void *) */
+    uint64_t size;     /* Size of the image */
+    uint64_t root;     /* Offset of root element */
+} has_image_header_t;
+
+typedef struct {
+    char   *buffer;
+    size_t  size;
+    size_t  current;
+} has_freezer_t;
+
+#define freezer_at(f, o, t) ((t *)((f)->buffer + (o)))
+
+/* Reserves a zeroed block and returns its offset or 0 on failure */
+static size_t has_freezer_reserve(has_freezer_t *f, size_t size)
+{
+    size_t o = f->current, n = image_align(f->current + size);
+
+    if(n > f->size) {
+        char *t;
+        size_t s = f->size * 2;
+        while(s < n) s = s * 2;
+        if((t = has_mem_realloc(f->buffer, s)) == NULL) {
+            return 0;
+        }
+        f->buffer = t;
+        f->size = s;
+    }
+    memset(f->buffer + o, 0, n - o);
+    f->current = n;
+    return o;
+}
+
+/* Stores in the pointer field at offset field the offset of target */
+static void has_freezer_link(has_freezer_t *f, size_t field, size_t target)
+{
+    intptr_t d = (intptr_t)target - (intptr_t)field;
+    memcpy(f->buffer + field, &d, sizeof(d));
+}
+
+static int has_freezer_string(has_freezer_t *f, size_t field,
+                              const char *string, size_t size)
+{
+    size_t o;
+    if((o = has_freezer_reserve(f, size + 1)) == 0) {
+        return -1;
+    }
+    memcpy(f->buffer + o, string, size);
+    has_freezer_link(f, field, o);
+    return 0;
+}
+
+/* Freezes e into the element already reserved at offset at. Offsets are
+   used instead of pointers as the buffer can be reallocated. */
+static int has_freezer_element(has_freezer_t *f, has_t *e, size_t at)
+{
+    size_t i, j, o, t, n;
+
+    if(has_materialize(e) < 0) {
+        return -1;
+    }
+    freezer_at(f, at, has_t)->type = e->type;
+    freezer_at(f, at, has_t)->flags = HAS_FROZEN;
+
+    switch(e->type) {
+        case has_hash: {
+            has_hash_entry_t *entries = has_resolve(e, e->value.hash.entries);
+            size_t size = e->value.hash.count, slots = hash_size(size);
+            if((o = has_freezer_reserve(f, size * sizeof(has_hash_entry_t))) == 0 ||
+               (t = has_freezer_reserve(f, slots * sizeof(has_hash_entry_t *))) == 0 ||
+               (n = has_freezer_reserve(f, e->value.hash.count * sizeof(has_t))) == 0) {
+                return -1;
+            }
+            freezer_at(f, at, has_t)->value.hash.size = size;
+            freezer_at(f, at, has_t)->value.hash.count = e->value.hash.count;
+            has_freezer_link(f, at + offsetof(has_t, value.hash.entries), o);
+            has_freezer_link(f, at + offsetof(has_t, value.hash.hash), t);
+
+            for(i = 0, j = 0; i < e->value.hash.size; i++) {
+                has_hash_entry_t *l = &(entries[i]);
+                size_t c = o + j * sizeof(has_hash_entry_t), k;
+                has_t *v = has_resolve(e, l->value);
+                if(l->key.pointer == NULL) {
+                    continue;
+                }
+
+                freezer_at(f, c, has_hash_entry_t)->hash = l->hash;
+                freezer_at(f, c, has_hash_entry_t)->key.size = l->key.size;
+                if(has_freezer_string(f, c + offsetof(has_hash_entry_t, key.pointer),
+                                      has_resolve(e, l->key.pointer),
+                                      l->key.size) < 0) {
+                    return -1;
+                }
+                if(v) {
+                    has_freezer_link(f, c + offsetof(has_hash_entry_t, value),
+                                     n + j * sizeof(has_t));
+                    if(has_freezer_element(f, v, n + j * sizeof(has_t)) < 0) {
+                        return -1;
+                    }
+                }
+
+                /* Same probing as has_hash_set_o() */
+                for(k = l->hash % slots;
+                    *freezer_at(f, t + k * sizeof(has_hash_entry_t *), intptr_t);
+                    k = (k + 1 == slots) ? 0 : k + 1) /* Nothing */ ;
+                has_freezer_link(f, t + k * sizeof(has_hash_entry_t *), c);
+                j++;
+            }
+            break;
+        }
+        case has_array: {
+            has_t **elements = has_resolve(e, e->value.array.elements);
+            size_t count = e->value.array.count;
+            freezer_at(f, at, has_t)->value.array.size = count;
+            freezer_at(f, at, has_t)->value.array.count = count;
+            if(count == 0) {
+                break;
+            }
+            if((o = has_freezer_reserve(f, count * sizeof(has_t *))) == 0 ||
+               (n = has_freezer_reserve(f, count * sizeof(has_t))) == 0) {
+                return -1;
+            }
+            has_freezer_link(f, at + offsetof(has_t, value.array.elements), o);
+            for(i = 0; i < count; i++) {
+                has_t *v = has_resolve(e, elements[i]);
+                if(v) {
+                    has_freezer_link(f, o + i * sizeof(has_t *), n + i * sizeof(has_t));
+                    if(has_freezer_element(f, v, n + i * sizeof(has_t)) < 0) {
+                        return -1;
+                    }
+                }
+            }
+            break;
+        }
+        case has_string:
+        case has_number:
+            freezer_at(f, at, has_t)->value.string.size = e->value.string.size;
+            return has_freezer_string(f, at + offsetof(has_t, value.string.pointer),
+                                      has_resolve(e, e->value.string.pointer),
+                                      e->value.string.size);
+        case has_pointer:
+            return -1;
+        default:
+            freezer_at(f, at, has_t)->value = e->value;
+            break;
+    }
+    return 0;
+}
+
+int has_freeze(has_t *input, char **output, size_t *size)
+{
+    has_freezer_t f;
+    has_image_header_t *h;
+    size_t root;
+
+    if(input == NULL || output == NULL || size == NULL ||
+       sizeof(intptr_t) != sizeof(void *) ||
+       (f.buffer = has_mem_alloc(4096)) == NULL) {
+        return -1;
+    }
+    f.size = 4096;
+    f.current = image_align(sizeof(has_image_header_t));
+    memset(f.buffer, 0, f.current);
+
+    if((root = has_freezer_reserve(&f, sizeof(has_t))) == 0 ||
+       has_freezer_element(&f, input, root) < 0) {
+        has_mem_free(f.buffer);
+        return -1;
+    }
+
+    h = freezer_at(&f, 0, has_image_header_t);
+    memcpy(h->magic, IMAGE_MAGIC, sizeof(h->magic));
+    h->check = IMAGE_CHECK;
+    h->element = sizeof(has_t);
+    h->pointer = sizeof(void *);
+    h->size = f.current;
+    h->root = root;
+
+    *output = f.buffer;
+    *size = f.current;
+    return 0;
+}
+
+has_t * has_thaw(const void *image, size_t size)
+{
+    const has_image_header_t *h = image;
+
+    if(image == NULL || ((uintptr_t)image & 7) ||
+       size < sizeof(has_image_header_t) ||
+       memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic)) != 0 ||
+       h->check != IMAGE_CHECK || h->element != sizeof(has_t) ||
+       h->pointer != sizeof(void *) || h->size > size || (h->root & 7) ||
+       h->root < sizeof(has_image_header_t) ||
+       h->root + sizeof(has_t) > h->size) {
+        return NULL;
+    }
+
+    return (has_t *)((const char *)image + h->root);
+}
+
 #define SuperFastHash has_hash_function
 
 /*
@@ -791,7 +2349,7 @@ uint32_t SuperFastHash (const char * data, int len) {
     switch (rem) {
         case 3: hash += get16bits (data);
                 hash ^= hash << 16;
-                hash ^= data[sizeof (uint16_t)] << 18;
+                hash ^= (uint32_t)(signed char)data[sizeof (uint16_t)] << 18;
                 hash += hash >> 11;
                 break;
         case 2: hash += get16bits (data);
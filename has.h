@@ -28,7 +28,9 @@ typedef enum {
     has_integer,  /** Integer           */
     has_boolean,  /** Boolean           */
     has_double,   /** Floating point    */
-    has_pointer   /** Pointer           */
+    has_pointer,  /** Pointer           */
+    has_int64,    /** 64-bit integer    */
+    has_number    /** Number as text    */
 } has_types;
 
 /**
@@ -88,6 +90,23 @@ typedef struct {
     bool      owner;
 } has_string_t;
 
+/**
+ * @struct has_digest_t
+ * @brief 128-bit structural digest @see has_digest
+ */
+typedef struct {
+    /** Low 64 bits */
+    uint64_t low;
+    /** High 64 bits */
+    uint64_t high;
+} has_digest_t;
+
+/**
+ * @struct has_memo_t
+ * @brief Memoized digest of a container (private) @see HAS_DIGEST
+ */
+typedef struct has_memo_t has_memo_t;
+
 /**
  * @struct has_array_t
  * @brief Array Structure
@@ -99,8 +118,27 @@ typedef struct {
     size_t      size;
     /** Number of elements present  */
     size_t      count;
+    /** Memoized digest (valid if #HAS_DIGEST is set) */
+    has_memo_t *memo;
 } has_array_t;
 
+/**
+ * @struct has_lazy_t
+ * @brief Content of a container built on first access @see HAS_LAZY
+ */
+typedef struct has_lazy_t has_lazy_t;
+struct has_lazy_t {
+    /** Source of the content */
+    void    *source;
+    /** Position of the content in the source */
+    size_t   index;
+    /** Fills the empty container e, returns 0 or -1 (e must then be
+        left empty) */
+    int    (*materialize)(has_t *e, has_lazy_t *lazy);
+    /** Called if the container is freed before being built */
+    void   (*release)(has_lazy_t *lazy);
+};
+
 /**
  * @struct has_hash_entry_t
  * @brief Associative Array Sub-structure
@@ -138,7 +176,7 @@ typedef union {
     has_array_t array;
     /** Associative Array */
     has_hash_t hash;
-    /** String */
+    /** String, or text of a number */
     has_string_t string;
     /** Unsigned Integer */
     uint32_t uint;
@@ -150,8 +188,39 @@ typedef union {
     bool boolean;
     /** Pointer */
     void *pointer;
+    /** 64-bit Signed Integer */
+    int64_t integer64;
+    /** Lazy container (valid if #HAS_LAZY is set) */
+    has_lazy_t lazy;
 } has_value_t;
 
+/**
+ * @def HAS_FROZEN
+ * @brief Flag set on elements stored in a frozen image (see has_freeze()).
+ *
+ * The pointers contained in a frozen element (string content, hash
+ * entries, hash index, keys, values and array elements) hold offsets
+ * relative to the address of the field itself, which makes the image
+ * position-independent. Such elements are read-only.
+ */
+#define HAS_FROZEN (1 << 0)
+
+/**
+ * @def HAS_DIGEST
+ * @brief Flag set on hash and array elements holding a memoized digest
+ * (see has_digest()). Modifying such a container, or a container it
+ * holds, resets it.
+ */
+#define HAS_DIGEST (1 << 1)
+
+/**
+ * @def HAS_LAZY
+ * @brief Flag set on hash and array elements whose content has not
+ * been built yet (see has_lazy_new()). It is built by the first
+ * function accessing it, or by has_materialize().
+ */
+#define HAS_LAZY (1 << 2)
+
 struct has_t {
     /** Value of has_t element */
     has_value_t value;
@@ -159,6 +228,8 @@ struct has_t {
     unsigned char type;
     /** Flag specifying if has_t element can be deallocated */
     bool owner;
+    /** Storage flags of has_t element @see HAS_FROZEN HAS_DIGEST */
+    unsigned char flags;
 };
 
 /**
@@ -177,6 +248,84 @@ typedef int (*has_walk_function_t)(has_t *cur, has_walk_t type, int index,
                                    const char *string, size_t size,
                                    has_t *element, void *pointer);
 
+/**
+ * @def HAS_WALK_SKIP
+ * @brief Value returned by a has_walk() callback to skip a subtree.
+ *
+ * When returned for #has_walk_hash_begin or #has_walk_array_begin the
+ * entries of the element are not visited, when returned for
+ * #has_walk_hash_value_begin or #has_walk_array_entry_begin the value
+ * is not traversed. The matching end event is still sent. For other
+ * events it has the same effect as 0. Any other non-zero value aborts
+ * the traversal.
+ */
+#define HAS_WALK_SKIP 0x7FFFFFFF
+
+/**
+ * @struct has_walker_t
+ * @brief Reusable state for has_walker_walk()
+ */
+typedef struct has_walker_t has_walker_t;
+
+/**
+ * @struct has_allocator_t
+ * @brief Memory allocation functions used by the library
+ */
+typedef struct has_allocator_t {
+    /** Allocates size bytes, like malloc() */
+    void * (*allocate)(void *context, size_t size);
+    /** Resizes a block, like realloc() */
+    void * (*reallocate)(void *context, void *pointer, size_t size);
+    /** Releases a block (possibly @c NULL), like free() */
+    void   (*release)(void *context, void *pointer);
+    /** Opaque pointer passed to the functions */
+    void    *context;
+} has_allocator_t;
+
+/**
+ * @brief Sets the allocator used for all allocations of the library
+ * @param allocator Pointer to the allocator (copied), @c NULL restores
+ * malloc(), realloc() and free().
+ * @return void
+ *
+ * Must be called before any has_t structure is created: memory is
+ * released with the allocator in place at that time. Buffers given to
+ * the library with ownership (strings, keys) must be allocated with
+ * has_mem_alloc(), buffers returned to the caller (serialized output,
+ * key lists, ...) must be released with has_mem_free().
+ */
+void has_set_allocator(const has_allocator_t *allocator);
+
+/**
+ * @brief Allocates memory with the configured allocator
+ * @param size Number of bytes
+ * @return A pointer to the memory or @c NULL.
+ */
+void * has_mem_alloc(size_t size);
+
+/**
+ * @brief Allocates zeroed memory with the configured allocator
+ * @param count Number of members
+ * @param size  Size of a member
+ * @return A pointer to the memory or @c NULL.
+ */
+void * has_mem_calloc(size_t count, size_t size);
+
+/**
+ * @brief Resizes memory with the configured allocator
+ * @param pointer Memory to resize or @c NULL
+ * @param size    New size in bytes
+ * @return A pointer to the memory or @c NULL (pointer is unchanged).
+ */
+void * has_mem_realloc(void *pointer, size_t size);
+
+/**
+ * @brief Releases memory with the configured allocator
+ * @param pointer Memory to release or @c NULL
+ * @return void
+ */
+void has_mem_free(void *pointer);
+
 /**
  * @brief Allocates one or several has_t element(s)
  * @param count
@@ -188,6 +337,8 @@ has_t * has_new(size_t count);
  * @brief Frees the content of a has_t structure
  * @param  e    Pointer to has_t structure
  * @return void
+ *
+ * The structure is traversed iteratively, its depth is not limited.
  */
 void has_free(has_t *e);
 
@@ -202,9 +353,43 @@ void has_set_owner(has_t *e, bool owner);
 /**
  * @brief Calls callback function during traversal of a has_t
  * structure.
+ * @param [in] e Pointer to has_t structure to traverse
+ * @param [in] f Callback function
+ * @param [in] p Pointer passed to the callback function
+ * @return 0 if the traversal completed, the non-zero value returned
+ * by the callback if aborted, -1 on failure.
+ *
+ * The traversal is iterative: nesting depth only consumes heap memory
+ * (beyond a small stack buffer). @see HAS_WALK_SKIP
  */
 int has_walk(has_t *e, has_walk_function_t f, void *p);
 
+/**
+ * @brief Allocates a walker keeping its traversal stack between calls
+ * @return A pointer to the walker or @c NULL.
+ */
+has_walker_t * has_walker_new(void);
+
+/**
+ * @brief Traverses a has_t structure like has_walk() using the stack
+ * of a walker.
+ * @param [in] w Pointer to walker
+ * @param [in] e Pointer to has_t structure to traverse
+ * @param [in] f Callback function
+ * @param [in] p Pointer passed to the callback function
+ * @return Same as has_walk().
+ *
+ * The stack only grows, repeated traversals of documents of similar
+ * depth do not allocate.
+ */
+int has_walker_walk(has_walker_t *w, has_t *e, has_walk_function_t f, void *p);
+
+/**
+ * @brief Frees a walker
+ * @param [in] w Pointer to walker
+ */
+void has_walker_free(has_walker_t *w);
+
 /**
  * @defgroup hash Associative array functions
  * @{
@@ -341,6 +526,39 @@ has_t * has_hash_get(has_t *hash, const char *key, size_t size);
  */
 has_t * has_hash_get_str(has_t *hash, const char *key);
 
+/**
+ * @brief Retrieves an entry from hash based on its key and digest.
+ * @param [in] hash   Pointer to hash has_t element to test.
+ * @param [in] key    Pointer to the key.
+ * @param [in] size   Size of the key.
+ * @param [in] digest Digest of the key computed with
+ * has_hash_function().
+ * @return the value corresponding to the key, @c NULL if not found or
+ * if hash is @c NULL or not a has_hash element.
+ *
+ * Allows callers looking up the same keys repeatedly to compute their
+ * digest only once.
+ */
+has_t * has_hash_get_hashed(has_t *hash, const char *key, size_t size,
+                            uint32_t digest);
+
+/**
+ * @brief Iterates over the entries of a hash.
+ * @param [in]     hash  Pointer to hash has_t element.
+ * @param [in,out] index Position of the iteration, must be set to 0
+ * before the first call.
+ * @param [out]    key   Pointer receiving the key (can be @c NULL).
+ * @param [out]    size  Pointer receiving the size of the key (can be
+ * @c NULL).
+ * @param [out]    value Pointer receiving the value (can be @c NULL).
+ * @return @c true if an entry was retrieved, @c false when there are
+ * no more entries or if hash is @c NULL or not a has_hash element.
+ *
+ * The hash must not be modified during the iteration.
+ */
+bool has_hash_iterate(has_t *hash, size_t *index, const char **key,
+                      size_t *size, has_t **value);
+
 /**
  * @brief Removes an entry from hash based on its key.
  * @param [in] hash  Pointer to hash has_t element to test.
@@ -479,6 +697,27 @@ has_t * has_array_unshift(has_t *array, has_t *value);
  */
 has_t * has_array_shift(has_t *array);
 
+/**
+ * @brief Inserts an element at given position of a has_t array.
+ * @param [in] array  Pointer to array has_t.
+ * @param [in] index  Position of the new element, at most the number
+ * of elements. Following elements are shifted.
+ * @param [in] value  Pointer to has_t value.
+ * @return Pointer to array has_t element if successful, @c NULL
+ * otherwise.
+ */
+has_t * has_array_insert(has_t *array, size_t index, has_t *value);
+
+/**
+ * @brief Removes the element at given position of a has_t array.
+ * @param [in] array  Pointer to array has_t.
+ * @param [in] index  Position of the element to remove. Following
+ * elements are shifted.
+ * @return Pointer to has_t element removed if successful, @c NULL
+ * otherwise.
+ */
+has_t * has_array_remove(has_t *array, size_t index);
+
 /**
  * @brief Sets an element at given postion of a has_t array.
  * @param [in] array  Pointer to array has_t.
@@ -576,6 +815,19 @@ has_t * has_string_init_str(has_t *string, char *pointer, bool owner);
  */
 bool has_is_string(has_t *string);
 
+/**
+ * @brief Retrieves the content of a string has_t element.
+ * @param [in]  string Pointer to string has_t element.
+ * @param [out] size   Pointer receiving the size of the string (can
+ * be @c NULL).
+ * @return Pointer to the string content, @c NULL if string is @c NULL
+ * or not a string element.
+ *
+ * Unlike reading has_string_t::pointer directly, this also works on
+ * frozen elements.
+ */
+const char * has_string_get(has_t *string, size_t *size);
+
 /** @} */
 
 /**
@@ -617,6 +869,70 @@ bool has_is_int(has_t *e);
 /* FIXME */
 int32_t has_int_get(has_t *integer);
 
+/**
+ * @brief Allocates and initializes a 64-bit integer has_t element.
+ */
+has_t * has_int64_new(int64_t value);
+
+/**
+ * @brief Initializes a 64-bit integer has_t element.
+ */
+has_t * has_int64_init(has_t *integer, int64_t value);
+
+/**
+ * @brief Tests if a has_t element is a 64-bit integer.
+ * @param [in] e  Pointer to has_t element to test.
+ * @return @c true if pointer is not null and has_t element is a
+ * 64-bit integer, @c false otherwise.
+ */
+bool has_is_int64(has_t *e);
+
+/**
+ * @brief Retrieves the value of an integer or 64-bit integer element.
+ * @param [in] integer Pointer to has_t element.
+ * @return The value, or 0 if the element is not an integer (or a
+ * number whose text is not a 64-bit integer).
+ */
+int64_t has_int64_get(has_t *integer);
+
+/**
+ * @brief Allocates and initializes a number has_t element kept as text.
+ * @param [in] pointer Pointer to the text of the number.
+ * @param [in] size    Size of the text.
+ * @param [in] owner   Boolean value specifying the ownership of the
+ * text.
+ * @return The element, @c NULL in case of failure.
+ *
+ * The text is not converted nor validated: has_int_get(),
+ * has_int64_get() and has_double_get() convert it on each call, and
+ * has_json_serialize() emits it unchanged.
+ */
+has_t * has_number_new(char *pointer, size_t size, bool owner);
+
+/**
+ * @brief Initializes a number has_t element kept as text.
+ * @see has_number_new
+ */
+has_t * has_number_init(has_t *number, char *pointer, size_t size, bool owner);
+
+/**
+ * @brief Tests if a has_t element is a number kept as text.
+ * @param [in] e  Pointer to has_t element to test.
+ * @return @c true if pointer is not null and has_t element is a
+ * number kept as text, @c false otherwise.
+ */
+bool has_is_number(has_t *e);
+
+/**
+ * @brief Retrieves the text of a number has_t element.
+ * @param [in]  number Pointer to number has_t element.
+ * @param [out] size   Pointer receiving the size of the text (can be
+ * @c NULL).
+ * @return Pointer to the text, @c NULL if number is @c NULL or not a
+ * number element.
+ */
+const char * has_number_get(has_t *number, size_t *size);
+
 /**
  * @brief Allocates and initializes a boolean has_t element.
  */
@@ -679,6 +995,184 @@ bool has_is_pointer(has_t *e);
 
 uint32_t has_hash_function(const char * data, int len);
 
+/**
+ * @brief Copies a has_t structure
+ * @param [in] e     Pointer to has_t structure to copy
+ * @param [in] owner If @c true strings and keys are duplicated,
+ * otherwise the copy references the strings and keys of e (and must
+ * not be used after e is freed).
+ * @return A pointer to the copy or @c NULL in case of failure.
+ *
+ * Hash values set to @c NULL are copied as @c NULL.
+ */
+has_t * has_copy(has_t *e, bool owner);
+
+/**
+ * @brief Compares two has_t structures
+ * @param [in] a Pointer to first has_t structure
+ * @param [in] b Pointer to second has_t structure
+ * @return @c true if both have the same type and content, @c false
+ * otherwise (or if memory allocation failed).
+ *
+ * Hashes are equal if they have the same keys associated to equal
+ * values, regardless of insertion order. A @c NULL element is equal
+ * to a null element. The comparison stops at the first difference and
+ * uses memoized digests, when both are available, to reject
+ * differing containers without visiting them.
+ */
+bool has_equal(has_t *a, has_t *b);
+
+/**
+ * @brief Computes the structural digest of a has_t structure
+ * @param [in]  e      Pointer to has_t structure
+ * @param [out] digest Pointer receiving the digest
+ * @return 0 if success, -1 in case of failure.
+ *
+ * Equal structures (see has_equal()) have the same digest, which does
+ * not depend on the insertion order of hash keys, nor on the platform
+ * (except for pointer elements). The digest of each hash and array is
+ * memoized with a link to the container holding it, so that modifying
+ * a container through this API resets the digests above it. A
+ * container held by two others is linked to one of them, the other
+ * one is then not memoized. Elements held by a container must be
+ * replaced, not re-initialized in place. Computing digests modifies
+ * the memoized values, a structure shared between threads must be
+ * protected.
+ */
+int has_digest(has_t *e, has_digest_t *digest);
+
+/**
+ * @brief Retrieves the memoized digest of a hash or array element
+ * @param [in]  e      Pointer to has_t element
+ * @param [out] digest Pointer receiving the digest (may be @c NULL)
+ * @return @c true if a current digest is memoized, @c false otherwise.
+ */
+bool has_digest_memoized(has_t *e, has_digest_t *digest);
+
+/**
+ * @brief Creates a hash or array element whose content is built on
+ * first access
+ * @param [in] type Type of the element, #has_hash or #has_array.
+ * @param [in] lazy Source of the content and callbacks.
+ * @return Pointer to the new element or @c NULL if allocation failed.
+ *
+ * Materializing is not thread-safe: a structure containing lazy
+ * elements must be protected when shared, even for reading.
+ */
+has_t * has_lazy_new(has_types type, const has_lazy_t *lazy);
+
+/**
+ * @brief Builds the content of a lazy element @see HAS_LAZY
+ * @param [in] e Pointer to has_t element
+ * @return 0 if the content is built (or e was not lazy), -1 on failure.
+ */
+int has_materialize(has_t *e);
+
+/**
+ * @brief Resets the memoized digest of a container and of those above
+ * @param [in] e Pointer to has_t element
+ *
+ * Only needed after modifying the content of an element directly,
+ * without going through this API.
+ */
+void has_digest_invalidate(has_t *e);
+
+/**
+ * @struct has_memory_usage_t
+ * @brief Memory used by a has_t structure, in bytes per category
+ */
+typedef struct {
+    /** Elements (hash, array, string, scalar) */
+    size_t nodes;
+    /** Hash entries, used or not */
+    size_t hash_entries;
+    /** Hash index */
+    size_t hash_index;
+    /** Used array slots */
+    size_t array_elements;
+    /** Unused array slots left by growth */
+    size_t array_slack;
+    /** Strings and keys owned by the structure */
+    size_t owned_strings;
+    /** Strings and keys referenced but not owned */
+    size_t borrowed_strings;
+    /** Memoized digests */
+    size_t digests;
+    /** Sum of all categories except borrowed strings */
+    size_t total;
+} has_memory_usage_t;
+
+/**
+ * @brief Measures the memory used by a has_t structure
+ * @param [in]  e     Pointer to has_t structure
+ * @param [out] usage Pointer receiving the sizes
+ * @return 0 if success, -1 in case of failure.
+ *
+ * Sizes are those requested from the allocator, without its own
+ * overhead. Elements of a frozen image are reported like allocated
+ * ones, with their strings as borrowed.
+ */
+int has_memory_usage(has_t *e, has_memory_usage_t *usage);
+
+/**
+ * @struct has_counters_t
+ * @brief Live elements by type
+ */
+typedef struct {
+    /** Number of elements, indexed by #has_types */
+    long elements[has_number + 1];
+} has_counters_t;
+
+/**
+ * @brief Retrieves the global counters of live elements
+ * @param [out] counters Pointer receiving the counters
+ * @return 0 if success, -1 if the library was built without
+ * @c HAS_COUNTERS (counters are then zeroed).
+ *
+ * Only elements allocated individually (has_new() with a count of 1
+ * and the has_*_new() functions) are counted, from creation until
+ * has_free(). Counting uses atomic operations, it is disabled by
+ * default.
+ */
+int has_counters(has_counters_t *counters);
+
+/**
+ * @defgroup frozen Frozen images
+ * Position-independent, read-only copies of has_t structures.
+ * @{
+ */
+
+/**
+ * @brief Serializes a has_t structure into a frozen image
+ * @param [in]  input  has_t structure to freeze
+ * @param [out] output Pointer receiving the allocated image
+ * @param [out] size   Pointer receiving the size of the image
+ * @return 0 if success, -1 in case of failure.
+ *
+ * The image only contains offsets and can be stored on disk or mapped
+ * at any address. Pointer elements can not be frozen. The image can
+ * only be read back on a platform with the same byte order and type
+ * sizes.
+ */
+int has_freeze(has_t *input, char **output, size_t *size);
+
+/**
+ * @brief Retrieves the root element of a frozen image
+ * @param [in] image Pointer to the image (aligned on 8 bytes)
+ * @param [in] size  Size of the image
+ * @return Pointer to the root element inside the image or @c NULL if
+ * the image header is not valid.
+ *
+ * The elements of the image can be read with the regular accessors
+ * (has_hash_get(), has_array_get(), has_string_get(), has_walk(),
+ * ...) but not modified. has_free() on them is a no-op: the image
+ * must stay available as long as they are used. Only the header is
+ * checked, images must come from a trusted source.
+ */
+has_t * has_thaw(const void *image, size_t size);
+
+/** @} */
+
 #ifdef __cplusplus
 };
 #endif
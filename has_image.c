@@ -0,0 +1,124 @@
+/*
+ * Copyright 2016 Mathias Brossard <mathias@brossard.org>
+ */
+/**
+ * @file has_image.c
+ */
+
+#include "has_image.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct has_image_t {
+    void   *base;
+    size_t  size;
+    has_t  *root;
+};
+
+/* Writes size bytes, retrying if interrupted */
+static int has_image_write(int fd, const char *data, size_t size)
+{
+    while(size > 0) {
+        ssize_t l = write(fd, data, size);
+        if(l < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += l;
+        size -= l;
+    }
+    return 0;
+}
+
+int has_image_save(has_t *input, const char *path)
+{
+    char *image = NULL, *tmp;
+    size_t size = 0, l;
+    int fd, r = -1;
+
+    if(path == NULL || has_freeze(input, &image, &size) < 0) {
+        return -1;
+    }
+
+    /* Written next to the file then renamed over it, so that processes
+       mapping the previous image keep reading it intact */
+    l = strlen(path);
+    if((tmp = has_mem_alloc(l + sizeof(".XXXXXX"))) == NULL) {
+        has_mem_free(image);
+        return -1;
+    }
+    memcpy(tmp, path, l);
+    memcpy(tmp + l, ".XXXXXX", sizeof(".XXXXXX"));
+
+    if((fd = mkstemp(tmp)) >= 0) {
+        if(fchmod(fd, 0644) == 0 && has_image_write(fd, image, size) == 0 &&
+           fsync(fd) == 0) {
+            r = 0;
+        }
+        if(close(fd) < 0 || (r == 0 && rename(tmp, path) < 0)) {
+            r = -1;
+        }
+        if(r < 0) {
+            unlink(tmp);
+        }
+    }
+
+    has_mem_free(tmp);
+    has_mem_free(image);
+    return r;
+}
+
+has_image_t *has_image_open(const char *path)
+{
+    has_image_t *image;
+    struct stat st;
+    int fd;
+
+    if(path == NULL || (image = has_mem_calloc(sizeof(has_image_t), 1)) == NULL) {
+        return NULL;
+    }
+
+    if((fd = open(path, O_RDONLY)) < 0) {
+        has_mem_free(image);
+        return NULL;
+    }
+
+    if(fstat(fd, &st) < 0 || st.st_size <= 0 ||
+       (image->base = mmap(NULL, st.st_size, PROT_READ,
+                           MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        has_mem_free(image);
+        return NULL;
+    }
+    close(fd);
+    image->size = st.st_size;
+
+    if((image->root = has_thaw(image->base, image->size)) == NULL) {
+        has_image_close(image);
+        return NULL;
+    }
+
+    return image;
+}
+
+has_t *has_image_root(has_image_t *image)
+{
+    return image ? image->root : NULL;
+}
+
+void has_image_close(has_image_t *image)
+{
+    if(image) {
+        munmap(image->base, image->size);
+        has_mem_free(image);
+    }
+}
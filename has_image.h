@@ -0,0 +1,63 @@
+/*
+ * Copyright 2016 Mathias Brossard <mathias@brossard.org>
+ */
+/**
+ * @file has_image.h
+ */
+
+#ifndef _HAS_IMAGE_H
+#define	_HAS_IMAGE_H
+
+#include "has.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @struct has_image_t
+ * @brief Frozen image mapped from a file
+ */
+typedef struct has_image_t has_image_t;
+
+/**
+ * @brief Writes the frozen image of a has_t structure to a file
+ * @param input has_t structure to freeze
+ * @param path  Path of the file to create or replace
+ * @return 0 if success, -1 in case of failure.
+ *
+ * The image is written to a temporary file in the same directory, then
+ * renamed over @p path: images of the previous file already opened
+ * with has_image_open() remain valid.
+ */
+int has_image_save(has_t *input, const char *path);
+
+/**
+ * @brief Maps read-only a frozen image file
+ * @param path Path of the file written by has_image_save()
+ * @return A pointer to the image or @c NULL in case of failure.
+ *
+ * The mapping is shared, processes opening the same file share the
+ * same pages from the page cache.
+ */
+has_image_t *has_image_open(const char *path);
+
+/**
+ * @brief Retrieves the root element of a mapped image
+ * @param image Pointer to the image
+ * @return Pointer to the root has_t element, valid until
+ * has_image_close() is called.
+ */
+has_t *has_image_root(has_image_t *image);
+
+/**
+ * @brief Unmaps and frees an image
+ * @param image Pointer to the image
+ */
+void has_image_close(has_image_t *image);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
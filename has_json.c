@@ -7,31 +7,27 @@
 
 #include "has_json.h"
 
-#include "jsmn/jsmn.h"
-#include "jsmn/jsmn.c"
-
 #include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
-#define ESTIMATOR_TRESHOLD 2048
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAS_JSON_X86
+#include <immintrin.h>
+#endif
 
 static const char * hexchar = "0123456789ABCDEF";
 
-static size_t has_json_token_testimator(const char *a, size_t l)
-{
-    size_t i, s = 0;
-    for(i = 0; i < l; i++) {
-        char c = a[i];
-        if(c == '{' || c == '}' || c == ',' ||
-           c == '[' || c == ']' || c == '"') {
-            s += 1;
-        }
-    }
-    return s / 2;
-}
-
 int encode_utf8(int32_t codepoint, char *output)
 {
     int i = 0;
@@ -108,14 +104,14 @@ unsigned int decode_4hex(const char * hex)
 
         if ((c >= '0') && (c <= '9')) c -= '0';
         else if ((c >= 'A') && (c <= 'F')) c -= 'A' - 10;
-        else if ((c >= 'a') && (c <= 'a')) c -= 'a' - 10;
+        else if ((c >= 'a') && (c <= 'f')) c -= 'a' - 10;
         if(c & 0xF0) return 0xFFFFFFFF;
         r = (r << 4) | c;
     }
     return r;
 }
 
-int has_json_decode_unicode(char *input, unsigned int length,
+int has_json_decode_unicode(char *input, size_t length,
                             int32_t *codepoint)
 {
     unsigned int point, read = 4;
@@ -178,53 +174,37 @@ int has_json_encode_unicode(uint32_t codepoint, char *output)
     }
 }
 
-int has_json_string_decode(char *input, size_t length,
-                           char **output, size_t *newlen)
+/* Unescapes length bytes of input into output, which can be input
+   itself since the result is never longer. Returns -1 if invalid. */
+static int has_json_string_unescape(const char *input, size_t length,
+                                    char *output, size_t *written)
 {
-    size_t processed = 0, written = 0;
-    char *n = NULL;
-    int i, j;
-
-    if(output == NULL || newlen == NULL) {
-        return -1;
-    }
-
-    /* Find first reverse solidus */
-    for(i = 0; input[i] != '\\' && i < length; i++) /* Nothing */ ;
-
-    /* String doesn't require decoding */
-    if(i == length) {
-        *output = NULL;
-        *newlen = length;
-        return 0;
-    }
+    size_t processed = 0, w = 0, i, j;
+    int k;
 
-    n = malloc(length); /* Decoded string will always be smaller */
     while(processed < length) {
-        for(i = processed; input[i] != '\\' && i < length; i++) /* Nothing */ ;
-        if(i == length) {
-            j = length - processed;
-        } else {
-            j = i - processed;
-        }
+        for(i = processed; i < length && input[i] != '\\'; i++) /* Nothing */ ;
+        j = i - processed;
 
-        memcpy(n + written, input + processed, j);
+        if(output + w != input + processed) {
+            memmove(output + w, input + processed, j);
+        }
         processed += j;
-        written += j;
+        w += j;
         if(processed < length && input[processed] == '\\') {
-            char c = input[processed + 1];
+            char c = (processed + 1 < length) ? input[processed + 1] : '\0';
             if(c == 'u') {
                 int32_t point = 0;
                 processed += 2;
-                if((j = has_json_decode_unicode
-                    (input + processed, length - processed, &point)) == - 1) {
+                if((k = has_json_decode_unicode
+                    ((char *)input + processed, length - processed, &point)) == - 1) {
                     return -1;
                 }
-                processed += j;
-                if((j = encode_utf8(point, n + written)) == -1) {
+                processed += k;
+                if((k = encode_utf8(point, output + w)) == -1) {
                     return -1;
                 }
-                written += j;
+                w += k;
             } else {
                 if(c == '"') c = '\"';
                 else if(c == '\\') c = '\\';
@@ -233,351 +213,3839 @@ int has_json_string_decode(char *input, size_t length,
                 else if(c == 'n') c = '\n';
                 else if(c == 'r') c = '\r';
                 else if(c == 't') c = '\t';
-                else return -1;
+                else if(c == '/') c = '/';
+                else {
+                    return -1;
+                }
                 processed += 2;
-                n[written++] = c;
+                output[w++] = c;
             }
         }
     }
-    *output = n;
-    *newlen = written;
+    *written = w;
     return 0;
 }
 
-has_t *has_json_build_string(char *ptr, size_t len, bool decode)
+int has_json_string_decode(char *input, size_t length,
+                           char **output, size_t *newlen)
 {
-    char *s;
-    size_t l;
+    size_t i;
+    char *n = NULL;
+
+    if(output == NULL || newlen == NULL) {
+        return -1;
+    }
+
+    /* Find first reverse solidus */
+    for(i = 0; i < length && input[i] != '\\'; i++) /* Nothing */ ;
 
-    if(!decode) {
-        return has_string_new(ptr, len);
+    /* String doesn't require decoding */
+    if(i == length) {
+        *output = NULL;
+        *newlen = length;
+        return 0;
+    }
+
+    /* Decoded string will always be smaller */
+    if((n = has_mem_alloc(length)) == NULL) {
+        return -1;
     }
+    if(has_json_string_unescape(input, length, n, newlen) < 0) {
+        has_mem_free(n);
+        return -1;
+    }
+    *output = n;
+    return 0;
+}
+
+
+/* Powers of ten exactly represented as doubles */
+static const double has_json_powers[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-    if(has_json_string_decode(ptr, len, &s, &l) < 0) {
+#define HAS_JSON_MANTISSA_MAX ((uint64_t)1 << 53)
+
+/* Converts with strtod() numbers the fast paths can not handle */
+static has_t *has_json_number_slow(has_t *r, const char *s, size_t l)
+{
+    char local[64], *buffer = local, *end;
+    double fp;
+
+    if(l >= sizeof(local) && (buffer = has_mem_alloc(l + 1)) == NULL) {
         return NULL;
     }
-    return (s == NULL) ? has_string_new(ptr, len) :
-        has_string_new_o(s, l, true);
+    memcpy(buffer, s, l);
+    buffer[l] = '\0';
+    fp = strtod(buffer, &end);
+    if(end != buffer + l) {
+        r = NULL;
+    }
+    if(buffer != local) {
+        has_mem_free(buffer);
+    }
+    return r ? has_double_init(r, fp) : NULL;
 }
 
-has_t *has_json_decode_primitive(char *s, size_t l)
+/* Digits of a number: up to 19 significant digits and a power of ten */
+typedef struct {
+    uint64_t mantissa;
+    long     exponent;
+    bool     negative;
+    bool     integer;
+    bool     truncated; /* More than 19 significant digits */
+} has_json_number_t;
+
+/* Validates a number with the strict JSON grammar and collects its
+   digits in a single pass, returns -1 if s is invalid */
+static int has_json_number_scan(const char *s, size_t l, has_json_number_t *n)
 {
-    has_t *r = NULL;
-    char c = s[0];
+    const char *p = s, *e = s + l;
+    uint64_t m = 0;
+    long exponent = 0, x = 0;
+    int digits = 0;
+    bool minus = false;
 
-    if(c == 'n') {
-        return (l == 4 && (memcmp(s, "null", 4) == 0)) ?
-            (has_new(1)) : NULL;
-    } else if(c == '-' || (c >= '0' && c <= '9')) {
-        char buffer[32], *tmp;
-        int i;
-        /* We have a number */
-        if(l > (sizeof(buffer) - 1)) {
-            return NULL;
+    n->negative = false;
+    n->integer = true;
+    n->truncated = false;
+    if(p < e && *p == '-') {
+        n->negative = true;
+        p++;
+    }
+    if(p == e || *p < '0' || *p > '9' ||
+       (*p == '0' && p + 1 < e && p[1] >= '0' && p[1] <= '9')) {
+        return -1;
+    }
+    for(; p < e && *p >= '0' && *p <= '9'; p++) {
+        if(digits < 19) {
+            m = m * 10 + (*p - '0');
+            digits += (m != 0);
+        } else {
+            n->truncated = true;
+        }
+    }
+    if(p < e && *p == '.') {
+        n->integer = false;
+        if(++p == e || *p < '0' || *p > '9') {
+            return -1;
         }
-        memcpy(buffer, s, l);
-        buffer[l] = '\0';
-        for(i = 0; (s[i] != '.' && s[i] != 'e') && i < l; i++) /* Nothing */;
-        if(i < l) {
-            /* Floating point */
-            double fp = strtod(buffer, &tmp);
-            if(buffer != tmp) {
-                r = has_double_new(fp);
+        for(; p < e && *p >= '0' && *p <= '9'; p++) {
+            if(digits < 19) {
+                m = m * 10 + (*p - '0');
+                digits += (m != 0);
+                exponent--;
+            } else {
+                n->truncated = true;
             }
-        } else {
-            /* Integer */
-            int32_t integer = strtol(buffer, &tmp, 10);
-            if(buffer != tmp) {
-                r = has_int_new(integer);
+        }
+    }
+    if(p < e && (*p == 'e' || *p == 'E')) {
+        n->integer = false;
+        if(++p < e && (*p == '-' || *p == '+')) {
+            minus = (*p++ == '-');
+        }
+        if(p == e || *p < '0' || *p > '9') {
+            return -1;
+        }
+        for(; p < e && *p >= '0' && *p <= '9'; p++) {
+            if(x < 100000) {
+                x = x * 10 + (*p - '0');
             }
         }
-    } else if(c == 't') {
-        return (l == 4 && (memcmp(s, "true", 4) == 0)) ?
-            (has_bool_new(true)) : NULL;
-    } else if(c == 'f') {
-        return (l == 5 && (memcmp(s, "false", 5) == 0)) ?
-            (has_bool_new(false)) : NULL;
+        exponent += minus ? -x : x;
     }
-
-    return r;
+    n->mantissa = m;
+    n->exponent = exponent;
+    return (p == e) ? 0 : -1;
 }
 
-static has_t *has_json_build(jsmntok_t *tokens, size_t cur, size_t max,
-                             const char *buffer, size_t *processed, bool decode)
+/* Validates and converts a number. Integers are exact up to 64 bits
+   (32-bit ones are stored as has_integer). Decimals whose digits fit
+   in a 53-bit mantissa with a power of ten of at most 22 are exact
+   products or quotients of two doubles, so correctly rounded
+   (Clinger's fast path); the others go through strtod(). */
+static has_t *has_json_number_init(has_t *r, const char *s, size_t l)
 {
-    has_t *r = NULL;
-    size_t count = 0;
-    int i, error = 0;
+    has_json_number_t n;
+    uint64_t m;
+    long exponent;
 
-    if (tokens[cur].end < 0 || tokens[cur].start < 0) {
+    if(has_json_number_scan(s, l, &n) < 0) {
         return NULL;
     }
-
-    switch (tokens[cur].type) {
-        case JSMN_PRIMITIVE:
-            r = has_json_decode_primitive((char *) buffer + tokens[cur].start,
-                                          tokens[cur].end - tokens[cur].start);
-            count++;
-            break;
-        case JSMN_STRING:
-            r = has_json_build_string((char *) buffer + tokens[cur].start,
-                                      tokens[cur].end - tokens[cur].start, decode);
-            count++;
-            break;
-        case JSMN_ARRAY:
-            r = has_array_new(tokens[cur].size);
-            count++;
-            for(i = 0; i < tokens[cur].size && error == 0; i++) {
-                has_t *e = has_json_build(tokens, cur + count, max,
-                                          buffer, &count, decode);
-                if(e == NULL || has_array_push(r, e) == NULL) {
-                    error = 1;
-                }
-            }
-            break;
-        case JSMN_OBJECT:
-            r = has_hash_new(tokens[cur].size);
-            count++;
-            for(i = 0; i < tokens[cur].size && error == 0; i++) {
-                has_t *k = has_json_build(tokens, cur + count, max,
-                                          buffer, &count, decode);
-                if(k) {
-                    has_t *v = has_json_build(tokens, cur + count, max,
-                                              buffer, &count, decode);
-                    if(v == NULL || has_hash_add(r, k, v) == NULL) {
-                        error = 1;
-                    }
-                }
-            }
-            break;
-        default:
-            /* Unknown type */
-            break;
+    if(n.truncated) {
+        return has_json_number_slow(r, s, l);
     }
-    if(processed && count > 0) {
-        *processed += count;
+    m = n.mantissa;
+    exponent = n.exponent;
+    if(n.integer && m <= (uint64_t)INT64_MAX + n.negative) {
+        int64_t v = n.negative ? (int64_t)(0 - m) : (int64_t)m;
+        return (v >= INT32_MIN && v <= INT32_MAX) ?
+            has_int_init(r, (int32_t)v) : has_int64_init(r, v);
+    }
+    if(m <= HAS_JSON_MANTISSA_MAX) {
+        double fp = (double)m;
+        if(exponent > 22 && exponent <= 22 + 15) {
+            /* Moves zeros to the mantissa while it stays exact */
+            for(; exponent > 22 && m <= HAS_JSON_MANTISSA_MAX / 10; exponent--) {
+                m *= 10;
+            }
+            fp = (double)m;
+        }
+        if(exponent >= -22 && exponent <= 22) {
+            fp = (exponent < 0) ? fp / has_json_powers[-exponent] :
+                fp * has_json_powers[exponent];
+            return has_double_init(r, n.negative ? -fp : fp);
+        }
     }
+    return has_json_number_slow(r, s, l);
+}
 
-    if(error && r) {
-        has_free(r);
+/* Sets the value of a null element, returns NULL if s is invalid */
+static has_t *has_json_primitive_init(has_t *r, const char *s, size_t l)
+{
+    char c = s[0];
+
+    if(c == 'n') {
+        return (l == 4 && (memcmp(s, "null", 4) == 0)) ? r : NULL;
+    } else if(c == '-' || (c >= '0' && c <= '9')) {
+        return has_json_number_init(r, s, l);
+    } else if(c == 't') {
+        return (l == 4 && (memcmp(s, "true", 4) == 0)) ?
+            has_bool_init(r, true) : NULL;
+    } else if(c == 'f') {
+        return (l == 5 && (memcmp(s, "false", 5) == 0)) ?
+            has_bool_init(r, false) : NULL;
     }
 
-    return r;
+    return NULL;
 }
 
-has_t *has_json_parse(const char *buffer, bool decode)
+/* Same as has_json_primitive_init() but numbers are only validated and
+   kept as text, which must outlive r */
+static has_t *has_json_raw_init(has_t *r, const char *s, size_t l)
 {
-    jsmn_parser parser;
-    jsmntok_t *tokens;
-    size_t size = strlen(buffer);
-    size_t max_tokens = size < ESTIMATOR_TRESHOLD ? ESTIMATOR_TRESHOLD / 2 :
-        has_json_token_testimator(buffer, size);
-    has_t *r = NULL;
+    has_json_number_t n;
 
-    if((tokens = malloc(max_tokens * sizeof(jsmntok_t))) == NULL) {
-        return NULL;
+    if(s[0] != '-' && (s[0] < '0' || s[0] > '9')) {
+        return has_json_primitive_init(r, s, l);
     }
+    return (has_json_number_scan(s, l, &n) == 0) ?
+        has_number_init(r, (char *)s, l, false) : NULL;
+}
 
-    jsmn_init(&parser);
+has_t *has_json_decode_primitive(char *s, size_t l)
+{
+    has_t *r;
 
-    if(jsmn_parse(&parser, buffer, size, tokens, max_tokens) < 0) {
-        free(tokens);
-        return NULL;
+    if((r = has_new(1)) != NULL && has_json_primitive_init(r, s, l) == NULL) {
+        has_free(r);
+        r = NULL;
     }
-
-    r = has_json_build(tokens, 0, max_tokens, buffer, NULL, decode);
-    free(tokens);
     return r;
 }
 
-typedef struct has_json_serializer_t has_json_serializer_t;
+/* Tokens returned by has_json_lex() */
+typedef enum {
+    has_json_token_end = 0,     /* End of input */
+    has_json_token_hash_begin,
+    has_json_token_hash_end,
+    has_json_token_array_begin,
+    has_json_token_array_end,
+    has_json_token_colon,
+    has_json_token_comma,
+    has_json_token_string,
+    has_json_token_primitive,
+    has_json_token_error
+} has_json_token_type_t;
+
+typedef struct {
+    has_json_token_type_t type;
+    const char           *start;   /* Content, without quotes for strings */
+    size_t                length;
+    bool                  escaped; /* String contains escape sequences */
+} has_json_token_t;
 
-typedef int (*has_json_outputter) (has_json_serializer_t *s,
-                                   const char *value, size_t size);
+/* Stage 1 processes the input in blocks of 64 bytes, one bit per byte */
+#define HAS_JSON_BLOCK     64
+/* Blocks indexed at once, small enough to stay in the L1 cache */
+#define HAS_JSON_BLOCKS    16
 
-struct has_json_serializer_t {
-    has_json_outputter outputter;
-    void *pointer;
-    int flags;
-    int indent;
-};
+/* Carries from one block to the next */
+typedef struct {
+    uint64_t escaped;   /* First byte is escaped by a backslash */
+    uint64_t string;    /* All ones if the block starts inside a string */
+    uint64_t scalar;    /* Last byte was part of a primitive */
+    uint64_t backslash; /* Backslashes seen in the current window */
+} has_json_indexer_t;
 
 typedef struct {
-    char *buffer;
-    size_t size;
-    size_t current;
-    bool owner;
-} has_json_serializer_buffer_t;
+    const char        *buffer;
+    size_t             length;
+    size_t             position;
+    /* Structural index, used by has_json_lex_indexed() */
+    has_json_indexer_t state;
+    bool               error;
+    size_t             indexed;   /* Bytes of input indexed */
+    size_t             window;    /* Start of the last indexed window */
+    size_t             next;
+    size_t             count;
+    size_t             positions[HAS_JSON_BLOCK * HAS_JSON_BLOCKS];
+} has_json_lexer_t;
 
-int has_json_serializer_buffer_outputter(has_json_serializer_buffer_t *b,
-                                         const char *value, size_t size)
+static bool has_json_is_hex(char c)
 {
-    if(b == NULL) {
-        return -1;
-    }
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+        (c >= 'A' && c <= 'F');
+}
 
-    if(size > (b->size - b->current)) {
-        char *t;
-        size_t s = b->size * 2;
-        while((s - b->current) < size) s = s * 2;
-        if(!b->owner || (t = realloc(b->buffer, s)) == NULL) {
-            return -1;
+/* Validates the escape sequences of a string */
+static bool has_json_check_escapes(const char *s, size_t n)
+{
+    const char *p;
+    size_t i = 0;
+
+    while(i < n && (p = memchr(s + i, '\\', n - i)) != NULL) {
+        i = p - s;
+        if(i + 1 >= n) {
+            return false;
+        }
+        switch(s[i + 1]) {
+            case '"': case '\\': case '/': case 'b':
+            case 'f': case 'n': case 'r': case 't':
+                i += 2;
+                break;
+            case 'u':
+                if(i + 5 >= n || !has_json_is_hex(s[i + 2]) ||
+                   !has_json_is_hex(s[i + 3]) || !has_json_is_hex(s[i + 4]) ||
+                   !has_json_is_hex(s[i + 5])) {
+                    return false;
+                }
+                i += 6;
+                break;
+            default:
+                return false;
         }
-        b->buffer = t;
-        b->size = s;
     }
-
-    memcpy(b->buffer + b->current, value, size);
-    b->current += size;
-    return 0;
+    return true;
 }
 
-int has_json_string_encode(has_json_serializer_t *s,
-                           const char *input, size_t length)
+/* Scans a string, position is right after the opening quote */
+static bool has_json_lex_string(has_json_lexer_t *l, has_json_token_t *t)
 {
-    unsigned int start = 0, stop = 0;
-
-    while(stop < length) {
-        unsigned char c = input[stop];
-        char buffer[6] = { '\\', 'u', '0', '0', 0, 0 }, unicode[12];
-        char *add = NULL;
-        int l = 2, m = 1;
+    const char *b = l->buffer;
+    size_t i = l->position, n = l->length;
 
+    t->type = has_json_token_string;
+    t->start = b + i;
+    t->escaped = false;
+    while(i < n) {
+        unsigned char c = b[i];
         if(c == '"') {
-            add = "\\\"";
+            t->length = i - l->position;
+            l->position = i + 1;
+            return !t->escaped || has_json_check_escapes(t->start, t->length);
+        } else if(c < 0x20) {
+            return false;
         } else if(c == '\\') {
-            add = "\\\\";
-        } else if(s->flags & HAS_JSON_SERIALIZE_ENCODE) {
-            if(c == '\b') add = "\\b";
-            else if(c == '\f') add = "\\f";
-            else if(c == '\n') add = "\\n";
-            else if(c == '\r') add = "\\r";
-            else if(c == '\t') add = "\\t";
-            else if(c < 32) {
-                buffer[4] = hexchar[c >> 4];
-                buffer[5] = hexchar[c & 0x0F];
-                add = buffer;
-                l = 6;
-            } else if(c > 0x80) {
-                int32_t codepoint = 0;
-                if(((m = decode_utf8(input + stop, length - stop, &codepoint)) < 0) ||
-                   ((l = has_json_encode_unicode(codepoint, unicode)) < 0)) {
-                    return -1;
-                }
-                add = unicode;
-            }
-        }
-        if(add) {
-            if((stop - start) > 0) {
-                if((s->outputter(s->pointer, input + start, stop - start)) < 0) {
-                    return -1;
-                }
-            }
-            if((s->outputter(s->pointer, add, l)) < 0) {
-                return -1;
-            }
-            start = stop + m;
+            t->escaped = true;
+            i += 2;
+        } else {
+            i++;
         }
-        stop += m;
     }
+    return false;
+}
 
-    if((start < stop) &&
-       ((s->outputter(s->pointer, input + start, stop - start)) < 0)) {
-        return -1;
+static void has_json_lex(has_json_lexer_t *l, has_json_token_t *t)
+{
+    const char *b = l->buffer;
+    size_t i = l->position, n = l->length;
+    char c;
+
+    while(i < n && (b[i] == ' ' || b[i] == '\n' || b[i] == '\r' || b[i] == '\t')) {
+        i++;
+    }
+    if(i == n) {
+        l->position = i;
+        t->type = has_json_token_end;
+        return;
     }
 
-    return 0;
+    t->start = b + i;
+    t->length = 1;
+    l->position = i + 1;
+    switch((c = b[i])) {
+        case '{': t->type = has_json_token_hash_begin;  return;
+        case '}': t->type = has_json_token_hash_end;    return;
+        case '[': t->type = has_json_token_array_begin; return;
+        case ']': t->type = has_json_token_array_end;   return;
+        case ':': t->type = has_json_token_colon;       return;
+        case ',': t->type = has_json_token_comma;       return;
+        case '"':
+            if(!has_json_lex_string(l, t)) {
+                t->type = has_json_token_error;
+            }
+            return;
+        default:
+            /* Primitive, validated when it is decoded */
+            while(++i < n && (c = b[i]) != ',' && c != ']' && c != '}' &&
+                  c != ':' && c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+                /* Nothing */
+            }
+            t->type = has_json_token_primitive;
+            t->length = i - l->position + 1;
+            l->position = i;
+            return;
+    }
 }
 
-int has_json_serialize_string(has_json_serializer_t *s,
-                              const char *value, size_t size)
+/* Stage 1: structural index. Each block is classified into bit masks
+   (with SIMD instructions when available), then bit operations find the
+   escaped characters and the strings, as described by Langdale and
+   Lemire in "Parsing Gigabytes of JSON per Second". The positions of
+   structural characters, quotes and primitive starts outside strings
+   are what has_json_lex_indexed() reads, strings and whitespace are
+   never scanned byte by byte. */
+
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t structural; /* {}[]:, */
+    uint64_t whitespace;
+    uint64_t control;    /* Bytes below 0x20 */
+} has_json_masks_t;
+
+typedef void (*has_json_classifier_t)(const char *block, has_json_masks_t *m);
+
+enum {
+    HAS_JSON_C_QUOTE      = 1 << 0,
+    HAS_JSON_C_BACKSLASH  = 1 << 1,
+    HAS_JSON_C_STRUCTURAL = 1 << 2,
+    HAS_JSON_C_WHITESPACE = 1 << 3,
+    HAS_JSON_C_CONTROL    = 1 << 4
+};
+
+#define HAS_JSON_C_CW (HAS_JSON_C_CONTROL | HAS_JSON_C_WHITESPACE)
+
+static const unsigned char has_json_classes[256] = {
+    /* Control characters, \t \n \r are also whitespace */
+    HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL,
+    HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL,
+    HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL,
+    HAS_JSON_C_CW, HAS_JSON_C_CW, HAS_JSON_C_CONTROL,
+    HAS_JSON_C_CONTROL, HAS_JSON_C_CW, HAS_JSON_C_CONTROL,
+    HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL,
+    HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL,
+    HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL,
+    HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL,
+    HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL,
+    HAS_JSON_C_CONTROL, HAS_JSON_C_CONTROL,
+    [' '] = HAS_JSON_C_WHITESPACE,
+    ['"'] = HAS_JSON_C_QUOTE,
+    [','] = HAS_JSON_C_STRUCTURAL,
+    [':'] = HAS_JSON_C_STRUCTURAL,
+    ['['] = HAS_JSON_C_STRUCTURAL,
+    ['\\'] = HAS_JSON_C_BACKSLASH,
+    [']'] = HAS_JSON_C_STRUCTURAL,
+    ['{'] = HAS_JSON_C_STRUCTURAL,
+    ['}'] = HAS_JSON_C_STRUCTURAL
+};
+
+static void has_json_classify_scalar(const char *block, has_json_masks_t *m)
 {
-    if(s == NULL || s->outputter == NULL) {
-        return -1;
-    }
+    const unsigned char *b = (const unsigned char *)block;
+    int i;
 
-    if(s->flags & HAS_JSON_SERIALIZE_ENCODE) {
-        return (((s->outputter)(s->pointer, "\"", 1) == 0) &&
-                (has_json_string_encode(s, value, size) == 0) &&
-                ((s->outputter)(s->pointer, "\"", 1) == 0)) ? 0 : -1;
-    } else {
-        return (((s->outputter)(s->pointer, "\"", 1) == 0) &&
-                ((s->outputter)(s->pointer, value, size) == 0) &&
-                ((s->outputter)(s->pointer, "\"", 1) == 0)) ? 0 : -1;
+    memset(m, 0, sizeof(has_json_masks_t));
+    for(i = 0; i < HAS_JSON_BLOCK; i++) {
+        uint64_t c = has_json_classes[b[i]];
+        m->quote      |= (c & 1) << i;
+        m->backslash  |= ((c >> 1) & 1) << i;
+        m->structural |= ((c >> 2) & 1) << i;
+        m->whitespace |= ((c >> 3) & 1) << i;
+        m->control    |= ((c >> 4) & 1) << i;
     }
 }
 
+#ifdef HAS_JSON_X86
+/* Structural and whitespace characters are found with two nibble
+   lookups (pshufb), whose results are ANDed: bits 0-1 are whitespace
+   (0x09 0x0A 0x0D, 0x20), bits 2-4 structural (0x2C, 0x3A, 0x5B 0x5D
+   0x7B 0x7D). Bytes above 0x7F have no bit in the high nibble table. */
+#define HAS_JSON_LOW_NIBBLES                                    \
+    2, 0, 0, 0, 0, 0, 0, 0, 0, 1, 9, 16, 4, 17, 0, 0
+#define HAS_JSON_HIGH_NIBBLES                                   \
+    1, 0, 6, 8, 0, 16, 0, 16, 0, 0, 0, 0, 0, 0, 0, 0
 
-#define INDENT(s) \
-    if(s->flags & HAS_JSON_SERIALIZE_PRETTY) { \
-        int i; \
-        for(i = 0; i < s->indent ; i++) { \
-            (s->outputter)(s->pointer, "  ", 2); \
-        } \
-    }
-#define PRETTY(s, c, a)  \
-    if(s->flags & HAS_JSON_SERIALIZE_PRETTY) { \
-        (s->outputter)(s->pointer, c, 1); \
-        s->indent += a; \
+__attribute__((target("sse4.2")))
+static void has_json_classify_sse42(const char *block, has_json_masks_t *m)
+{
+    const __m128i low = _mm_setr_epi8(HAS_JSON_LOW_NIBBLES);
+    const __m128i high = _mm_setr_epi8(HAS_JSON_HIGH_NIBBLES);
+    const __m128i nibble = _mm_set1_epi8(0x0F), zero = _mm_setzero_si128();
+    int i;
+
+    memset(m, 0, sizeof(has_json_masks_t));
+    for(i = 0; i < HAS_JSON_BLOCK; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block + i));
+        __m128i c = _mm_and_si128(_mm_shuffle_epi8(low, _mm_and_si128(v, nibble)),
+                                  _mm_shuffle_epi8(high, _mm_and_si128
+                                                   (_mm_srli_epi16(v, 4), nibble)));
+#define BITS(x) ((uint64_t)(uint16_t)_mm_movemask_epi8(x) << i)
+        m->quote      |= BITS(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+        m->backslash  |= BITS(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        m->structural |= ~BITS(_mm_cmpeq_epi8(_mm_and_si128(c, _mm_set1_epi8(0x1C)), zero)) &
+            ((uint64_t)0xFFFF << i);
+        m->whitespace |= ~BITS(_mm_cmpeq_epi8(_mm_and_si128(c, _mm_set1_epi8(0x03)), zero)) &
+            ((uint64_t)0xFFFF << i);
+        /* Unsigned v <= 0x1F */
+        m->control    |= BITS(_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)),
+                                             _mm_set1_epi8(0x1F)));
+#undef BITS
     }
+}
 
-int has_json_serializer_walker(has_t *cur, has_walk_t type, int index,
-                               const char *string, size_t size, has_t *element,
-                               void *pointer)
+__attribute__((target("avx2")))
+static void has_json_classify_avx2(const char *block, has_json_masks_t *m)
 {
-    has_json_serializer_t *s = pointer;
-    int r = 0;
-    if(s == NULL || s->outputter == NULL) {
-        return -1;
+    const __m256i low = _mm256_setr_epi8(HAS_JSON_LOW_NIBBLES, HAS_JSON_LOW_NIBBLES);
+    const __m256i high = _mm256_setr_epi8(HAS_JSON_HIGH_NIBBLES, HAS_JSON_HIGH_NIBBLES);
+    const __m256i nibble = _mm256_set1_epi8(0x0F), zero = _mm256_setzero_si256();
+    int i;
+
+    memset(m, 0, sizeof(has_json_masks_t));
+    for(i = 0; i < HAS_JSON_BLOCK; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(block + i));
+        __m256i c = _mm256_and_si256(_mm256_shuffle_epi8(low, _mm256_and_si256(v, nibble)),
+                                     _mm256_shuffle_epi8(high, _mm256_and_si256
+                                                         (_mm256_srli_epi16(v, 4), nibble)));
+#define BITS(x) ((uint64_t)(uint32_t)_mm256_movemask_epi8(x) << i)
+        m->quote      |= BITS(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+        m->backslash  |= BITS(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+        m->structural |= ~BITS(_mm256_cmpeq_epi8(_mm256_and_si256(c, _mm256_set1_epi8(0x1C)), zero)) &
+            ((uint64_t)0xFFFFFFFF << i);
+        m->whitespace |= ~BITS(_mm256_cmpeq_epi8(_mm256_and_si256(c, _mm256_set1_epi8(0x03)), zero)) &
+            ((uint64_t)0xFFFFFFFF << i);
+        m->control    |= BITS(_mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(0x1F)),
+                                                _mm256_set1_epi8(0x1F)));
+#undef BITS
     }
+}
 
-    if(cur == NULL) {
-        INDENT(s);
-        r = (s->outputter)(s->pointer, "null", 4);
-    } else if(type == has_walk_hash_begin) {
-        r = (s->outputter)(s->pointer, "{", 1);
-        PRETTY(s, "\n", 1);
-    } else if(type == has_walk_hash_key) {
-        INDENT(s);
-        r = ((has_json_serialize_string(s, string, size) == 0) &&
-             ((s->outputter)(s->pointer, ":", 1) == 0)) ? 0 : -1;
-        PRETTY(s, " ", 0);
-    } else if(type == has_walk_hash_value_end) {
-        if(index < cur->value.hash.count - 1) {
+/* Carry-less multiplication by all ones computes the prefix XOR */
+__attribute__((target("pclmul")))
+static uint64_t has_json_prefix_xor_clmul(uint64_t x)
+{
+    return (uint64_t)_mm_cvtsi128_si64(_mm_clmulepi64_si128
+                                       (_mm_set_epi64x(0, (long long)x),
+                                        _mm_set1_epi8((char)0xFF), 0));
+}
+#endif
+
+static has_json_classifier_t has_json_classify = has_json_classify_scalar;
+static bool has_json_clmul = false;
+static pthread_once_t has_json_classify_once = PTHREAD_ONCE_INIT;
+
+static void has_json_classify_select(void)
+{
+#ifdef HAS_JSON_X86
+    __builtin_cpu_init();
+    has_json_clmul = __builtin_cpu_supports("pclmul");
+    if(__builtin_cpu_supports("avx2")) {
+        has_json_classify = has_json_classify_avx2;
+    } else if(__builtin_cpu_supports("sse4.2")) {
+        has_json_classify = has_json_classify_sse42;
+    }
+#endif
+}
+
+/* Selects the best implementation supported by the processor, once
+   for all threads */
+static has_json_classifier_t has_json_classifier(void)
+{
+    pthread_once(&has_json_classify_once, has_json_classify_select);
+    return has_json_classify;
+}
+
+/* UTF-8 validation. The scalar version checks 8 bytes at once for
+   ASCII, then each sequence against the ranges of RFC 3629 (no overlong
+   forms, surrogates or code points above U+10FFFF). */
+static bool has_json_utf8_scalar(const char *input, size_t length)
+{
+    const unsigned char *s = (const unsigned char *)input;
+    size_t i = 0, j, n;
+    uint64_t w;
+
+    while(i < length) {
+        if(i + 8 <= length) {
+            memcpy(&w, s + i, 8);
+            if((w & UINT64_C(0x8080808080808080)) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+        if(s[i] < 0x80) {
+            i++;
+            continue;
+        } else {
+            unsigned char c = s[i], low = 0x80, high = 0xBF;
+            if(c >= 0xC2 && c <= 0xDF) {
+                n = 1;
+            } else if(c >= 0xE0 && c <= 0xEF) {
+                n = 2;
+                low = (c == 0xE0) ? 0xA0 : 0x80;
+                high = (c == 0xED) ? 0x9F : 0xBF;
+            } else if(c >= 0xF0 && c <= 0xF4) {
+                n = 3;
+                low = (c == 0xF0) ? 0x90 : 0x80;
+                high = (c == 0xF4) ? 0x8F : 0xBF;
+            } else {
+                return false;
+            }
+            if(length - i - 1 < n || s[i + 1] < low || s[i + 1] > high) {
+                return false;
+            }
+            for(j = 2; j <= n; j++) {
+                if((s[i + j] & 0xC0) != 0x80) {
+                    return false;
+                }
+            }
+            i += n + 1;
+        }
+    }
+    return true;
+}
+
+#ifdef HAS_JSON_X86
+/* Vectorized validation with three nibble lookups (Keiser and Lemire,
+   "Validating UTF-8 In Less Than One Instruction Per Byte"): the high
+   and low nibbles of the previous byte and the high nibble of the
+   current one each give the errors they are compatible with, a bit
+   remaining in the AND of the three is an error. Third and fourth
+   bytes of sequences are checked with the two previous bytes. Blocks
+   of ASCII only check that the previous block did not end in the
+   middle of a sequence. */
+#define HAS_JSON_TOO_SHORT   (1 << 0)
+#define HAS_JSON_TOO_LONG    (1 << 1)
+#define HAS_JSON_OVERLONG_3  (1 << 2)
+#define HAS_JSON_TOO_LARGE   (1 << 3)
+#define HAS_JSON_SURROGATE   (1 << 4)
+#define HAS_JSON_OVERLONG_2  (1 << 5)
+#define HAS_JSON_TOO_LARGE_1000 (1 << 6)
+#define HAS_JSON_OVERLONG_4  (1 << 6)
+#define HAS_JSON_TWO_CONTS   (1 << 7)
+#define HAS_JSON_CARRY (HAS_JSON_TOO_SHORT | HAS_JSON_TOO_LONG | HAS_JSON_TWO_CONTS)
+#define HAS_JSON_LARGE (HAS_JSON_CARRY | HAS_JSON_TOO_LARGE | HAS_JSON_TOO_LARGE_1000)
+
+#define HAS_JSON_UTF8_BYTE_1_HIGH                                             \
+    HAS_JSON_TOO_LONG, HAS_JSON_TOO_LONG, HAS_JSON_TOO_LONG, HAS_JSON_TOO_LONG, \
+    HAS_JSON_TOO_LONG, HAS_JSON_TOO_LONG, HAS_JSON_TOO_LONG, HAS_JSON_TOO_LONG, \
+    HAS_JSON_TWO_CONTS, HAS_JSON_TWO_CONTS, HAS_JSON_TWO_CONTS, HAS_JSON_TWO_CONTS, \
+    HAS_JSON_TOO_SHORT | HAS_JSON_OVERLONG_2,                                 \
+    HAS_JSON_TOO_SHORT,                                                       \
+    HAS_JSON_TOO_SHORT | HAS_JSON_OVERLONG_3 | HAS_JSON_SURROGATE,            \
+    HAS_JSON_TOO_SHORT | HAS_JSON_TOO_LARGE | HAS_JSON_TOO_LARGE_1000 |       \
+    HAS_JSON_OVERLONG_4
+
+#define HAS_JSON_UTF8_BYTE_1_LOW                                              \
+    HAS_JSON_CARRY | HAS_JSON_OVERLONG_3 | HAS_JSON_OVERLONG_2 | HAS_JSON_OVERLONG_4, \
+    HAS_JSON_CARRY | HAS_JSON_OVERLONG_2,                                     \
+    HAS_JSON_CARRY, HAS_JSON_CARRY,                                           \
+    HAS_JSON_CARRY | HAS_JSON_TOO_LARGE,                                      \
+    HAS_JSON_LARGE, HAS_JSON_LARGE, HAS_JSON_LARGE,                           \
+    HAS_JSON_LARGE, HAS_JSON_LARGE, HAS_JSON_LARGE, HAS_JSON_LARGE,           \
+    HAS_JSON_LARGE, HAS_JSON_LARGE | HAS_JSON_SURROGATE,                      \
+    HAS_JSON_LARGE, HAS_JSON_LARGE
+
+#define HAS_JSON_UTF8_BYTE_2_HIGH                                             \
+    HAS_JSON_TOO_SHORT, HAS_JSON_TOO_SHORT, HAS_JSON_TOO_SHORT, HAS_JSON_TOO_SHORT, \
+    HAS_JSON_TOO_SHORT, HAS_JSON_TOO_SHORT, HAS_JSON_TOO_SHORT, HAS_JSON_TOO_SHORT, \
+    HAS_JSON_TOO_LONG | HAS_JSON_OVERLONG_2 | HAS_JSON_TWO_CONTS |            \
+    HAS_JSON_OVERLONG_3 | HAS_JSON_TOO_LARGE_1000 | HAS_JSON_OVERLONG_4,      \
+    HAS_JSON_TOO_LONG | HAS_JSON_OVERLONG_2 | HAS_JSON_TWO_CONTS |            \
+    HAS_JSON_OVERLONG_3 | HAS_JSON_TOO_LARGE,                                 \
+    HAS_JSON_TOO_LONG | HAS_JSON_OVERLONG_2 | HAS_JSON_TWO_CONTS |            \
+    HAS_JSON_SURROGATE | HAS_JSON_TOO_LARGE,                                  \
+    HAS_JSON_TOO_LONG | HAS_JSON_OVERLONG_2 | HAS_JSON_TWO_CONTS |            \
+    HAS_JSON_SURROGATE | HAS_JSON_TOO_LARGE,                                  \
+    HAS_JSON_TOO_SHORT, HAS_JSON_TOO_SHORT, HAS_JSON_TOO_SHORT, HAS_JSON_TOO_SHORT
+
+static const unsigned char has_json_utf8_tables[3][16] = {
+    { HAS_JSON_UTF8_BYTE_1_HIGH },
+    { HAS_JSON_UTF8_BYTE_1_LOW },
+    { HAS_JSON_UTF8_BYTE_2_HIGH }
+};
+
+/* Bytes above which a block ends inside a sequence */
+static const unsigned char has_json_utf8_incomplete[32] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+
+__attribute__((target("sse4.2")))
+static bool has_json_utf8_sse42(const char *input, size_t length)
+{
+#define TABLE(i) _mm_loadu_si128((const __m128i *)has_json_utf8_tables[i])
+    const __m128i byte_1_high = TABLE(0), byte_1_low = TABLE(1), byte_2_high = TABLE(2);
+#undef TABLE
+    const __m128i incomplete = _mm_loadu_si128((const __m128i *)
+                                               (has_json_utf8_incomplete + 16));
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev = _mm_setzero_si128(), carry = _mm_setzero_si128();
+    __m128i error = _mm_setzero_si128(), v;
+    char tail[16];
+    size_t i;
+
+    for(i = 0; i < length; i += 16) {
+        if(i + 16 <= length) {
+            v = _mm_loadu_si128((const __m128i *)(input + i));
+        } else {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, input + i, length - i);
+            v = _mm_loadu_si128((const __m128i *)tail);
+        }
+        if(_mm_movemask_epi8(v) == 0) {
+            error = _mm_or_si128(error, carry);
+            carry = _mm_setzero_si128();
+        } else {
+            __m128i prev1 = _mm_alignr_epi8(v, prev, 15);
+            __m128i prev2 = _mm_alignr_epi8(v, prev, 14);
+            __m128i prev3 = _mm_alignr_epi8(v, prev, 13);
+            __m128i sc = _mm_and_si128
+                (_mm_and_si128(_mm_shuffle_epi8(byte_1_high, _mm_and_si128
+                                                (_mm_srli_epi16(prev1, 4), nibble)),
+                               _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+                 _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+            __m128i must = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80))),
+                                        _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80))));
+            must = _mm_and_si128(must, _mm_set1_epi8((char)0x80));
+            error = _mm_or_si128(error, _mm_xor_si128(must, sc));
+            carry = _mm_subs_epu8(v, incomplete);
+        }
+        prev = v;
+    }
+    error = _mm_or_si128(error, carry);
+    return _mm_testz_si128(error, error) ? true : false;
+}
+
+__attribute__((target("avx2")))
+static bool has_json_utf8_avx2(const char *input, size_t length)
+{
+#define TABLE(i) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) \
+                                                         has_json_utf8_tables[i]))
+    const __m256i byte_1_high = TABLE(0), byte_1_low = TABLE(1), byte_2_high = TABLE(2);
+#undef TABLE
+    const __m256i incomplete = _mm256_loadu_si256((const __m256i *)
+                                                  has_json_utf8_incomplete);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i prev = _mm256_setzero_si256(), carry = _mm256_setzero_si256();
+    __m256i error = _mm256_setzero_si256(), v;
+    char tail[32];
+    size_t i;
+
+    for(i = 0; i < length; i += 32) {
+        if(i + 32 <= length) {
+            v = _mm256_loadu_si256((const __m256i *)(input + i));
+        } else {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, input + i, length - i);
+            v = _mm256_loadu_si256((const __m256i *)tail);
+        }
+        if(_mm256_movemask_epi8(v) == 0) {
+            error = _mm256_or_si256(error, carry);
+            carry = _mm256_setzero_si256();
+        } else {
+            /* Previous bytes, across the two lanes */
+            __m256i shifted = _mm256_permute2x128_si256(prev, v, 0x21);
+            __m256i prev1 = _mm256_alignr_epi8(v, shifted, 15);
+            __m256i prev2 = _mm256_alignr_epi8(v, shifted, 14);
+            __m256i prev3 = _mm256_alignr_epi8(v, shifted, 13);
+            __m256i sc = _mm256_and_si256
+                (_mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, _mm256_and_si256
+                                                      (_mm256_srli_epi16(prev1, 4), nibble)),
+                                  _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+                 _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256
+                                     (_mm256_srli_epi16(v, 4), nibble)));
+            __m256i must = _mm256_or_si256
+                (_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+                 _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80))));
+            must = _mm256_and_si256(must, _mm256_set1_epi8((char)0x80));
+            error = _mm256_or_si256(error, _mm256_xor_si256(must, sc));
+            carry = _mm256_subs_epu8(v, incomplete);
+        }
+        prev = v;
+    }
+    error = _mm256_or_si256(error, carry);
+    return _mm256_testz_si256(error, error) ? true : false;
+}
+#endif
+
+typedef bool (*has_json_utf8_validator_t)(const char *input, size_t length);
+
+static has_json_utf8_validator_t has_json_utf8_validate = has_json_utf8_scalar;
+static pthread_once_t has_json_utf8_once = PTHREAD_ONCE_INIT;
+
+static void has_json_utf8_select(void)
+{
+#ifdef HAS_JSON_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        has_json_utf8_validate = has_json_utf8_avx2;
+    } else if(__builtin_cpu_supports("sse4.2")) {
+        has_json_utf8_validate = has_json_utf8_sse42;
+    }
+#endif
+}
+
+bool has_json_utf8_valid(const char *input, size_t length)
+{
+    pthread_once(&has_json_utf8_once, has_json_utf8_select);
+    /* Short strings are not worth a vector */
+    return (length < 16) ? has_json_utf8_scalar(input, length) :
+        has_json_utf8_validate(input, length);
+}
+
+/* Bit i is set if an odd number of quotes is at or before i */
+static uint64_t has_json_prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/* Characters escaped by a backslash, handling runs of backslashes */
+static uint64_t has_json_escaped(has_json_indexer_t *s, uint64_t backslash)
+{
+    const uint64_t even = 0x5555555555555555ULL;
+    uint64_t follows, odd_starts, even_sequences;
+
+    backslash &= ~s->escaped;
+    follows = (backslash << 1) | s->escaped;
+    odd_starts = backslash & ~even & ~follows;
+    even_sequences = odd_starts + backslash;
+    s->escaped = (even_sequences < odd_starts) ? 1 : 0;
+    return (even ^ (even_sequences << 1)) & follows;
+}
+
+/* Returns the structural bits of a block, false if a string contains
+   a control character */
+static bool has_json_index_block(has_json_indexer_t *s, const char *block,
+                                 has_json_classifier_t classify, uint64_t *bits)
+{
+    has_json_masks_t m;
+    uint64_t quote, string, scalar;
+
+    classify(block, &m);
+    s->backslash |= m.backslash;
+    quote = m.quote & ~has_json_escaped(s, m.backslash);
+#ifdef HAS_JSON_X86
+    string = (has_json_clmul ? has_json_prefix_xor_clmul(quote) :
+              has_json_prefix_xor(quote)) ^ s->string;
+#else
+    string = has_json_prefix_xor(quote) ^ s->string;
+#endif
+    s->string = (uint64_t)((int64_t)string >> 63);
+    scalar = ~(m.structural | m.whitespace | m.quote | string);
+    *bits = (m.structural & ~string) | quote |
+        (scalar & ~((scalar << 1) | s->scalar));
+    s->scalar = scalar >> 63;
+    return (m.control & string) == 0;
+}
+
+#if defined(__GNUC__)
+#define has_json_ctz(x) __builtin_ctzll(x)
+#else
+static int has_json_ctz(uint64_t x)
+{
+    int i = 0;
+    while((x & 1) == 0) {
+        x >>= 1;
+        i++;
+    }
+    return i;
+}
+#endif
+
+/* Indexes the next blocks, returns false at the end of the input or
+   on error */
+static bool has_json_index(has_json_lexer_t *l)
+{
+    has_json_classifier_t classify = has_json_classifier();
+    size_t k;
+
+    l->next = l->count = 0;
+    while(l->count == 0 && l->indexed < l->length && !l->error) {
+        l->window = l->indexed;
+        l->state.backslash = 0;
+        for(k = 0; k < HAS_JSON_BLOCKS && l->indexed < l->length; k++) {
+            const char *block = l->buffer + l->indexed;
+            char tail[HAS_JSON_BLOCK];
+            uint64_t bits;
+
+            if(l->length - l->indexed < HAS_JSON_BLOCK) {
+                /* Last block, padded with whitespace */
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, block, l->length - l->indexed);
+                block = tail;
+            }
+            if(!has_json_index_block(&(l->state), block, classify, &bits)) {
+                l->error = true;
+                return false;
+            }
+            while(bits) {
+                l->positions[l->count++] = l->indexed + has_json_ctz(bits);
+                bits &= bits - 1;
+            }
+            l->indexed += HAS_JSON_BLOCK;
+            if(l->indexed > l->length) {
+                l->indexed = l->length;
+            }
+        }
+    }
+    return l->count > 0;
+}
+
+/* Same tokens as has_json_lex(), reading positions from the index */
+static void has_json_lex_indexed(has_json_lexer_t *l, has_json_token_t *t)
+{
+    const char *b = l->buffer;
+    size_t p, q, n = l->length;
+    char c;
+
+    if(l->next == l->count && !has_json_index(l)) {
+        t->type = l->error ? has_json_token_error : has_json_token_end;
+        return;
+    }
+
+    p = l->positions[l->next++];
+    t->start = b + p;
+    t->length = 1;
+    switch((c = b[p])) {
+        case '{': t->type = has_json_token_hash_begin;  return;
+        case '}': t->type = has_json_token_hash_end;    return;
+        case '[': t->type = has_json_token_array_begin; return;
+        case ']': t->type = has_json_token_array_end;   return;
+        case ':': t->type = has_json_token_colon;       return;
+        case ',': t->type = has_json_token_comma;       return;
+        case '"':
+            /* The next position is the closing quote */
+            if(l->next == l->count && !has_json_index(l)) {
+                t->type = has_json_token_error;
+                return;
+            }
+            q = l->positions[l->next++];
+            t->type = has_json_token_string;
+            t->start = b + p + 1;
+            t->length = q - p - 1;
+            /* Only look for backslashes if the window has some, or if
+               the string started in a previous window */
+            t->escaped = (l->state.backslash || p < l->window) &&
+                memchr(t->start, '\\', t->length) != NULL;
+            if(t->escaped && !has_json_check_escapes(t->start, t->length)) {
+                t->type = has_json_token_error;
+            }
+            return;
+        default:
+            q = p;
+            while(++q < n && (c = b[q]) != ',' && c != ']' && c != '}' &&
+                  c != ':' && c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+                /* Nothing */
+            }
+            t->type = has_json_token_primitive;
+            t->length = q - p;
+            return;
+    }
+}
+
+#define HAS_JSON_STACK 32
+
+/* Open container, its members are in the item stack from start */
+typedef struct {
+    has_types type;
+    size_t    start;
+} has_json_frame_t;
+
+/* Member of an open container, key is NULL for array elements */
+typedef struct {
+    char   *key;
+    size_t  size;
+    bool    owner;
+    has_t  *value;
+} has_json_item_t;
+
+typedef enum {
+    has_json_expect_value,       /* Root value, after ':' or ',' in array */
+    has_json_expect_first_value, /* After '[': value or ']' */
+    has_json_expect_first_key,   /* After '{': key or '}' */
+    has_json_expect_key,         /* After ',' in hash */
+    has_json_expect_colon,       /* After key */
+    has_json_expect_next,        /* After member: ',' or end of container */
+    has_json_expect_end          /* Root value complete */
+} has_json_expect_t;
+
+/* Builds the tree from tokens. Members are collected on a stack until
+   their container is closed, so that it can be allocated with its exact
+   size. No recursion, the stacks grow on the heap. */
+typedef struct {
+    has_json_frame_t  *frames;
+    size_t             depth;
+    size_t             frames_size;
+    has_json_item_t   *items;
+    size_t             count;
+    size_t             items_size;
+    has_json_expect_t  expect;
+    has_t             *root;
+    bool               decode;
+    bool               copy;   /* Tokens do not outlive the builder call */
+    bool               raw;    /* Numbers are kept as text */
+    bool               utf8;   /* Strings are validated */
+    bool               insitu; /* Strings are decoded in the buffer */
+    has_json_frame_t   local_frames[HAS_JSON_STACK];
+    has_json_item_t    local_items[HAS_JSON_STACK];
+} has_json_builder_t;
+
+static void has_json_builder_init(has_json_builder_t *b, bool decode, bool copy)
+{
+    b->frames = b->local_frames;
+    b->frames_size = HAS_JSON_STACK;
+    b->depth = 0;
+    b->items = b->local_items;
+    b->items_size = HAS_JSON_STACK;
+    b->count = 0;
+    b->expect = has_json_expect_value;
+    b->root = NULL;
+    b->decode = decode;
+    b->copy = copy;
+    b->raw = false;
+    b->utf8 = false;
+    b->insitu = false;
+}
+
+/* Options of the builder other than decoding */
+static void has_json_builder_options(has_json_builder_t *b, int flags)
+{
+    b->raw = (flags & HAS_JSON_PARSE_RAW) ? true : false;
+    b->utf8 = (flags & HAS_JSON_PARSE_UTF8) ? true : false;
+}
+
+/* Releases, unless it was taken, the partial tree and keeps the stacks
+   for the next value */
+static void has_json_builder_reset(has_json_builder_t *b)
+{
+    size_t i;
+
+    for(i = 0; i < b->count; i++) {
+        if(b->items[i].owner) {
+            has_mem_free(b->items[i].key);
+        }
+        has_free(b->items[i].value);
+    }
+    has_free(b->root);
+    b->root = NULL;
+    b->count = 0;
+    b->depth = 0;
+    b->expect = has_json_expect_value;
+}
+
+/* Releases the stacks and, unless it was taken, the partial tree */
+static void has_json_builder_clear(has_json_builder_t *b)
+{
+    has_json_builder_reset(b);
+    if(b->frames != b->local_frames) {
+        has_mem_free(b->frames);
+    }
+    if(b->items != b->local_items) {
+        has_mem_free(b->items);
+    }
+    has_json_builder_init(b, b->decode, b->copy);
+}
+
+/* Doubles a stack, moving it to the heap the first time */
+static void *has_json_builder_grow(void *stack, void *local, size_t *size,
+                                   size_t width)
+{
+    void *t;
+
+    if(stack == local) {
+        if((t = has_mem_alloc(2 * *size * width)) != NULL) {
+            memcpy(t, local, *size * width);
+        }
+    } else {
+        t = has_mem_realloc(stack, 2 * *size * width);
+    }
+    if(t) {
+        *size *= 2;
+    }
+    return t;
+}
+
+static has_json_item_t *has_json_builder_item(has_json_builder_t *b)
+{
+    has_json_item_t *i;
+
+    if(b->count == b->items_size) {
+        if((i = has_json_builder_grow(b->items, b->local_items, &b->items_size,
+                                      sizeof(has_json_item_t))) == NULL) {
+            return NULL;
+        }
+        b->items = i;
+    }
+    i = &(b->items[b->count++]);
+    memset(i, 0, sizeof(has_json_item_t));
+    return i;
+}
+
+/* Stores a complete value, which belongs to the builder even on failure */
+static int has_json_builder_value(has_json_builder_t *b, has_t *v)
+{
+    has_json_item_t *i;
+
+    if(v == NULL) {
+        return -1;
+    }
+    if(b->depth == 0) {
+        b->root = v;
+        b->expect = has_json_expect_end;
+        return 0;
+    }
+
+    if(b->frames[b->depth - 1].type == has_hash) {
+        i = &(b->items[b->count - 1]); /* Pushed with the key */
+    } else if((i = has_json_builder_item(b)) == NULL) {
+        has_free(v);
+        return -1;
+    }
+    i->value = v;
+    b->expect = has_json_expect_next;
+    return 0;
+}
+
+static int has_json_builder_open(has_json_builder_t *b, has_types type)
+{
+    if(b->expect != has_json_expect_value &&
+       b->expect != has_json_expect_first_value) {
+        return -1;
+    }
+    if(b->depth == b->frames_size) {
+        has_json_frame_t *f;
+        if((f = has_json_builder_grow(b->frames, b->local_frames, &b->frames_size,
+                                      sizeof(has_json_frame_t))) == NULL) {
+            return -1;
+        }
+        b->frames = f;
+    }
+    b->frames[b->depth].type = type;
+    b->frames[b->depth].start = b->count;
+    b->depth++;
+    b->expect = (type == has_hash) ? has_json_expect_first_key :
+        has_json_expect_first_value;
+    return 0;
+}
+
+static int has_json_builder_close(has_json_builder_t *b, has_types type)
+{
+    has_json_frame_t *f;
+    has_json_item_t *items;
+    size_t i, n;
+    has_t *c;
+
+    if(b->depth == 0 || (f = &(b->frames[b->depth - 1]))->type != type ||
+       (b->expect != has_json_expect_next &&
+        b->expect != ((type == has_hash) ? has_json_expect_first_key :
+                      has_json_expect_first_value))) {
+        return -1;
+    }
+
+    items = &(b->items[f->start]);
+    n = b->count - f->start;
+    if(type == has_hash) {
+        if((c = has_hash_new(n ? n : 1)) == NULL) {
+            return -1;
+        }
+        for(i = 0; i < n; i++) {
+            if(has_hash_set_o(c, items[i].key, items[i].size,
+                              items[i].value, items[i].owner) == NULL) {
+                /* Members from i are still owned by the item stack */
+                memmove(items, items + i, (n - i) * sizeof(has_json_item_t));
+                b->count = f->start + n - i;
+                has_free(c);
+                return -1;
+            }
+        }
+    } else {
+        if((c = has_array_new(n)) == NULL) {
+            return -1;
+        }
+        for(i = 0; i < n; i++) {
+            c->value.array.elements[i] = items[i].value;
+        }
+        c->value.array.count = n;
+    }
+
+    b->count = f->start;
+    b->depth--;
+    return has_json_builder_value(b, c);
+}
+
+/* Decodes or copies, if needed, the string of a token */
+static int has_json_builder_string(has_json_builder_t *b, has_json_token_t *t,
+                                   char **s, size_t *l)
+{
+    *s = NULL;
+    *l = t->length;
+    if(b->decode && t->escaped && b->insitu) {
+        return has_json_string_unescape(t->start, t->length, (char *)t->start, l);
+    } else if(b->decode && t->escaped) {
+        return has_json_string_decode((char *)t->start, t->length, s, l);
+    }
+    if(b->copy) {
+        if((*s = has_mem_alloc(t->length ? t->length : 1)) == NULL) {
+            return -1;
+        }
+        if(t->length > 0) {
+            memcpy(*s, t->start, t->length);
+        }
+    }
+    return 0;
+}
+
+/* Creates the element of a primitive token, copying the text of raw
+   numbers if tokens do not outlive the call */
+static has_t *has_json_builder_primitive(has_json_builder_t *b,
+                                         has_json_token_t *t)
+{
+    has_t *r;
+    char *s;
+
+    if(!b->raw) {
+        return has_json_decode_primitive((char *)t->start, t->length);
+    }
+    if((r = has_new(1)) == NULL ||
+       has_json_raw_init(r, t->start, t->length) == NULL) {
+        has_free(r);
+        return NULL;
+    }
+    if(b->copy && r->type == has_number) {
+        if((s = has_mem_alloc(t->length)) == NULL) {
+            has_free(r);
+            return NULL;
+        }
+        memcpy(s, t->start, t->length);
+        has_number_init(r, s, t->length, true);
+    }
+    return r;
+}
+
+static int has_json_builder_token(has_json_builder_t *b, has_json_token_t *t)
+{
+    has_t *v;
+    char *s;
+    size_t l;
+
+    switch(t->type) {
+        case has_json_token_hash_begin:
+            return has_json_builder_open(b, has_hash);
+        case has_json_token_array_begin:
+            return has_json_builder_open(b, has_array);
+        case has_json_token_hash_end:
+            return has_json_builder_close(b, has_hash);
+        case has_json_token_array_end:
+            return has_json_builder_close(b, has_array);
+        case has_json_token_colon:
+            if(b->expect != has_json_expect_colon) {
+                return -1;
+            }
+            b->expect = has_json_expect_value;
+            return 0;
+        case has_json_token_comma:
+            if(b->expect != has_json_expect_next) {
+                return -1;
+            }
+            b->expect = (b->frames[b->depth - 1].type == has_hash) ?
+                has_json_expect_key : has_json_expect_value;
+            return 0;
+        case has_json_token_string:
+            if(b->expect == has_json_expect_key ||
+               b->expect == has_json_expect_first_key) {
+                has_json_item_t *i;
+                if(has_json_builder_string(b, t, &s, &l) < 0) {
+                    return -1;
+                }
+                if(b->utf8 && !has_json_utf8_valid(s ? s : t->start, l)) {
+                    has_mem_free(s);
+                    return -1;
+                }
+                if((i = has_json_builder_item(b)) == NULL) {
+                    has_mem_free(s);
+                    return -1;
+                }
+                i->key = s ? s : (char *)t->start;
+                i->size = l;
+                i->owner = (s != NULL);
+                b->expect = has_json_expect_colon;
+                return 0;
+            } else if(b->expect == has_json_expect_value ||
+                      b->expect == has_json_expect_first_value) {
+                if(has_json_builder_string(b, t, &s, &l) < 0) {
+                    return -1;
+                }
+                if(b->utf8 && !has_json_utf8_valid(s ? s : t->start, l)) {
+                    has_mem_free(s);
+                    return -1;
+                }
+                if((v = s ? has_string_new_o(s, l, true) :
+                    has_string_new((char *)t->start, l)) == NULL) {
+                    has_mem_free(s);
+                }
+                return has_json_builder_value(b, v);
+            }
+            return -1;
+        case has_json_token_primitive:
+            if(b->expect == has_json_expect_value ||
+               b->expect == has_json_expect_first_value) {
+                return has_json_builder_value(b, has_json_builder_primitive(b, t));
+            }
+            return -1;
+        default:
+            return -1;
+    }
+}
+
+static void has_json_lexer_init(has_json_lexer_t *l, const char *buffer,
+                                size_t length)
+{
+    memset(l, 0, offsetof(has_json_lexer_t, positions));
+    l->buffer = buffer;
+    l->length = length;
+}
+
+static bool has_json_indexable(has_json_lexer_t *l)
+{
+    /* Short inputs are not worth indexing, and without vector
+       instructions the byte lexer is faster than the scalar classifier */
+    return (l->length >= HAS_JSON_BLOCK) &&
+        (has_json_classifier() != has_json_classify_scalar);
+}
+
+/* Feeds all tokens to the builder, returns -1 on error */
+static int has_json_feed(has_json_lexer_t *l, has_json_builder_t *b)
+{
+    has_json_token_t t;
+    bool indexed = has_json_indexable(l);
+
+    for(;;) {
+        if(!indexed) {
+            has_json_lex(l, &t);
+        } else {
+            has_json_lex_indexed(l, &t);
+        }
+        if(t.type == has_json_token_end) {
+            return 0;
+        }
+        if(has_json_builder_token(b, &t) < 0) {
+            return -1;
+        }
+    }
+}
+
+/* Builds the single value of a text and releases the builder */
+static has_t *has_json_build(has_json_lexer_t *l, has_json_builder_t *b)
+{
+    has_t *r = NULL;
+
+    if(has_json_feed(l, b) == 0 && b->expect == has_json_expect_end) {
+        r = b->root;
+        b->root = NULL;
+    }
+    has_json_builder_clear(b);
+    return r;
+}
+
+static has_t *has_json_parse_buffer(const char *buffer, size_t length, int flags)
+{
+    has_json_lexer_t l;
+    has_json_builder_t b;
+
+    has_json_lexer_init(&l, buffer, length);
+    has_json_builder_init(&b, (flags & HAS_JSON_PARSE_DECODE) ? true : false,
+                          false);
+    has_json_builder_options(&b, flags);
+    return has_json_build(&l, &b);
+}
+
+has_t *has_json_parse(const char *buffer, bool decode)
+{
+    return buffer ? has_json_parse_buffer(buffer, strlen(buffer),
+                                          decode ? HAS_JSON_PARSE_DECODE : 0) :
+        NULL;
+}
+
+has_t *has_json_parse_insitu(char *buffer, size_t length, int flags)
+{
+    has_json_lexer_t l;
+    has_json_builder_t b;
+
+    if(buffer == NULL) {
+        return NULL;
+    }
+    has_json_lexer_init(&l, buffer, length);
+    has_json_builder_init(&b, true, false);
+    has_json_builder_options(&b, flags);
+    /* A string is behind the lexer, structural index included, once
+       its token is built, so it can be rewritten */
+    b.insitu = true;
+    return has_json_build(&l, &b);
+}
+
+/* Keeps the builder stacks, once grown, and the lexer with its
+   structural index between parses */
+struct has_json_ctx_t {
+    has_json_builder_t builder;
+    has_json_lexer_t   lexer;
+};
+
+has_json_ctx_t *has_json_ctx_new(void)
+{
+    has_json_ctx_t *ctx;
+
+    if((ctx = has_mem_alloc(sizeof(has_json_ctx_t))) != NULL) {
+        has_json_builder_init(&ctx->builder, false, false);
+    }
+    return ctx;
+}
+
+has_t *has_json_ctx_parse(has_json_ctx_t *ctx, const char *buffer,
+                          size_t length, int flags)
+{
+    has_json_builder_t *b;
+    has_t *r = NULL;
+
+    if(ctx == NULL || buffer == NULL) {
+        return NULL;
+    }
+    if(flags & (HAS_JSON_PARSE_PARALLEL | HAS_JSON_PARSE_LINES |
+                HAS_JSON_PARSE_LAZY)) {
+        return has_json_parse_n(buffer, length, flags);
+    }
+    b = &ctx->builder;
+    b->decode = (flags & HAS_JSON_PARSE_DECODE) ? true : false;
+    has_json_builder_options(b, flags);
+    has_json_lexer_init(&ctx->lexer, buffer, length);
+    if(has_json_feed(&ctx->lexer, b) == 0 && b->expect == has_json_expect_end) {
+        r = b->root;
+        b->root = NULL;
+    }
+    has_json_builder_reset(b);
+    return r;
+}
+
+void has_json_ctx_free(has_json_ctx_t *ctx)
+{
+    if(ctx) {
+        has_json_builder_clear(&ctx->builder);
+        has_mem_free(ctx);
+    }
+}
+
+static has_t *has_json_parse_lazy(const char *buffer, size_t length, int flags);
+static has_t *has_json_parse_chunks(const char *buffer, size_t length,
+                                    int flags, int threads);
+
+has_t *has_json_parse_n(const char *buffer, size_t length, int flags)
+{
+    if(buffer == NULL) {
+        return NULL;
+    }
+    if(flags & HAS_JSON_PARSE_LINES) {
+        return has_ndjson_parse_array(buffer, length, flags,
+                                      (flags & HAS_JSON_PARSE_PARALLEL) ? 0 : 1);
+    }
+    if(flags & HAS_JSON_PARSE_LAZY) {
+        return has_json_parse_lazy(buffer, length, flags);
+    }
+    return (flags & HAS_JSON_PARSE_PARALLEL) ?
+        has_json_parse_chunks(buffer, length, flags, 0) :
+        has_json_parse_buffer(buffer, length, flags);
+}
+
+struct has_json_file_t {
+    void   *base;
+    size_t  size;
+    has_t  *root;
+};
+
+has_json_file_t *has_json_parse_file(const char *path, int flags)
+{
+    has_json_file_t *file;
+    struct stat st;
+    int fd;
+
+    if(path == NULL ||
+       (file = has_mem_calloc(sizeof(has_json_file_t), 1)) == NULL) {
+        return NULL;
+    }
+
+    if((fd = open(path, O_RDONLY)) < 0) {
+        has_mem_free(file);
+        return NULL;
+    }
+
+    if(fstat(fd, &st) < 0 || st.st_size <= 0 ||
+       (uintmax_t)st.st_size > SIZE_MAX ||
+       (file->base = mmap(NULL, st.st_size, PROT_READ,
+                          MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        has_mem_free(file);
+        return NULL;
+    }
+    close(fd);
+    file->size = st.st_size;
+
+    /* Read ahead while parsing, strings are then accessed in any order */
+    madvise(file->base, file->size, MADV_SEQUENTIAL);
+    file->root = has_json_parse_n(file->base, file->size, flags);
+    madvise(file->base, file->size, MADV_NORMAL);
+    if(file->root == NULL) {
+        has_json_file_close(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+has_t *has_json_file_root(has_json_file_t *file)
+{
+    return file ? file->root : NULL;
+}
+
+void has_json_file_close(has_json_file_t *file)
+{
+    if(file) {
+        has_free(file->root);
+        munmap(file->base, file->size);
+        has_mem_free(file);
+    }
+}
+
+/* Event parser: the same grammar as the builder, but values are sent
+   to a has_walk() callback instead of being stored. Only the nesting
+   stack is kept, so memory does not depend on the size of the text. */
+
+typedef struct {
+    has_types  type;
+    size_t     index;     /* Of the current member */
+    size_t     extent;    /* Of the container, if recorded */
+    bool       quiet;     /* No begin and end events */
+    has_t      container; /* Passed to the callback, without members */
+} has_json_event_frame_t;
+
+/* Text of a container, recorded for lazy parsing */
+typedef struct {
+    size_t open;        /* Position of the opening bracket */
+    size_t close;       /* Position of the closing bracket */
+    size_t descendants; /* Number of containers inside, which follow */
+} has_json_extent_t;
+
+typedef struct {
+    has_json_event_frame_t *frames;
+    size_t                  depth;
+    size_t                  frames_size;
+    has_json_expect_t       expect;
+    size_t                  skip;       /* No events from this depth */
+    bool                    skip_value; /* Next value is not traversed */
+    bool                    decode;
+    bool                    raw;
+    bool                    utf8;
+    has_walk_function_t     f;
+    void                   *pointer;
+    int                     result;     /* Returned by the callback */
+    const char             *buffer;
+    bool                    record;     /* Extents of containers */
+    has_json_extent_t      *extents;
+    size_t                  extents_count;
+    size_t                  extents_size;
+    has_json_event_frame_t  local_frames[HAS_JSON_STACK];
+} has_json_events_t;
+
+/* Container of frame f, counting the members up to the current one */
+static has_t *has_json_event_container(has_json_event_frame_t *f)
+{
+    if(f->type == has_hash) {
+        f->container.value.hash.count = f->index + 1;
+    } else {
+        f->container.value.array.count = f->index + 1;
+    }
+    return &(f->container);
+}
+
+/* Calls the callback unless events are skipped, returns -1 to abort */
+static int has_json_event(has_json_events_t *e, has_t *cur, has_walk_t type,
+                          size_t index, const char *string, size_t size,
+                          bool *skip)
+{
+    int r;
+
+    if(e->skip && e->depth >= e->skip) {
+        return 0;
+    }
+    r = e->f(cur, type, (int)index, string, size, NULL, e->pointer);
+    if(r == HAS_WALK_SKIP) {
+        if(skip) {
+            *skip = true;
+        }
+    } else if(r != 0) {
+        e->result = r;
+        return -1;
+    }
+    return 0;
+}
+
+static int has_json_event_value_begin(has_json_events_t *e)
+{
+    has_json_event_frame_t *f;
+
+    if(e->expect != has_json_expect_value &&
+       e->expect != has_json_expect_first_value) {
+        return -1;
+    }
+    if(e->depth == 0) {
+        return 0;
+    }
+    f = &(e->frames[e->depth - 1]);
+    return has_json_event(e, has_json_event_container(f),
+                          (f->type == has_hash) ?
+                          has_walk_hash_value_begin :
+                          has_walk_array_entry_begin,
+                          f->index, NULL, 0, &e->skip_value);
+}
+
+static int has_json_event_value_end(has_json_events_t *e)
+{
+    has_json_event_frame_t *f;
+
+    if(e->depth == 0) {
+        e->expect = has_json_expect_end;
+        return 0;
+    }
+    f = &(e->frames[e->depth - 1]);
+    e->expect = has_json_expect_next;
+    return has_json_event(e, &(f->container), (f->type == has_hash) ?
+                          has_walk_hash_value_end :
+                          has_walk_array_entry_end,
+                          f->index++, NULL, 0, NULL);
+}
+
+static int has_json_event_open(has_json_events_t *e, has_types type,
+                               has_json_token_t *t)
+{
+    bool skip = false, quiet;
+
+    if(has_json_event_value_begin(e) < 0) {
+        return -1;
+    }
+    quiet = e->skip_value;
+    e->skip_value = false;
+
+    if(e->depth == e->frames_size) {
+        has_json_event_frame_t *f;
+        if((f = has_json_builder_grow(e->frames, e->local_frames,
+                                      &e->frames_size,
+                                      sizeof(has_json_event_frame_t))) == NULL) {
+            return -1;
+        }
+        e->frames = f;
+    }
+    e->frames[e->depth].type = type;
+    e->frames[e->depth].index = 0;
+    e->frames[e->depth].quiet = quiet;
+    memset(&(e->frames[e->depth].container), 0, sizeof(has_t));
+    e->frames[e->depth].container.type = type;
+    if(!quiet &&
+       has_json_event(e, &(e->frames[e->depth].container),
+                      (type == has_hash) ? has_walk_hash_begin :
+                      has_walk_array_begin, 0, NULL, 0, &skip) < 0) {
+        return -1;
+    }
+    if(e->record) {
+        if(e->extents_count == e->extents_size) {
+            size_t size = e->extents_size ? 2 * e->extents_size : 64;
+            has_json_extent_t *x = has_mem_realloc(e->extents, size *
+                                                   sizeof(has_json_extent_t));
+            if(x == NULL) {
+                return -1;
+            }
+            e->extents = x;
+            e->extents_size = size;
+        }
+        e->frames[e->depth].extent = e->extents_count;
+        e->extents[e->extents_count++].open = t->start - e->buffer;
+    }
+    e->depth++;
+    if((quiet || skip) && e->skip == 0) {
+        e->skip = e->depth;
+    }
+    e->expect = (type == has_hash) ? has_json_expect_first_key :
+        has_json_expect_first_value;
+    return 0;
+}
+
+static int has_json_event_close(has_json_events_t *e, has_types type,
+                                has_json_token_t *t)
+{
+    has_json_event_frame_t *f;
+
+    if(e->depth == 0 || (f = &(e->frames[e->depth - 1]))->type != type ||
+       (e->expect != has_json_expect_next &&
+        e->expect != ((type == has_hash) ? has_json_expect_first_key :
+                      has_json_expect_first_value))) {
+        return -1;
+    }
+    e->depth--;
+    if(e->skip > e->depth) {
+        e->skip = 0;
+    }
+    if(e->record) {
+        has_json_extent_t *x = &(e->extents[f->extent]);
+        x->close = t->start - e->buffer;
+        x->descendants = e->extents_count - f->extent - 1;
+    }
+    if(!f->quiet &&
+       has_json_event(e, &(f->container), (type == has_hash) ? has_walk_hash_end :
+                      has_walk_array_end, 0, NULL, 0, NULL) < 0) {
+        return -1;
+    }
+    return has_json_event_value_end(e);
+}
+
+static int has_json_event_token(has_json_events_t *e, has_json_token_t *t)
+{
+    char *s = NULL;
+    size_t l = t->length;
+    int r = 0;
+
+    switch(t->type) {
+        case has_json_token_hash_begin:
+            return has_json_event_open(e, has_hash, t);
+        case has_json_token_array_begin:
+            return has_json_event_open(e, has_array, t);
+        case has_json_token_hash_end:
+            return has_json_event_close(e, has_hash, t);
+        case has_json_token_array_end:
+            return has_json_event_close(e, has_array, t);
+        case has_json_token_colon:
+            if(e->expect != has_json_expect_colon) {
+                return -1;
+            }
+            e->expect = has_json_expect_value;
+            return 0;
+        case has_json_token_comma:
+            if(e->expect != has_json_expect_next) {
+                return -1;
+            }
+            e->expect = (e->frames[e->depth - 1].type == has_hash) ?
+                has_json_expect_key : has_json_expect_value;
+            return 0;
+        case has_json_token_string:
+            if(e->decode && t->escaped &&
+               has_json_string_decode((char *)t->start, t->length, &s, &l) < 0) {
+                return -1;
+            }
+            if(e->utf8 && !has_json_utf8_valid(s ? s : t->start, l)) {
+                has_mem_free(s);
+                return -1;
+            }
+            if(e->expect == has_json_expect_key ||
+               e->expect == has_json_expect_first_key) {
+                has_json_event_frame_t *f = &(e->frames[e->depth - 1]);
+                e->expect = has_json_expect_colon;
+                r = has_json_event(e, has_json_event_container(f),
+                                   has_walk_hash_key, f->index,
+                                   s ? s : t->start, l, NULL);
+            } else if((r = has_json_event_value_begin(e)) == 0) {
+                if(!e->skip_value) {
+                    has_t string;
+                    memset(&string, 0, sizeof(string));
+                    has_string_init(&string, s ? s : (char *)t->start, l, false);
+                    r = has_json_event(e, &string, has_walk_string, 0,
+                                       s ? s : t->start, l, NULL);
+                }
+                e->skip_value = false;
+                r = (r < 0) ? r : has_json_event_value_end(e);
+            }
+            has_mem_free(s);
+            return r;
+        case has_json_token_primitive: {
+            has_t other;
+            memset(&other, 0, sizeof(other));
+            if(has_json_event_value_begin(e) < 0 ||
+               (e->raw ? has_json_raw_init(&other, t->start, t->length) :
+                has_json_primitive_init(&other, t->start, t->length)) == NULL) {
+                return -1;
+            }
+            if(!e->skip_value) {
+                r = has_json_event(e, &other, has_walk_other, 0,
+                                   t->start, t->length, NULL);
+            }
+            e->skip_value = false;
+            return (r < 0) ? r : has_json_event_value_end(e);
+        }
+        default:
+            return -1;
+    }
+}
+
+static void has_json_events_init(has_json_events_t *e, const char *buffer,
+                                 int flags, has_walk_function_t f,
+                                 void *pointer)
+{
+    memset(e, 0, offsetof(has_json_events_t, local_frames));
+    e->frames = e->local_frames;
+    e->frames_size = HAS_JSON_STACK;
+    e->expect = has_json_expect_value;
+    e->decode = (flags & HAS_JSON_PARSE_DECODE) ? true : false;
+    e->raw = (flags & HAS_JSON_PARSE_RAW) ? true : false;
+    e->utf8 = (flags & HAS_JSON_PARSE_UTF8) ? true : false;
+    e->f = f;
+    e->pointer = pointer;
+    e->buffer = buffer;
+}
+
+static int has_json_events_run(has_json_events_t *e, size_t length)
+{
+    has_json_lexer_t *l;
+    has_json_token_t t;
+    bool indexed;
+    int r = -1;
+
+    if((l = has_mem_alloc(sizeof(has_json_lexer_t))) == NULL) {
+        return -1;
+    }
+    has_json_lexer_init(l, e->buffer, length);
+    indexed = has_json_indexable(l);
+    for(;;) {
+        if(!indexed) {
+            has_json_lex(l, &t);
+        } else {
+            has_json_lex_indexed(l, &t);
+        }
+        if(t.type == has_json_token_end) {
+            r = (e->expect == has_json_expect_end) ? 0 : -1;
+            break;
+        }
+        if(has_json_event_token(e, &t) < 0) {
+            /* Aborted by the callback or invalid text */
+            r = e->result ? e->result : -1;
+            break;
+        }
+    }
+    if(e->frames != e->local_frames) {
+        has_mem_free(e->frames);
+    }
+    has_mem_free(l);
+    return r;
+}
+
+int has_json_walk(const char *buffer, size_t length, int flags,
+                  has_walk_function_t f, void *pointer)
+{
+    has_json_events_t e;
+
+    if(buffer == NULL || f == NULL) {
+        return -1;
+    }
+    has_json_events_init(&e, buffer, flags, f, pointer);
+    return has_json_events_run(&e, length);
+}
+
+/* Lazy parsing: a first pass validates the text and records the extent
+   of each container. A lazy container is built from its extent when
+   first accessed: the text of its direct members is parsed, the
+   extents of containers it holds are skipped and they become lazy in
+   turn. The extents are shared by all the lazy containers of a text
+   and released with the last one. */
+
+typedef struct {
+    const char        *buffer;
+    has_json_extent_t *extents;
+    bool               decode;
+    int                flags;
+    size_t             references;
+} has_json_lazy_t;
+
+static int has_json_validator(has_t *cur, has_walk_t type, int index,
+                              const char *string, size_t size,
+                              has_t *element, void *pointer)
+{
+    return 0;
+}
+
+static void has_json_lazy_release(has_lazy_t *lazy)
+{
+    has_json_lazy_t *d = lazy->source;
+
+    if(--d->references == 0) {
+        has_mem_free(d->extents);
+        has_mem_free(d);
+    }
+}
+
+static int has_json_lazy_materialize(has_t *e, has_lazy_t *lazy);
+
+static has_t *has_json_lazy_new(has_json_lazy_t *d, size_t extent)
+{
+    has_lazy_t lazy;
+    has_t *r;
+
+    lazy.source = d;
+    lazy.index = extent;
+    lazy.materialize = has_json_lazy_materialize;
+    lazy.release = has_json_lazy_release;
+    if((r = has_lazy_new(d->buffer[d->extents[extent].open] == '{' ?
+                         has_hash : has_array, &lazy)) != NULL) {
+        d->references++;
+    }
+    return r;
+}
+
+static int has_json_lazy_materialize(has_t *e, has_lazy_t *lazy)
+{
+    has_json_lazy_t *d = lazy->source;
+    has_json_extent_t *x = &(d->extents[lazy->index]);
+    size_t child = lazy->index + 1;
+    has_json_lexer_t l;
+    has_json_builder_t b;
+    has_json_token_t t;
+    has_t *c = NULL;
+    int r = 0;
+
+    memset(&l, 0, offsetof(has_json_lexer_t, positions));
+    l.buffer = d->buffer;
+    l.position = x->open + 1;
+    l.length = x->close;
+    has_json_builder_init(&b, d->decode, false);
+    has_json_builder_options(&b, d->flags);
+    has_json_builder_open(&b, e->type);
+    /* The text was validated by the first pass */
+    while(r == 0) {
+        has_json_lex(&l, &t);
+        if(t.type == has_json_token_end) {
+            break;
+        } else if(t.type == has_json_token_hash_begin ||
+                  t.type == has_json_token_array_begin) {
+            r = has_json_builder_value(&b, has_json_lazy_new(d, child));
+            l.position = d->extents[child].close + 1;
+            child += d->extents[child].descendants + 1;
+        } else {
+            r = has_json_builder_token(&b, &t);
+        }
+    }
+    if(r == 0 && has_json_builder_close(&b, e->type) == 0) {
+        /* Moves the content of the built container into e */
+        c = b.root;
+        b.root = NULL;
+        e->value = c->value;
+        memset(&(c->value), 0, sizeof(c->value));
+        has_free(c);
+    }
+    has_json_builder_clear(&b);
+    if(c == NULL) {
+        return -1;
+    }
+    has_json_lazy_release(lazy);
+    return 0;
+}
+
+static has_t *has_json_parse_lazy(const char *buffer, size_t length, int flags)
+{
+    has_json_events_t e;
+    has_json_lazy_t *d;
+    has_t *r = NULL;
+
+    has_json_events_init(&e, buffer, flags, has_json_validator, NULL);
+    e.record = true;
+    if(has_json_events_run(&e, length) < 0) {
+        has_mem_free(e.extents);
+        return NULL;
+    }
+    if(e.extents_count == 0) {
+        /* Scalar */
+        return has_json_parse_buffer(buffer, length, flags);
+    }
+
+    if((d = has_mem_alloc(sizeof(has_json_lazy_t))) == NULL) {
+        has_mem_free(e.extents);
+        return NULL;
+    }
+    d->buffer = buffer;
+    d->extents = e.extents;
+    d->decode = (flags & HAS_JSON_PARSE_DECODE) ? true : false;
+    d->flags = flags;
+    d->references = 1;
+    r = has_json_lazy_new(d, 0);
+    /* Released by the root */
+    d->references--;
+    if(r == NULL) {
+        has_mem_free(d->extents);
+        has_mem_free(d);
+    }
+    return r;
+}
+
+/* Projection: paths are JSON Pointers compiled to tokens, a value is
+   matched against the tokens at its depth. The containers leading to
+   selected values are passed to the builder, when the first selected
+   value inside them is found, with only their selected members (and
+   null entries keeping array positions), commas and colons being
+   synthesized. Other values are skipped by counting brackets, their
+   strings are not decoded and their primitives not converted. */
+
+#define HAS_JSON_SELECT_MAX 64
+
+typedef struct {
+    const char *key;   /* Unescaped */
+    size_t      size;
+    long        index; /* -1 if the token is not an array index */
+} has_json_pointer_token_t;
+
+typedef struct {
+    has_json_pointer_token_t  *tokens;
+    size_t                     count;
+} has_json_pointer_t;
+
+typedef struct {
+    has_types        type;
+    uint64_t         paths;     /* Paths going through the container */
+    size_t           index;     /* Position of the current entry */
+    size_t           forwarded; /* Members passed to the builder */
+    bool             opened;    /* Passed to the builder */
+    has_json_token_t key;       /* Key in the parent hash */
+} has_json_select_frame_t;
+
+typedef struct {
+    has_json_pointer_t       pointers[HAS_JSON_SELECT_MAX];
+    size_t                   count;
+    has_json_builder_t       builder;
+    has_json_select_frame_t *frames;
+    size_t                   depth;
+    size_t                   frames_size;
+    has_json_expect_t        expect;
+    size_t                   skip;   /* Depth inside a skipped value */
+    size_t                   copy;   /* Depth inside a selected value */
+    has_json_token_t         key;    /* Key of the current member */
+    uint64_t                 member; /* Paths matching the key */
+    has_json_select_frame_t  local_frames[HAS_JSON_STACK];
+} has_json_select_t;
+
+/* Splits the pointers in tokens stored in one allocation */
+static void *has_json_select_compile(has_json_select_t *s, const char **paths)
+{
+    size_t i, n = 0, text = 0;
+    has_json_pointer_token_t *tokens;
+    const char *p;
+    char *o;
+    void *block;
+
+    for(s->count = 0; paths[s->count]; s->count++) {
+        if(s->count == HAS_JSON_SELECT_MAX ||
+           (paths[s->count][0] != '/' && paths[s->count][0] != '\0')) {
+            return NULL;
+        }
+        for(p = paths[s->count]; *p; p++) {
+            n += (*p == '/');
+        }
+        text += p - paths[s->count];
+    }
+    if(s->count == 0 ||
+       (block = has_mem_alloc(n * sizeof(has_json_pointer_token_t) + text + 1)) == NULL) {
+        return NULL;
+    }
+    tokens = block;
+    o = (char *)(tokens + n);
+    for(i = 0; i < s->count; i++) {
+        s->pointers[i].tokens = tokens;
+        s->pointers[i].count = 0;
+        for(p = paths[i]; *p; tokens++, s->pointers[i].count++) {
+            tokens->key = o;
+            tokens->index = 0;
+            for(p++; *p && *p != '/'; p++) {
+                if(*p == '~' && (p[1] == '0' || p[1] == '1')) {
+                    *o++ = (*++p == '0') ? '~' : '/';
+                } else if(*p == '~') {
+                    has_mem_free(block);
+                    return NULL;
+                } else {
+                    *o++ = *p;
+                }
+                if(tokens->index >= 0 && *(o - 1) >= '0' && *(o - 1) <= '9' &&
+                   tokens->index < (LONG_MAX - 9) / 10 &&
+                   (o - 1 == tokens->key || tokens->key[0] != '0')) {
+                    tokens->index = tokens->index * 10 + (*(o - 1) - '0');
+                } else {
+                    tokens->index = -1;
+                }
+            }
+            tokens->size = o - tokens->key;
+            if(tokens->size == 0) {
+                tokens->index = -1;
+            }
+        }
+    }
+    return block;
+}
+
+/* Paths of mask whose token at depth is key (index if key is NULL) */
+static uint64_t has_json_select_match(has_json_select_t *s, uint64_t mask,
+                                      size_t depth, const char *key,
+                                      size_t size, size_t index)
+{
+    uint64_t r = 0;
+    size_t i;
+
+    for(i = 0; i < s->count; i++) {
+        has_json_pointer_t *p = &(s->pointers[i]);
+        has_json_pointer_token_t *t;
+        if(!(mask & ((uint64_t)1 << i)) || p->count <= depth) {
+            continue;
+        }
+        t = &(p->tokens[depth]);
+        if(key ? (t->size == size && memcmp(t->key, key, size) == 0) :
+           (t->index == (long)index)) {
+            r |= (uint64_t)1 << i;
+        }
+    }
+    return r;
+}
+
+/* Paths of mask ending at depth */
+static uint64_t has_json_select_ends(has_json_select_t *s, uint64_t mask,
+                                     size_t depth)
+{
+    uint64_t r = 0;
+    size_t i;
+
+    for(i = 0; i < s->count; i++) {
+        if((mask & ((uint64_t)1 << i)) && s->pointers[i].count == depth) {
+            r |= (uint64_t)1 << i;
+        }
+    }
+    return r;
+}
+
+static int has_json_select_forward(has_json_select_t *s,
+                                   has_json_token_type_t type,
+                                   const char *start, size_t length)
+{
+    has_json_token_t t;
+
+    t.type = type;
+    t.start = start;
+    t.length = length;
+    t.escaped = false;
+    return has_json_builder_token(&(s->builder), &t);
+}
+
+/* Passes to the builder what precedes a selected member of f:
+   separators, nulls for skipped array entries, key */
+static int has_json_select_member(has_json_select_t *s,
+                                  has_json_select_frame_t *f,
+                                  has_json_token_t *key)
+{
+    if(f == NULL) {
+        return 0;
+    }
+    while(f->type == has_array && f->forwarded < f->index) {
+        if((f->forwarded++ > 0 &&
+            has_json_select_forward(s, has_json_token_comma, ",", 1) < 0) ||
+           has_json_select_forward(s, has_json_token_primitive, "null", 4) < 0) {
+            return -1;
+        }
+    }
+    if(f->forwarded++ > 0 &&
+       has_json_select_forward(s, has_json_token_comma, ",", 1) < 0) {
+        return -1;
+    }
+    if(f->type == has_hash &&
+       (has_json_builder_token(&(s->builder), key) < 0 ||
+        has_json_select_forward(s, has_json_token_colon, ":", 1) < 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Passes to the builder the containers not opened yet */
+static int has_json_select_open(has_json_select_t *s)
+{
+    size_t i;
+
+    for(i = 0; i < s->depth; i++) {
+        has_json_select_frame_t *f = &(s->frames[i]);
+        if(f->opened) {
+            continue;
+        }
+        if(has_json_select_member(s, i ? &(s->frames[i - 1]) : NULL, &f->key) < 0 ||
+           has_json_select_forward(s, (f->type == has_hash) ?
+                                   has_json_token_hash_begin :
+                                   has_json_token_array_begin,
+                                   (f->type == has_hash) ? "{" : "[", 1) < 0) {
+            return -1;
+        }
+        f->opened = true;
+    }
+    return 0;
+}
+
+static void has_json_select_value_end(has_json_select_t *s)
+{
+    if(s->depth == 0) {
+        s->expect = has_json_expect_end;
+    } else {
+        s->frames[s->depth - 1].index++;
+        s->expect = has_json_expect_next;
+    }
+}
+
+/* First token of a value */
+static int has_json_select_value(has_json_select_t *s, has_json_token_t *t)
+{
+    has_json_select_frame_t *f = s->depth ? &(s->frames[s->depth - 1]) : NULL;
+    bool open = (t->type == has_json_token_hash_begin ||
+                 t->type == has_json_token_array_begin);
+    uint64_t mask;
+
+    if(s->expect != has_json_expect_value &&
+       s->expect != has_json_expect_first_value) {
+        return -1;
+    }
+    if(f == NULL) {
+        mask = (s->count == HAS_JSON_SELECT_MAX) ? ~(uint64_t)0 :
+            (((uint64_t)1 << s->count) - 1);
+    } else if(f->type == has_hash) {
+        mask = s->member;
+    } else {
+        mask = has_json_select_match(s, f->paths, s->depth - 1, NULL, 0,
+                                     f->index);
+    }
+
+    if(has_json_select_ends(s, mask, s->depth)) {
+        /* Selected, passed as is */
+        if(has_json_select_open(s) < 0 ||
+           has_json_select_member(s, f, &(s->key)) < 0 ||
+           has_json_builder_token(&(s->builder), t) < 0) {
+            return -1;
+        }
+        s->copy = open ? 1 : 0;
+    } else if(mask && open) {
+        /* On the way to a selected value */
+        if(s->depth == s->frames_size) {
+            has_json_select_frame_t *n;
+            if((n = has_json_builder_grow(s->frames, s->local_frames,
+                                          &s->frames_size,
+                                          sizeof(has_json_select_frame_t))) == NULL) {
+                return -1;
+            }
+            s->frames = n;
+        }
+        f = &(s->frames[s->depth++]);
+        f->type = (t->type == has_json_token_hash_begin) ? has_hash : has_array;
+        f->paths = mask;
+        f->index = 0;
+        f->forwarded = 0;
+        f->opened = false;
+        f->key = s->key;
+        s->expect = (f->type == has_hash) ? has_json_expect_first_key :
+            has_json_expect_first_value;
+        /* The root is passed even if nothing inside is selected */
+        return (s->depth == 1) ? has_json_select_open(s) : 0;
+    } else {
+        s->skip = open ? 1 : 0;
+    }
+    if(s->copy == 0 && s->skip == 0) {
+        has_json_select_value_end(s);
+    }
+    return 0;
+}
+
+static int has_json_select_token(has_json_select_t *s, has_json_token_t *t)
+{
+    bool open = (t->type == has_json_token_hash_begin ||
+                 t->type == has_json_token_array_begin);
+    bool close = (t->type == has_json_token_hash_end ||
+                  t->type == has_json_token_array_end);
+    has_json_select_frame_t *f;
+    char *k;
+    size_t l;
+
+    if(t->type == has_json_token_error) {
+        return -1;
+    } else if(s->skip) {
+        s->skip += open ? 1 : (close ? -1 : 0);
+        if(s->skip == 0) {
+            has_json_select_value_end(s);
+        }
+        return 0;
+    } else if(s->copy) {
+        s->copy += open ? 1 : (close ? -1 : 0);
+        if(has_json_builder_token(&(s->builder), t) < 0) {
+            return -1;
+        }
+        if(s->copy == 0) {
+            has_json_select_value_end(s);
+        }
+        return 0;
+    }
+
+    f = s->depth ? &(s->frames[s->depth - 1]) : NULL;
+    switch(t->type) {
+        case has_json_token_hash_end:
+        case has_json_token_array_end:
+            if(f == NULL ||
+               f->type != ((t->type == has_json_token_hash_end) ? has_hash : has_array) ||
+               (s->expect != has_json_expect_next &&
+                s->expect != has_json_expect_first_key &&
+                s->expect != has_json_expect_first_value)) {
+                return -1;
+            }
+            if(f->opened && has_json_builder_token(&(s->builder), t) < 0) {
+                return -1;
+            }
+            s->depth--;
+            has_json_select_value_end(s);
+            return 0;
+        case has_json_token_colon:
+            if(s->expect != has_json_expect_colon) {
+                return -1;
+            }
+            s->expect = has_json_expect_value;
+            return 0;
+        case has_json_token_comma:
+            if(s->expect != has_json_expect_next) {
+                return -1;
+            }
+            s->expect = (f->type == has_hash) ? has_json_expect_key :
+                has_json_expect_value;
+            return 0;
+        case has_json_token_string:
+            if(s->expect == has_json_expect_key ||
+               s->expect == has_json_expect_first_key) {
+                /* Keys are compared decoded */
+                if(t->escaped) {
+                    if(has_json_string_decode((char *)t->start, t->length, &k, &l) < 0) {
+                        return -1;
+                    }
+                    s->member = has_json_select_match(s, f->paths, s->depth - 1,
+                                                      k, l, 0);
+                    has_mem_free(k);
+                } else {
+                    s->member = has_json_select_match(s, f->paths, s->depth - 1,
+                                                      t->start, t->length, 0);
+                }
+                s->key = *t;
+                s->expect = has_json_expect_colon;
+                return 0;
+            }
+            return has_json_select_value(s, t);
+        case has_json_token_primitive:
+        case has_json_token_hash_begin:
+        case has_json_token_array_begin:
+            return has_json_select_value(s, t);
+        default:
+            return -1;
+    }
+}
+
+has_t *has_json_parse_select(const char *buffer, size_t length,
+                             const char **paths, int flags)
+{
+    has_json_select_t s;
+    has_json_lexer_t l;
+    has_json_token_t t;
+    bool indexed;
+    void *block;
+    has_t *r = NULL;
+
+    if(buffer == NULL || paths == NULL ||
+       (block = has_json_select_compile(&s, paths)) == NULL) {
+        return NULL;
+    }
+    has_json_builder_init(&s.builder, (flags & HAS_JSON_PARSE_DECODE) ? true : false,
+                          false);
+    has_json_builder_options(&s.builder, flags);
+    s.frames = s.local_frames;
+    s.frames_size = HAS_JSON_STACK;
+    s.depth = 0;
+    s.expect = has_json_expect_value;
+    s.skip = 0;
+    s.copy = 0;
+    s.member = 0;
+
+    has_json_lexer_init(&l, buffer, length);
+    indexed = has_json_indexable(&l);
+    for(;;) {
+        if(!indexed) {
+            has_json_lex(&l, &t);
+        } else {
+            has_json_lex_indexed(&l, &t);
+        }
+        if(t.type == has_json_token_end) {
+            if(s.expect == has_json_expect_end) {
+                r = s.builder.root;
+                s.builder.root = NULL;
+            }
+            break;
+        }
+        if(s.expect == has_json_expect_end || has_json_select_token(&s, &t) < 0) {
+            break;
+        }
+    }
+    has_json_builder_clear(&s.builder);
+    if(s.frames != s.local_frames) {
+        has_mem_free(s.frames);
+    }
+    has_mem_free(block);
+    return r;
+}
+
+/* Streaming parser: chunks are lexed in place, only a string or
+   primitive cut by the end of a chunk is kept, in the pending buffer,
+   until the rest is fed. As chunks do not outlive has_json_parser_feed,
+   the builder copies strings. */
+
+typedef enum {
+    has_json_pending_none,
+    has_json_pending_string,
+    has_json_pending_primitive
+} has_json_pending_t;
+
+struct has_json_parser_t {
+    has_json_builder_t  builder;
+    has_json_pending_t  pending;
+    char               *buffer;  /* Pending token */
+    size_t              length;
+    size_t              size;
+    bool                escape;  /* Next pending string byte is escaped */
+    bool                escaped; /* Pending string contains escapes */
+    bool                failed;
+};
+
+has_json_parser_t *has_json_parser_new(int flags)
+{
+    has_json_parser_t *p;
+
+    if((p = has_mem_calloc(sizeof(has_json_parser_t), 1)) != NULL) {
+        has_json_builder_init(&p->builder,
+                              (flags & HAS_JSON_PARSE_DECODE) ? true : false,
+                              true);
+        has_json_builder_options(&p->builder, flags);
+    }
+    return p;
+}
+
+static int has_json_parser_append(has_json_parser_t *p, const char *s, size_t n)
+{
+    if(p->length + n > p->size) {
+        size_t size = p->size ? p->size : 64;
+        char *b;
+        while(size < p->length + n && size <= SIZE_MAX / 2) {
+            size *= 2;
+        }
+        if(size < p->length + n) {
+            return -1;
+        }
+        if((b = has_mem_realloc(p->buffer, size)) == NULL) {
+            return -1;
+        }
+        p->buffer = b;
+        p->size = size;
+    }
+    if(n > 0) {
+        memcpy(p->buffer + p->length, s, n);
+        p->length += n;
+    }
+    return 0;
+}
+
+/* Scans a string from position i up to its closing quote, returns its
+   position, n if the string continues in the next chunk or -1 */
+static ptrdiff_t has_json_parser_string(has_json_parser_t *p, const char *s,
+                                        size_t i, size_t n)
+{
+    for(; i < n; i++) {
+        unsigned char c = s[i];
+        if(c < 0x20) {
+            return -1;
+        } else if(p->escape) {
+            p->escape = false;
+        } else if(c == '\\') {
+            p->escape = p->escaped = true;
+        } else if(c == '"') {
+            return i;
+        }
+    }
+    return n;
+}
+
+/* Sends the pending token to the builder */
+static int has_json_parser_flush(has_json_parser_t *p)
+{
+    has_json_token_t t;
+
+    t.type = (p->pending == has_json_pending_string) ?
+        has_json_token_string : has_json_token_primitive;
+    t.start = p->buffer;
+    t.length = p->length;
+    t.escaped = p->escaped;
+    p->pending = has_json_pending_none;
+    p->length = 0;
+    if(t.escaped && !has_json_check_escapes(t.start, t.length)) {
+        return -1;
+    }
+    return has_json_builder_token(&p->builder, &t);
+}
+
+static int has_json_parser_chunk(has_json_parser_t *p, const char *chunk,
+                                 size_t length)
+{
+    has_json_lexer_t l;
+    has_json_token_t t;
+    ptrdiff_t q;
+    size_t i = 0;
+    char c;
+
+    /* Rest of the pending token */
+    if(p->pending == has_json_pending_string) {
+        if((q = has_json_parser_string(p, chunk, 0, length)) < 0 ||
+           has_json_parser_append(p, chunk, q) < 0) {
+            return -1;
+        }
+        if(q == length) {
+            return 0;
+        }
+        i = q + 1;
+        if(has_json_parser_flush(p) < 0) {
+            return -1;
+        }
+    } else if(p->pending == has_json_pending_primitive) {
+        while(i < length && (c = chunk[i]) != ',' && c != ']' && c != '}' &&
+              c != ':' && c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+            i++;
+        }
+        if(has_json_parser_append(p, chunk, i) < 0) {
+            return -1;
+        }
+        if(i == length) {
+            return 0;
+        }
+        if(has_json_parser_flush(p) < 0) {
+            return -1;
+        }
+    }
+
+    /* Tokens within the chunk */
+    has_json_lexer_init(&l, chunk, length);
+    l.position = i;
+    for(;;) {
+        has_json_lex(&l, &t);
+        if(t.type == has_json_token_end) {
+            return 0;
+        } else if(t.type == has_json_token_primitive && l.position == length) {
+            p->pending = has_json_pending_primitive;
+            return has_json_parser_append(p, t.start, t.length);
+        } else if(t.type == has_json_token_error) {
+            /* Unless the string is cut by the end of the chunk */
+            i = t.start - chunk;
+            p->escape = p->escaped = false;
+            if(has_json_parser_string(p, chunk, i, length) != length) {
+                return -1;
+            }
+            p->pending = has_json_pending_string;
+            return has_json_parser_append(p, chunk + i, length - i);
+        } else if(has_json_builder_token(&p->builder, &t) < 0) {
+            return -1;
+        }
+    }
+}
+
+int has_json_parser_feed(has_json_parser_t *parser, const char *chunk,
+                         size_t length)
+{
+    if(parser == NULL || parser->failed || (chunk == NULL && length > 0)) {
+        return -1;
+    }
+    if(length > 0 && has_json_parser_chunk(parser, chunk, length) < 0) {
+        parser->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+has_t *has_json_parser_finish(has_json_parser_t *parser)
+{
+    has_t *r = NULL;
+
+    if(parser == NULL) {
+        return NULL;
+    }
+    if(!parser->failed &&
+       (parser->pending == has_json_pending_none ||
+        (parser->pending == has_json_pending_primitive &&
+         has_json_parser_flush(parser) == 0)) &&
+       parser->builder.expect == has_json_expect_end) {
+        r = parser->builder.root;
+        parser->builder.root = NULL;
+    }
+    has_json_builder_clear(&parser->builder);
+    has_mem_free(parser->buffer);
+    has_mem_free(parser);
+    return r;
+}
+
+/* Parallel parsing: the input is cut in chunks, one per thread.
+
+   1. Each chunk is indexed assuming it does not start inside a string.
+      It gives the parity of its quotes and its nesting depth change.
+   2. Prefix sums give the real state at the start of each chunk (the
+      rare chunks that start inside a string are scanned again). Each
+      thread finds in its chunk the first comma separating members of
+      the root container.
+   3. Each thread parses the members between its comma and the next
+      one, the resulting containers are concatenated. */
+
+#ifndef HAS_JSON_CHUNK_MIN
+#define HAS_JSON_CHUNK_MIN (1 << 20)
+#endif
+
+typedef struct {
+    const char *buffer;
+    size_t      length;
+    size_t      start;    /* Chunk */
+    size_t      end;
+    bool        string;   /* Chunk starts inside a string */
+    long        level;    /* Depth at start of chunk */
+    int         parity;   /* Odd number of quotes */
+    long        depth;    /* Depth change over the chunk */
+    long        minimum;  /* Lowest depth change */
+    size_t      low;      /* First position of the lowest depth */
+    size_t      split;    /* First comma between root members */
+    size_t      from;     /* Members parsed by this thread */
+    size_t      to;
+    has_types   type;
+    int         flags;    /* Parsing options */
+    bool        segment;  /* from and to are set */
+    bool        empty;
+    has_t      *result;
+} has_json_chunk_t;
+
+/* Scans a chunk, stopping at the first comma at depth 1 if split */
+static void has_json_chunk_scan(has_json_chunk_t *c, bool split)
+{
+    has_json_classifier_t classify = has_json_classifier();
+    const char *b = c->buffer;
+    has_json_indexer_t s;
+    size_t i, p;
+    long depth = 0;
+
+    memset(&s, 0, sizeof(s));
+    s.string = c->string ? ~(uint64_t)0 : 0;
+    /* An odd run of backslashes before the chunk escapes its first byte */
+    for(p = c->start; p > 0 && b[p - 1] == '\\'; p--) {
+        /* Nothing */
+    }
+    s.escaped = (c->start - p) & 1;
+
+    c->parity = 0;
+    c->minimum = 0;
+    c->low = c->split = SIZE_MAX;
+    for(i = c->start; i < c->end; i += HAS_JSON_BLOCK) {
+        const char *block = b + i;
+        char tail[HAS_JSON_BLOCK];
+        uint64_t bits;
+
+        if(c->end - i < HAS_JSON_BLOCK) {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, block, c->end - i);
+            block = tail;
+        }
+        /* Errors are found when the members are parsed */
+        has_json_index_block(&s, block, classify, &bits);
+        while(bits) {
+            p = i + has_json_ctz(bits);
+            bits &= bits - 1;
+            switch(b[p]) {
+                case '"':
+                    c->parity ^= 1;
+                    break;
+                case '{': case '[':
+                    depth++;
+                    break;
+                case '}': case ']':
+                    if(--depth < c->minimum) {
+                        c->minimum = depth;
+                        c->low = p;
+                    }
+                    break;
+                case ',':
+                    if(split && c->level + depth == 1) {
+                        c->split = p;
+                        return;
+                    }
+                    break;
+            }
+        }
+    }
+    c->depth = depth;
+}
+
+/* Parses members of a container without its brackets */
+static has_t *has_json_parse_members(const char *buffer, size_t length,
+                                     has_types type, int flags, bool *empty)
+{
+    has_json_lexer_t *l;
+    has_json_builder_t b;
+    has_t *r = NULL;
+
+    if((l = has_mem_alloc(sizeof(has_json_lexer_t))) == NULL) {
+        return NULL;
+    }
+    has_json_lexer_init(l, buffer, length);
+    has_json_builder_init(&b, (flags & HAS_JSON_PARSE_DECODE) ? true : false,
+                          false);
+    has_json_builder_options(&b, flags);
+    has_json_builder_open(&b, type);
+    *empty = false;
+    if(has_json_feed(l, &b) == 0 && b.depth == 1) {
+        *empty = (b.expect == has_json_expect_first_key ||
+                  b.expect == has_json_expect_first_value);
+        if(has_json_builder_close(&b, type) == 0) {
+            r = b.root;
+            b.root = NULL;
+        }
+    }
+    has_json_builder_clear(&b);
+    has_mem_free(l);
+    return r;
+}
+
+static void *has_json_chunk_split(void *p)
+{
+    has_json_chunk_t *c = p;
+    has_json_chunk_scan(c, true);
+    return NULL;
+}
+
+static void *has_json_chunk_first(void *p)
+{
+    has_json_chunk_t *c = p;
+    has_json_chunk_scan(c, false);
+    return NULL;
+}
+
+static void *has_json_chunk_parse(void *p)
+{
+    has_json_chunk_t *c = p;
+    if(!c->segment) {
+        return NULL;
+    }
+    c->result = has_json_parse_members(c->buffer + c->from, c->to - c->from,
+                                       c->type, c->flags, &c->empty);
+    return NULL;
+}
+
+/* Runs f on each chunk, in the calling thread for the first one or if
+   a thread can not be started */
+static void has_json_chunks_run(has_json_chunk_t *chunks, int n,
+                                void *(*f)(void *))
+{
+    pthread_t *threads = has_mem_calloc(n, sizeof(pthread_t));
+    bool *started = has_mem_calloc(n, sizeof(bool));
+    int i;
+
+    for(i = 1; i < n; i++) {
+        if(threads && started &&
+           pthread_create(&threads[i], NULL, f, &chunks[i]) == 0) {
+            started[i] = true;
+        } else {
+            f(&chunks[i]);
+        }
+    }
+    f(&chunks[0]);
+    for(i = 1; i < n; i++) {
+        if(started && started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    has_mem_free(threads);
+    has_mem_free(started);
+}
+
+/* Concatenates the members of the containers of chunks */
+static has_t *has_json_chunks_join(has_json_chunk_t *chunks, int n, has_types type)
+{
+    size_t total = 0, j, k;
+    has_t *r;
+    int i;
+
+    for(i = 0; i < n; i++) {
+        if(chunks[i].result) {
+            total += (type == has_hash) ? chunks[i].result->value.hash.count :
+                chunks[i].result->value.array.count;
+        }
+    }
+    if((r = (type == has_hash) ? has_hash_new(total ? total : 1) :
+        has_array_new(total)) == NULL) {
+        return NULL;
+    }
+
+    for(i = 0, k = 0; i < n; i++) {
+        has_t *c = chunks[i].result;
+        if(c == NULL) {
+            continue;
+        }
+        if(type == has_array) {
+            for(j = 0; j < c->value.array.count; j++) {
+                r->value.array.elements[k++] = c->value.array.elements[j];
+            }
+            r->value.array.count = k;
+            c->value.array.count = 0;
+        } else {
+            has_hash_entry_t *e = c->value.hash.entries;
+            for(j = 0; j < c->value.hash.size; j++) {
+                if(e[j].key.pointer == NULL) {
+                    continue;
+                }
+                if(has_hash_set_o(r, e[j].key.pointer, e[j].key.size,
+                                  e[j].value, e[j].key.owner) == NULL) {
+                    /* Members from j are still owned by c */
+                    has_free(r);
+                    return NULL;
+                }
+                e[j].key.pointer = NULL;
+            }
+        }
+        has_free(c);
+        chunks[i].result = NULL;
+    }
+    return r;
+}
+
+/* Parallel parser, flags other than DECODE, RAW and UTF8 being ignored */
+static has_t *has_json_parse_chunks(const char *buffer, size_t length,
+                                    int flags, int threads)
+{
+    has_json_chunk_t *chunks;
+    size_t root = 0, close = SIZE_MAX, p;
+    has_types type;
+    has_t *r = NULL;
+    bool string = false, valid;
+    long level = 0;
+    int i, n, segments = 0;
+
+    if(buffer == NULL) {
+        return NULL;
+    }
+    if(threads <= 0) {
+        long c = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (c > 0) ? (int)c : 1;
+    }
+    if((size_t)threads > length / HAS_JSON_CHUNK_MIN) {
+        threads = length / HAS_JSON_CHUNK_MIN;
+    }
+    while(root < length && (buffer[root] == ' ' || buffer[root] == '\n' ||
+                            buffer[root] == '\r' || buffer[root] == '\t')) {
+        root++;
+    }
+    if(threads < 2 || root == length ||
+       (buffer[root] != '[' && buffer[root] != '{')) {
+        return has_json_parse_buffer(buffer, length, flags);
+    }
+    type = (buffer[root] == '[') ? has_array : has_hash;
+
+    if((chunks = has_mem_calloc(threads, sizeof(has_json_chunk_t))) == NULL) {
+        return NULL;
+    }
+    n = threads;
+    for(i = 0; i < n; i++) {
+        has_json_chunk_t *c = &chunks[i];
+        c->buffer = buffer;
+        c->length = length;
+        /* Block aligned boundaries */
+        c->start = (i == 0) ? 0 :
+            (length / n * i) & ~(size_t)(HAS_JSON_BLOCK - 1);
+        c->end = (i == n - 1) ? length :
+            (length / n * (i + 1)) & ~(size_t)(HAS_JSON_BLOCK - 1);
+        c->type = type;
+        c->flags = flags;
+    }
+
+    /* Pass 1 and prefix sums */
+    has_json_chunks_run(chunks, n, has_json_chunk_first);
+    for(i = 0; i < n; i++) {
+        has_json_chunk_t *c = &chunks[i];
+        if(c->string != string) {
+            /* Speculation failed, scan again from inside a string */
+            c->string = string;
+            has_json_chunk_scan(c, false);
+        }
+        c->level = level;
+        if(close == SIZE_MAX && c->low != SIZE_MAX && level + c->minimum <= 0) {
+            close = c->low;
+        }
+        level += c->depth;
+        string = string ^ c->parity;
+    }
+
+    /* The root must be closed with a matching bracket, followed by
+       whitespace only */
+    valid = !string && close != SIZE_MAX &&
+        buffer[close] == ((type == has_array) ? ']' : '}');
+    for(p = close + 1; valid && p < length; p++) {
+        valid = (buffer[p] == ' ' || buffer[p] == '\n' ||
+                 buffer[p] == '\r' || buffer[p] == '\t');
+    }
+    if(!valid) {
+        has_mem_free(chunks);
+        return NULL;
+    }
+
+    /* Pass 2: member boundaries */
+    has_json_chunks_run(chunks + 1, n - 1, has_json_chunk_split);
+    chunks[0].split = root;
+    for(i = 0; i < n; i++) {
+        has_json_chunk_t *c = &chunks[i], *d = NULL;
+        int j;
+        if(c->split == SIZE_MAX || c->split >= close) {
+            continue;
+        }
+        for(j = i + 1; j < n && d == NULL; j++) {
+            if(chunks[j].split != SIZE_MAX && chunks[j].split < close) {
+                d = &chunks[j];
+            }
+        }
+        c->from = c->split + 1;
+        c->to = d ? d->split : close;
+        c->segment = true;
+        segments++;
+    }
+
+    /* Pass 3: members */
+    has_json_chunks_run(chunks, n, has_json_chunk_parse);
+    valid = true;
+    for(i = 0; i < n; i++) {
+        if(chunks[i].segment &&
+           (chunks[i].result == NULL || (chunks[i].empty && segments > 1))) {
+            valid = false;
+        }
+    }
+    if(valid) {
+        r = has_json_chunks_join(chunks, n, type);
+    }
+    for(i = 0; i < n; i++) {
+        has_free(chunks[i].result);
+    }
+    has_mem_free(chunks);
+    return r;
+}
+
+has_t *has_json_parse_parallel(const char *buffer, size_t length, bool decode,
+                               int threads)
+{
+    return has_json_parse_chunks(buffer, length,
+                                 decode ? HAS_JSON_PARSE_DECODE : 0, threads);
+}
+
+/* Newline-delimited JSON: the buffer is cut in batches of lines which
+   workers parse in any order, at most a window of batches ahead of the
+   calling thread that delivers the records in order. */
+
+#ifndef HAS_NDJSON_BATCH
+#define HAS_NDJSON_BATCH (256 * 1024)
+#endif
+
+typedef struct {
+    has_t  **records;
+    size_t   count;
+    size_t   size;
+    bool     failed;
+    bool     done;
+} has_ndjson_batch_t;
+
+typedef struct {
+    const char         *buffer;
+    size_t              length;
+    bool                decode;
+    size_t              batches;
+    has_ndjson_batch_t *window;
+    size_t              width;     /* Of the window */
+    size_t              next;      /* Next batch to parse */
+    size_t              delivered; /* Batches delivered */
+    bool                stop;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+} has_ndjson_t;
+
+/* Per thread state, reused for all records */
+typedef struct {
+    has_ndjson_t       *n;
+    has_json_lexer_t    lexer;
+    has_json_builder_t  builder;
+} has_ndjson_worker_t;
+
+/* First position of the batch, after a newline */
+static size_t has_ndjson_boundary(has_ndjson_t *n, size_t batch)
+{
+    size_t p = batch * HAS_NDJSON_BATCH;
+    const char *e;
+
+    if(batch == 0) {
+        return 0;
+    }
+    if(p >= n->length) {
+        return n->length;
+    }
+    e = memchr(n->buffer + p - 1, '\n', n->length - p + 1);
+    return e ? (size_t)(e - n->buffer) + 1 : n->length;
+}
+
+/* Parses the lines of a batch, a NULL record for each invalid line */
+static void has_ndjson_batch(has_ndjson_worker_t *w, size_t batch,
+                             has_ndjson_batch_t *b)
+{
+    has_ndjson_t *n = w->n;
+    size_t p = has_ndjson_boundary(n, batch), end = has_ndjson_boundary(n, batch + 1);
+
+    while(p < end) {
+        const char *line = n->buffer + p, *e;
+        size_t l = ((e = memchr(line, '\n', end - p)) != NULL) ?
+            (size_t)(e - line) : end - p;
+        size_t i;
+        has_t *r = NULL;
+
+        p += l + 1;
+        for(i = 0; i < l && (line[i] == ' ' || line[i] == '\r' ||
+                             line[i] == '\t'); i++) {
+            /* Nothing */
+        }
+        if(i == l) {
+            continue; /* Blank line */
+        }
+
+        has_json_lexer_init(&w->lexer, line, l);
+        if(has_json_feed(&w->lexer, &w->builder) == 0 &&
+           w->builder.expect == has_json_expect_end) {
+            r = w->builder.root;
+            w->builder.root = NULL;
+        }
+        has_json_builder_reset(&w->builder);
+
+        if(b->count == b->size) {
+            size_t size = b->size ? 2 * b->size : 64;
+            has_t **t = has_mem_realloc(b->records, size * sizeof(has_t *));
+            if(t == NULL) {
+                has_free(r);
+                b->failed = true;
+                return;
+            }
+            b->records = t;
+            b->size = size;
+        }
+        b->records[b->count++] = r;
+    }
+}
+
+static void *has_ndjson_work(void *p)
+{
+    has_ndjson_worker_t *w = p;
+    has_ndjson_t *n = w->n;
+    size_t batch;
+
+    pthread_mutex_lock(&n->lock);
+    while(!n->stop && n->next < n->batches) {
+        if(n->next >= n->delivered + n->width) {
+            pthread_cond_wait(&n->cond, &n->lock);
+            continue;
+        }
+        batch = n->next++;
+        pthread_mutex_unlock(&n->lock);
+        has_ndjson_batch(w, batch, &n->window[batch % n->width]);
+        pthread_mutex_lock(&n->lock);
+        n->window[batch % n->width].done = true;
+        pthread_cond_broadcast(&n->cond);
+    }
+    pthread_mutex_unlock(&n->lock);
+    return NULL;
+}
+
+static void has_ndjson_batch_free(has_ndjson_batch_t *b, size_t from)
+{
+    size_t i;
+
+    for(i = from; i < b->count; i++) {
+        has_free(b->records[i]);
+    }
+    b->count = 0;
+    b->failed = false;
+    b->done = false;
+}
+
+int has_ndjson_parse(const char *buffer, size_t length, int flags, int threads,
+                     has_ndjson_function_t f, void *pointer)
+{
+    has_ndjson_worker_t *workers = NULL;
+    pthread_t *ids = NULL;
+    has_ndjson_t n;
+    size_t d, i, index = 0;
+    int r = 0, started = 0, t;
+
+    if((buffer == NULL && length > 0) || f == NULL) {
+        return -1;
+    }
+    memset(&n, 0, sizeof(n));
+    n.buffer = buffer;
+    n.length = length;
+    n.decode = (flags & HAS_JSON_PARSE_DECODE) ? true : false;
+    n.batches = (length + HAS_NDJSON_BATCH - 1) / HAS_NDJSON_BATCH;
+    if(threads <= 0) {
+        long c = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (c > 0) ? (int)c : 1;
+    }
+    if((size_t)threads > n.batches) {
+        threads = n.batches ? n.batches : 1;
+    }
+    n.width = 2 * threads;
+
+    if((n.window = has_mem_calloc(n.width, sizeof(has_ndjson_batch_t))) == NULL ||
+       (workers = has_mem_calloc(threads, sizeof(has_ndjson_worker_t))) == NULL ||
+       (ids = has_mem_calloc(threads, sizeof(pthread_t))) == NULL) {
+        has_mem_free(n.window);
+        has_mem_free(workers);
+        return -1;
+    }
+    for(t = 0; t < threads; t++) {
+        workers[t].n = &n;
+        has_json_builder_init(&workers[t].builder, n.decode, false);
+        has_json_builder_options(&workers[t].builder, flags);
+    }
+    pthread_mutex_init(&n.lock, NULL);
+    pthread_cond_init(&n.cond, NULL);
+    if(threads > 1) {
+        for(t = 0; t < threads; t++) {
+            if(pthread_create(&ids[t], NULL, has_ndjson_work, &workers[t]) == 0) {
+                started++;
+            } else {
+                break;
+            }
+        }
+    }
+
+    for(d = 0; d < n.batches; d++) {
+        has_ndjson_batch_t *b = &n.window[d % n.width];
+
+        if(started == 0) {
+            has_ndjson_batch(&workers[0], d, b);
+        } else {
+            pthread_mutex_lock(&n.lock);
+            while(!b->done) {
+                pthread_cond_wait(&n.cond, &n.lock);
+            }
+            pthread_mutex_unlock(&n.lock);
+        }
+
+        /* Records belong to the callback */
+        for(i = 0; i < b->count && r == 0; i++) {
+            r = f(index++, b->records[i], pointer);
+        }
+        if(r == 0 && b->failed) {
+            r = -1;
+        }
+        has_ndjson_batch_free(b, i);
+
+        pthread_mutex_lock(&n.lock);
+        n.delivered++;
+        n.stop = (r != 0);
+        pthread_cond_broadcast(&n.cond);
+        pthread_mutex_unlock(&n.lock);
+        if(r != 0) {
+            break;
+        }
+    }
+
+    for(t = 0; t < started; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    for(d = 0; d < n.width; d++) {
+        has_ndjson_batch_free(&n.window[d], 0);
+        has_mem_free(n.window[d].records);
+    }
+    for(t = 0; t < threads; t++) {
+        has_json_builder_clear(&workers[t].builder);
+    }
+    pthread_cond_destroy(&n.cond);
+    pthread_mutex_destroy(&n.lock);
+    has_mem_free(n.window);
+    has_mem_free(workers);
+    has_mem_free(ids);
+    return (r < 0) ? -1 : 0;
+}
+
+/* Appends records to an array, stops on an invalid line */
+static int has_ndjson_append(size_t index, has_t *record, void *pointer)
+{
+    has_t *array = pointer;
+
+    if(record == NULL) {
+        return -1;
+    }
+    if(has_array_push(array, record) == NULL) {
+        has_free(record);
+        return -1;
+    }
+    return 0;
+}
+
+has_t *has_ndjson_parse_array(const char *buffer, size_t length, int flags,
+                              int threads)
+{
+    has_t *r;
+
+    if((r = has_array_new(0)) != NULL &&
+       has_ndjson_parse(buffer, length, flags, threads,
+                        has_ndjson_append, r) < 0) {
+        has_free(r);
+        r = NULL;
+    }
+    return r;
+}
+
+typedef struct {
+    has_json_outputter outputter;
+    void *pointer;
+    int flags;
+    int indent;
+} has_json_serializer_t;
+
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t current;
+    bool owner;
+} has_json_serializer_buffer_t;
+
+static int has_json_serializer_buffer_outputter(void *pointer,
+                                                const char *value, size_t size)
+{
+    has_json_serializer_buffer_t *b = pointer;
+
+    if(b == NULL) {
+        return -1;
+    }
+
+    if(size > (b->size - b->current)) {
+        char *t;
+        size_t s = b->size * 2;
+        while((s - b->current) < size) s = s * 2;
+        if(!b->owner || (t = has_mem_realloc(b->buffer, s)) == NULL) {
+            return -1;
+        }
+        b->buffer = t;
+        b->size = s;
+    }
+
+    memcpy(b->buffer + b->current, value, size);
+    b->current += size;
+    return 0;
+}
+
+/* Escape scanning. Strings are copied in runs up to the next byte that
+   may need escaping: quote, backslash, control character or byte above
+   0x7F. The scalar version checks 8 bytes at once. */
+#define HAS_JSON_ONES  UINT64_C(0x0101010101010101)
+#define HAS_JSON_HIGHS UINT64_C(0x8080808080808080)
+
+static size_t has_json_escape_scan_scalar(const char *input, size_t length)
+{
+    const unsigned char *s = (const unsigned char *)input;
+    size_t i = 0;
+    uint64_t w, q, b;
+
+    /* Zero byte detection, may flag bytes after a real match */
+    for(; i + 8 <= length; i += 8) {
+        memcpy(&w, s + i, sizeof(w));
+        q = w ^ (HAS_JSON_ONES * '"');
+        b = w ^ (HAS_JSON_ONES * '\\');
+        if((w | ((w - HAS_JSON_ONES * 0x20) & ~w) |
+            ((q - HAS_JSON_ONES) & ~q) | ((b - HAS_JSON_ONES) & ~b)) &
+           HAS_JSON_HIGHS) {
+            break;
+        }
+    }
+    for(; i < length; i++) {
+        if(s[i] < 0x20 || s[i] > 0x7F || s[i] == '"' || s[i] == '\\') {
+            break;
+        }
+    }
+    return i;
+}
+
+#ifdef HAS_JSON_X86
+__attribute__((target("sse4.2")))
+static size_t has_json_escape_scan_sse42(const char *input, size_t length)
+{
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    size_t i;
+
+    for(i = 0; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(input + i));
+        __m128i e = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                              _mm_cmpeq_epi8(v, backslash)),
+                                 _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+        /* High bits of v are the bytes above 0x7F */
+        int mask = _mm_movemask_epi8(_mm_or_si128(e, v));
+        if(mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + has_json_escape_scan_scalar(input + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t has_json_escape_scan_avx2(const char *input, size_t length)
+{
+    const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    size_t i;
+
+    for(i = 0; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(input + i));
+        __m256i e = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                                    _mm256_cmpeq_epi8(v, backslash)),
+                                    _mm256_cmpeq_epi8(_mm256_max_epu8(v, control),
+                                                      control));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(e, v));
+        if(mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + has_json_escape_scan_scalar(input + i, length - i);
+}
+#endif
+
+typedef size_t (*has_json_escape_scanner_t)(const char *input, size_t length);
+
+static has_json_escape_scanner_t has_json_escape_scanner = has_json_escape_scan_scalar;
+static pthread_once_t has_json_escape_once = PTHREAD_ONCE_INIT;
+
+static void has_json_escape_select(void)
+{
+#ifdef HAS_JSON_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        has_json_escape_scanner = has_json_escape_scan_avx2;
+    } else if(__builtin_cpu_supports("sse4.2")) {
+        has_json_escape_scanner = has_json_escape_scan_sse42;
+    }
+#endif
+}
+
+/* Returns the number of leading bytes that never need escaping */
+static size_t has_json_escape_scan(const char *input, size_t length)
+{
+    pthread_once(&has_json_escape_once, has_json_escape_select);
+    return has_json_escape_scanner(input, length);
+}
+
+int has_json_string_encode(has_json_serializer_t *s,
+                           const char *input, size_t length)
+{
+    size_t start = 0, stop = 0;
+
+    while(stop < length) {
+        unsigned char c;
+        char buffer[6] = { '\\', 'u', '0', '0', 0, 0 }, unicode[12];
+        char *add = NULL;
+        int l = 2, m = 1;
+
+        /* Safe bytes are added to the current run */
+        if((stop += has_json_escape_scan(input + stop, length - stop)) >= length) {
+            break;
+        }
+        c = input[stop];
+        if(c == '"') {
+            add = "\\\"";
+        } else if(c == '\\') {
+            add = "\\\\";
+        } else if(s->flags & HAS_JSON_SERIALIZE_ENCODE) {
+            if(c == '\b') add = "\\b";
+            else if(c == '\f') add = "\\f";
+            else if(c == '\n') add = "\\n";
+            else if(c == '\r') add = "\\r";
+            else if(c == '\t') add = "\\t";
+            else if(c < 32) {
+                buffer[4] = hexchar[c >> 4];
+                buffer[5] = hexchar[c & 0x0F];
+                add = buffer;
+                l = 6;
+            } else if(c > 0x80) {
+                int32_t codepoint = 0;
+                if(((m = decode_utf8(input + stop, length - stop, &codepoint)) < 0) ||
+                   ((l = has_json_encode_unicode(codepoint, unicode)) < 0)) {
+                    return -1;
+                }
+                add = unicode;
+            }
+        }
+        if(add) {
+            if((stop - start) > 0) {
+                if((s->outputter(s->pointer, input + start, stop - start)) < 0) {
+                    return -1;
+                }
+            }
+            if((s->outputter(s->pointer, add, l)) < 0) {
+                return -1;
+            }
+            start = stop + m;
+        }
+        stop += m;
+    }
+
+    if((start < stop) &&
+       ((s->outputter(s->pointer, input + start, stop - start)) < 0)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int has_json_serialize_string(has_json_serializer_t *s,
+                              const char *value, size_t size)
+{
+    if(s == NULL || s->outputter == NULL) {
+        return -1;
+    }
+
+    if(s->flags & HAS_JSON_SERIALIZE_ENCODE) {
+        return (((s->outputter)(s->pointer, "\"", 1) == 0) &&
+                (has_json_string_encode(s, value, size) == 0) &&
+                ((s->outputter)(s->pointer, "\"", 1) == 0)) ? 0 : -1;
+    } else {
+        return (((s->outputter)(s->pointer, "\"", 1) == 0) &&
+                ((s->outputter)(s->pointer, value, size) == 0) &&
+                ((s->outputter)(s->pointer, "\"", 1) == 0)) ? 0 : -1;
+    }
+}
+
+
+/* Decimal digit pairs, integers are formatted two digits at a time */
+static const char has_json_digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233"
+    "34353637383940414243444546474849505152535455565758596061626364656667"
+    "6869707172737475767778798081828384858687888990919293949596979899";
+
+/* Writes the decimal digits of v, returns their number */
+static int has_json_format_uint64(char *buffer, uint64_t v)
+{
+    char tmp[20], *p = tmp + sizeof(tmp);
+    int l;
+
+    while(v >= 100) {
+        unsigned int i = (unsigned int)(v % 100) * 2;
+        v /= 100;
+        *--p = has_json_digits[i + 1];
+        *--p = has_json_digits[i];
+    }
+    if(v >= 10) {
+        *--p = has_json_digits[v * 2 + 1];
+        *--p = has_json_digits[v * 2];
+    } else {
+        *--p = (char)('0' + v);
+    }
+    l = (int)(tmp + sizeof(tmp) - p);
+    memcpy(buffer, p, l);
+    return l;
+}
+
+static int has_json_format_int64(char *buffer, int64_t v)
+{
+    if(v < 0) {
+        *buffer = '-';
+        return has_json_format_uint64(buffer + 1, -(uint64_t)v) + 1;
+    }
+    return has_json_format_uint64(buffer, (uint64_t)v);
+}
+
+/*
+ * Shortest round-trip formatting of doubles with Grisu2 (Florian Loitsch,
+ * "Printing Floating-Point Numbers Quickly and Accurately with Integers").
+ * The output always parses back to the same double and is the shortest
+ * such representation in all but very rare cases.
+ */
+typedef struct {
+    uint64_t f;
+    int e;
+} has_json_diyfp_t;
+
+static has_json_diyfp_t has_json_diyfp(uint64_t f, int e)
+{
+    has_json_diyfp_t r;
+    r.f = f;
+    r.e = e;
+    return r;
+}
+
+/* Upper 64 bits of the 128-bit product, rounded */
+static has_json_diyfp_t has_json_diyfp_mul(has_json_diyfp_t x,
+                                           has_json_diyfp_t y)
+{
+    uint64_t u_lo = x.f & 0xFFFFFFFF, u_hi = x.f >> 32;
+    uint64_t v_lo = y.f & 0xFFFFFFFF, v_hi = y.f >> 32;
+    uint64_t p0 = u_lo * v_lo, p1 = u_lo * v_hi;
+    uint64_t p2 = u_hi * v_lo, p3 = u_hi * v_hi;
+    uint64_t q = (p0 >> 32) + (p1 & 0xFFFFFFFF) + (p2 & 0xFFFFFFFF);
+
+    q += (uint64_t)1 << 31;
+    return has_json_diyfp(p3 + (p2 >> 32) + (p1 >> 32) + (q >> 32),
+                          x.e + y.e + 64);
+}
+
+static has_json_diyfp_t has_json_diyfp_normalize(has_json_diyfp_t x)
+{
+    while((x.f >> 63) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/* Normalized powers of ten 10^k for k = -300, -292, ..., 324 */
+static const struct {
+    uint64_t f;
+    int e;
+    int k;
+} has_json_cached_powers[] = {
+    { UINT64_C(0xAB70FE17C79AC6CA), -1060, -300 },
+    { UINT64_C(0xFF77B1FCBEBCDC4F), -1034, -292 },
+    { UINT64_C(0xBE5691EF416BD60C), -1007, -284 },
+    { UINT64_C(0x8DD01FAD907FFC3C),  -980, -276 },
+    { UINT64_C(0xD3515C2831559A83),  -954, -268 },
+    { UINT64_C(0x9D71AC8FADA6C9B5),  -927, -260 },
+    { UINT64_C(0xEA9C227723EE8BCB),  -901, -252 },
+    { UINT64_C(0xAECC49914078536D),  -874, -244 },
+    { UINT64_C(0x823C12795DB6CE57),  -847, -236 },
+    { UINT64_C(0xC21094364DFB5637),  -821, -228 },
+    { UINT64_C(0x9096EA6F3848984F),  -794, -220 },
+    { UINT64_C(0xD77485CB25823AC7),  -768, -212 },
+    { UINT64_C(0xA086CFCD97BF97F4),  -741, -204 },
+    { UINT64_C(0xEF340A98172AACE5),  -715, -196 },
+    { UINT64_C(0xB23867FB2A35B28E),  -688, -188 },
+    { UINT64_C(0x84C8D4DFD2C63F3B),  -661, -180 },
+    { UINT64_C(0xC5DD44271AD3CDBA),  -635, -172 },
+    { UINT64_C(0x936B9FCEBB25C996),  -608, -164 },
+    { UINT64_C(0xDBAC6C247D62A584),  -582, -156 },
+    { UINT64_C(0xA3AB66580D5FDAF6),  -555, -148 },
+    { UINT64_C(0xF3E2F893DEC3F126),  -529, -140 },
+    { UINT64_C(0xB5B5ADA8AAFF80B8),  -502, -132 },
+    { UINT64_C(0x87625F056C7C4A8B),  -475, -124 },
+    { UINT64_C(0xC9BCFF6034C13053),  -449, -116 },
+    { UINT64_C(0x964E858C91BA2655),  -422, -108 },
+    { UINT64_C(0xDFF9772470297EBD),  -396, -100 },
+    { UINT64_C(0xA6DFBD9FB8E5B88F),  -369,  -92 },
+    { UINT64_C(0xF8A95FCF88747D94),  -343,  -84 },
+    { UINT64_C(0xB94470938FA89BCF),  -316,  -76 },
+    { UINT64_C(0x8A08F0F8BF0F156B),  -289,  -68 },
+    { UINT64_C(0xCDB02555653131B6),  -263,  -60 },
+    { UINT64_C(0x993FE2C6D07B7FAC),  -236,  -52 },
+    { UINT64_C(0xE45C10C42A2B3B06),  -210,  -44 },
+    { UINT64_C(0xAA242499697392D3),  -183,  -36 },
+    { UINT64_C(0xFD87B5F28300CA0E),  -157,  -28 },
+    { UINT64_C(0xBCE5086492111AEB),  -130,  -20 },
+    { UINT64_C(0x8CBCCC096F5088CC),  -103,  -12 },
+    { UINT64_C(0xD1B71758E219652C),   -77,   -4 },
+    { UINT64_C(0x9C40000000000000),   -50,    4 },
+    { UINT64_C(0xE8D4A51000000000),   -24,   12 },
+    { UINT64_C(0xAD78EBC5AC620000),     3,   20 },
+    { UINT64_C(0x813F3978F8940984),    30,   28 },
+    { UINT64_C(0xC097CE7BC90715B3),    56,   36 },
+    { UINT64_C(0x8F7E32CE7BEA5C70),    83,   44 },
+    { UINT64_C(0xD5D238A4ABE98068),   109,   52 },
+    { UINT64_C(0x9F4F2726179A2245),   136,   60 },
+    { UINT64_C(0xED63A231D4C4FB27),   162,   68 },
+    { UINT64_C(0xB0DE65388CC8ADA8),   189,   76 },
+    { UINT64_C(0x83C7088E1AAB65DB),   216,   84 },
+    { UINT64_C(0xC45D1DF942711D9A),   242,   92 },
+    { UINT64_C(0x924D692CA61BE758),   269,  100 },
+    { UINT64_C(0xDA01EE641A708DEA),   295,  108 },
+    { UINT64_C(0xA26DA3999AEF774A),   322,  116 },
+    { UINT64_C(0xF209787BB47D6B85),   348,  124 },
+    { UINT64_C(0xB454E4A179DD1877),   375,  132 },
+    { UINT64_C(0x865B86925B9BC5C2),   402,  140 },
+    { UINT64_C(0xC83553C5C8965D3D),   428,  148 },
+    { UINT64_C(0x952AB45CFA97A0B3),   455,  156 },
+    { UINT64_C(0xDE469FBD99A05FE3),   481,  164 },
+    { UINT64_C(0xA59BC234DB398C25),   508,  172 },
+    { UINT64_C(0xF6C69A72A3989F5C),   534,  180 },
+    { UINT64_C(0xB7DCBF5354E9BECE),   561,  188 },
+    { UINT64_C(0x88FCF317F22241E2),   588,  196 },
+    { UINT64_C(0xCC20CE9BD35C78A5),   614,  204 },
+    { UINT64_C(0x98165AF37B2153DF),   641,  212 },
+    { UINT64_C(0xE2A0B5DC971F303A),   667,  220 },
+    { UINT64_C(0xA8D9D1535CE3B396),   694,  228 },
+    { UINT64_C(0xFB9B7CD9A4A7443C),   720,  236 },
+    { UINT64_C(0xBB764C4CA7A44410),   747,  244 },
+    { UINT64_C(0x8BAB8EEFB6409C1A),   774,  252 },
+    { UINT64_C(0xD01FEF10A657842C),   800,  260 },
+    { UINT64_C(0x9B10A4E5E9913129),   827,  268 },
+    { UINT64_C(0xE7109BFBA19C0C9D),   853,  276 },
+    { UINT64_C(0xAC2820D9623BF429),   880,  284 },
+    { UINT64_C(0x80444B5E7AA7CF85),   907,  292 },
+    { UINT64_C(0xBF21E44003ACDD2D),   933,  300 },
+    { UINT64_C(0x8E679C2F5E44FF8F),   960,  308 },
+    { UINT64_C(0xD433179D9C8CB841),   986,  316 },
+    { UINT64_C(0x9E19DB92B4E31BA9),  1013,  324 },
+};
+
+/* Target range of the binary exponent of scaled values */
+#define HAS_JSON_GRISU_ALPHA (-60)
+
+static void has_json_grisu2_round(char *buffer, int length, uint64_t dist,
+                                  uint64_t delta, uint64_t rest,
+                                  uint64_t ten_k)
+{
+    /* Moves the last digit down while it gets closer to the value */
+    while((rest < dist) && (delta - rest >= ten_k) &&
+          ((rest + ten_k < dist) || (dist - rest > rest + ten_k - dist))) {
+        buffer[length - 1]--;
+        rest += ten_k;
+    }
+}
+
+/* Generates the digits of a value between m_minus and m_plus */
+static int has_json_grisu2_digits(char *buffer, int *exponent,
+                                  has_json_diyfp_t m_minus,
+                                  has_json_diyfp_t w,
+                                  has_json_diyfp_t m_plus)
+{
+    uint64_t delta = m_plus.f - m_minus.f, dist = m_plus.f - w.f;
+    int shift = -m_plus.e, length = 0, n, m = 0;
+    uint64_t one = (uint64_t)1 << shift;
+    uint32_t p1 = (uint32_t)(m_plus.f >> shift), pow10;
+    uint64_t p2 = m_plus.f & (one - 1);
+
+    for(n = 10, pow10 = 1000000000; n > 1 && p1 < pow10; n--) {
+        pow10 /= 10;
+    }
+
+    /* Integral part */
+    while(n > 0) {
+        uint64_t rest;
+        buffer[length++] = (char)('0' + p1 / pow10);
+        p1 %= pow10;
+        n--;
+        rest = ((uint64_t)p1 << shift) + p2;
+        if(rest <= delta) {
+            *exponent += n;
+            has_json_grisu2_round(buffer, length, dist, delta, rest,
+                                  (uint64_t)pow10 << shift);
+            return length;
+        }
+        pow10 /= 10;
+    }
+
+    /* Fractional part */
+    do {
+        p2 *= 10;
+        buffer[length++] = (char)('0' + (p2 >> shift));
+        p2 &= one - 1;
+        m++;
+        delta *= 10;
+        dist *= 10;
+    } while(p2 > delta);
+
+    *exponent -= m;
+    has_json_grisu2_round(buffer, length, dist, delta, p2, one);
+    return length;
+}
+
+/* Shortest digits of a positive finite value: value = digits * 10^exponent */
+static int has_json_grisu2(char *buffer, int *exponent, double value)
+{
+    uint64_t bits, f;
+    int e, k, index;
+    has_json_diyfp_t v, m_plus, m_minus, c;
+
+    memcpy(&bits, &value, sizeof(bits));
+    e = (int)(bits >> 52);
+    f = bits & (((uint64_t)1 << 52) - 1);
+    v = (e == 0) ? has_json_diyfp(f, 1 - 1075) :
+        has_json_diyfp(f | ((uint64_t)1 << 52), e - 1075);
+
+    /* Boundaries halfway to the neighbours, the lower one is closer
+       when the significand is a power of two */
+    m_plus = has_json_diyfp_normalize(has_json_diyfp(2 * v.f + 1, v.e - 1));
+    m_minus = (f == 0 && e > 1) ? has_json_diyfp(4 * v.f - 1, v.e - 2) :
+        has_json_diyfp(2 * v.f - 1, v.e - 1);
+    m_minus.f <<= m_minus.e - m_plus.e;
+    m_minus.e = m_plus.e;
+    v = has_json_diyfp_normalize(v);
+
+    /* Cached power scaling the exponent into [alpha, alpha + 28] */
+    k = HAS_JSON_GRISU_ALPHA - m_plus.e - 1;
+    k = (k * 78913) / (1 << 18) + (k > 0);
+    index = (300 + k + 7) / 8;
+    c = has_json_diyfp(has_json_cached_powers[index].f,
+                       has_json_cached_powers[index].e);
+    *exponent = -has_json_cached_powers[index].k;
+
+    v = has_json_diyfp_mul(v, c);
+    m_plus = has_json_diyfp_mul(m_plus, c);
+    m_minus = has_json_diyfp_mul(m_minus, c);
+    m_plus.f--;
+    m_minus.f++;
+
+    return has_json_grisu2_digits(buffer, exponent, m_minus, v, m_plus);
+}
+
+/*
+ * Formats a double, always with a fraction or an exponent so that it is
+ * parsed back as a double. Non-finite values have no JSON representation
+ * and are formatted as null. The buffer must hold at least 32 bytes.
+ */
+static int has_json_format_double(char *buffer, double value)
+{
+    char *p = buffer;
+    int length, exponent, n;
+
+    if(value != value || value - value != 0) {
+        memcpy(buffer, "null", 4);
+        return 4;
+    }
+    if(signbit(value)) {
+        *p++ = '-';
+        value = -value;
+    }
+    if(value == 0) {
+        memcpy(p, "0.0", 3);
+        return (int)(p - buffer) + 3;
+    }
+
+    length = has_json_grisu2(p, &exponent, value);
+    n = length + exponent;
+
+    if(length <= n && n <= 15) {
+        /* 1234e2 -> 123400.0 */
+        memset(p + length, '0', n - length);
+        memcpy(p + n, ".0", 2);
+        p += n + 2;
+    } else if(0 < n && n <= 15) {
+        /* 1234e-2 -> 12.34 */
+        memmove(p + n + 1, p + n, length - n);
+        p[n] = '.';
+        p += length + 1;
+    } else if(-4 < n && n <= 0) {
+        /* 1234e-6 -> 0.001234 */
+        memmove(p + 2 - n, p, length);
+        p[0] = '0';
+        p[1] = '.';
+        memset(p + 2, '0', -n);
+        p += 2 - n + length;
+    } else {
+        /* 1234e30 -> 1.234e33 */
+        if(length > 1) {
+            memmove(p + 2, p + 1, length - 1);
+            p[1] = '.';
+            p += length + 1;
+        } else {
+            p++;
+        }
+        *p++ = 'e';
+        p += has_json_format_int64(p, n - 1);
+    }
+    return (int)(p - buffer);
+}
+
+/* Pretty-printing output, r is set to the result of the outputter */
+#define INDENT(s, r) \
+    if(s->flags & HAS_JSON_SERIALIZE_PRETTY) { \
+        int i; \
+        for(i = 0; (r) == 0 && i < s->indent ; i++) { \
+            (r) = (s->outputter)(s->pointer, "  ", 2); \
+        } \
+    }
+#define PRETTY(s, c, a, r) \
+    if(((r) == 0) && (s->flags & HAS_JSON_SERIALIZE_PRETTY)) { \
+        (r) = (s->outputter)(s->pointer, c, 1); \
+        s->indent += a; \
+    }
+
+int has_json_serializer_walker(has_t *cur, has_walk_t type, int index,
+                               const char *string, size_t size, has_t *element,
+                               void *pointer)
+{
+    has_json_serializer_t *s = pointer;
+    int r = 0;
+    if(s == NULL || s->outputter == NULL) {
+        return -1;
+    }
+
+    if(cur == NULL) {
+        INDENT(s, r);
+        r = (r == 0) ? (s->outputter)(s->pointer, "null", 4) : r;
+    } else if(type == has_walk_hash_begin) {
+        r = (s->outputter)(s->pointer, "{", 1);
+        PRETTY(s, "\n", 1, r);
+    } else if(type == has_walk_hash_key) {
+        if(index > 0) {
             r = (s->outputter)(s->pointer, ",", 1);
-            PRETTY(s, "\n", 0);
+            PRETTY(s, "\n", 0, r);
         }
+        INDENT(s, r);
+        r = ((r == 0) && (has_json_serialize_string(s, string, size) == 0) &&
+             ((s->outputter)(s->pointer, ":", 1) == 0)) ? 0 : -1;
+        PRETTY(s, " ", 0, r);
     } else if(type == has_walk_hash_end) {
-        PRETTY(s, "\n", -1);
-        INDENT(s);
-        r = (s->outputter)(s->pointer, "}", 1);
+        PRETTY(s, "\n", -1, r);
+        INDENT(s, r);
+        r = (r == 0) ? (s->outputter)(s->pointer, "}", 1) : r;
     } else if(type == has_walk_array_begin) {
         r = (s->outputter)(s->pointer, "[", 1);
-        PRETTY(s, "\n", 1);
+        PRETTY(s, "\n", 1, r);
     } else if(type == has_walk_array_entry_begin) {
-        INDENT(s);
-    } else if(type == has_walk_array_entry_end) {
-        if(index < cur->value.array.count - 1) {
+        if(index > 0) {
             r = (s->outputter)(s->pointer, ",", 1);
-            PRETTY(s, "\n", 0);
+            PRETTY(s, "\n", 0, r);
         }
+        INDENT(s, r);
     } else if(type == has_walk_array_end) {
-        PRETTY(s, "\n", -1);
-        INDENT(s);
-        r = (s->outputter)(s->pointer, "]", 1);
+        PRETTY(s, "\n", -1, r);
+        INDENT(s, r);
+        r = (r == 0) ? (s->outputter)(s->pointer, "]", 1) : r;
     } else if(type == has_walk_string) {
         r = has_json_serialize_string(s, string, size);
     } else if(type == has_walk_other) {
         if(cur->type == has_null) {
             r = (s->outputter)(s->pointer, "null", 4);
         } else if(cur->type == has_integer) {
-            char buffer[64];
-            int l = snprintf(buffer, sizeof(buffer) - 1, "%d", cur->value.integer);
-            r = (l > 0) ? (s->outputter)(s->pointer, buffer, l) : -1;
+            char buffer[24];
+            int l = has_json_format_int64(buffer, cur->value.integer);
+            r = (s->outputter)(s->pointer, buffer, l);
+        } else if(cur->type == has_number) {
+            size_t l;
+            const char *text = has_number_get(cur, &l);
+            r = (s->outputter)(s->pointer, text, l);
+        } else if(cur->type == has_int64) {
+            char buffer[24];
+            int l = has_json_format_int64(buffer, cur->value.integer64);
+            r = (s->outputter)(s->pointer, buffer, l);
         } else if(cur->type == has_double) {
-            char buffer[64];
-            int l = snprintf(buffer, sizeof(buffer) - 1, "%f", cur->value.fp);
-            r = (l > 0) ? (s->outputter)(s->pointer, buffer, l) : -1;
+            char buffer[32];
+            int l = has_json_format_double(buffer, cur->value.fp);
+            r = (s->outputter)(s->pointer, buffer, l);
         } else if(cur->type == has_boolean) {
             r = (cur->value.boolean) ? (s->outputter)(s->pointer, "true", 4) :
                 (s->outputter)(s->pointer, "false", 5);
@@ -587,10 +4055,25 @@ int has_json_serializer_walker(has_t *cur, has_walk_t type, int index,
     return r;
 }
 
+int has_json_serialize_to(has_t *input, has_json_outputter outputter,
+                          void *pointer, int flags)
+{
+    has_json_serializer_t s;
+    if(outputter == NULL) {
+        return -1;
+    }
+
+    s.flags = flags;
+    s.indent = 0;
+    s.outputter = outputter;
+    s.pointer = pointer;
+
+    return (has_walk(input, has_json_serializer_walker, &s) == 0) ? 0 : -1;
+}
+
 int has_json_serialize(has_t *input, char **output, size_t *size, int flags)
 {
     has_json_serializer_buffer_t sb;
-    has_json_serializer_t s;
     if(output == NULL) {
         return -1;
     } else if(output && *output) {
@@ -600,8 +4083,9 @@ int has_json_serialize(has_t *input, char **output, size_t *size, int flags)
         } else {
             return -1;
         }
+        sb.owner = 0;
     } else {
-        if((sb.buffer = malloc(4096)) == NULL) {
+        if((sb.buffer = has_mem_alloc(4096)) == NULL) {
             return -1;
         }
         sb.size = 4096;
@@ -609,18 +4093,129 @@ int has_json_serialize(has_t *input, char **output, size_t *size, int flags)
     }
     sb.current = 0;
 
-    s.flags = flags;
-    s.indent = 0;
-    s.outputter = (has_json_outputter)has_json_serializer_buffer_outputter;
-    s.pointer = &sb;
-
-    if((has_walk(input, has_json_serializer_walker, &s) == 0) &&
+    if((has_json_serialize_to(input, has_json_serializer_buffer_outputter,
+                              &sb, flags) == 0) &&
        (has_json_serializer_buffer_outputter(&sb, "\0", 1) == 0)) {
         *output = sb.buffer;
         *size = sb.current - 1;
     } else {
-        free(sb.buffer);
+        if(sb.owner) {
+            has_mem_free(sb.buffer);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/* Size of the staging buffer of file descriptor sinks */
+#define HAS_JSON_FD_BUFFER 65536
+
+typedef struct {
+    int fd;
+    char *buffer;
+    size_t current;
+    bool error;
+} has_json_serializer_fd_t;
+
+/* Writes all vectors, resuming after partial writes and signals */
+static int has_json_writev(int fd, struct iovec *iov, int count)
+{
+    while(count > 0) {
+        ssize_t w = writev(fd, iov, count);
+        if(w < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while((count > 0) && ((size_t)w >= iov->iov_len)) {
+            w -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+static int has_json_serializer_fd_outputter(void *pointer,
+                                            const char *value, size_t size)
+{
+    has_json_serializer_fd_t *f = pointer;
+    struct iovec iov[2];
+    int count = 1;
+
+    if(f == NULL || f->error) {
+        return -1;
+    }
+
+    if(size <= (HAS_JSON_FD_BUFFER - f->current)) {
+        memcpy(f->buffer + f->current, value, size);
+        f->current += size;
+        return 0;
+    }
+
+    /* Pieces at least as large as the staging buffer are not copied */
+    iov[0].iov_base = f->buffer;
+    iov[0].iov_len = f->current;
+    if(size >= HAS_JSON_FD_BUFFER) {
+        iov[1].iov_base = (void *)value;
+        iov[1].iov_len = size;
+        count = 2;
+    }
+    if(has_json_writev(f->fd, iov, count) < 0) {
+        f->error = true;
         return -1;
     }
+
+    f->current = 0;
+    if(count == 1) {
+        memcpy(f->buffer, value, size);
+        f->current = size;
+    }
     return 0;
 }
+
+int has_json_serialize_fd(has_t *input, int fd, int flags)
+{
+    has_json_serializer_fd_t f;
+    struct iovec iov;
+    int r;
+
+    if(fd < 0 || (f.buffer = has_mem_alloc(HAS_JSON_FD_BUFFER)) == NULL) {
+        return -1;
+    }
+    f.fd = fd;
+    f.current = 0;
+    f.error = false;
+
+    r = has_json_serialize_to(input, has_json_serializer_fd_outputter,
+                              &f, flags);
+    if(r == 0 && f.current > 0) {
+        iov.iov_base = f.buffer;
+        iov.iov_len = f.current;
+        r = has_json_writev(fd, &iov, 1);
+    }
+    has_mem_free(f.buffer);
+    return (r == 0) ? 0 : -1;
+}
+
+static int has_json_serializer_file_outputter(void *pointer,
+                                              const char *value, size_t size)
+{
+    return (fwrite(value, 1, size, pointer) == size) ? 0 : -1;
+}
+
+int has_json_serialize_file(has_t *input, FILE *file, int flags)
+{
+    if(file == NULL) {
+        return -1;
+    }
+
+    return ((has_json_serialize_to(input, has_json_serializer_file_outputter,
+                                   file, flags) == 0) &&
+            (fflush(file) == 0) && !ferror(file)) ? 0 : -1;
+}
@@ -9,6 +9,7 @@
 #define	_HAS_JSON_H
 
 #include "has.h"
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -21,10 +22,232 @@ extern "C" {
  * @return A pointer to a has_t structure or @c NULL in case of failure.
  *
  * The input string must be a valid UTF-8 encoded string. The strings
- * in the resulting has_t structure will be decoded (unescape).
+ * in the resulting has_t structure will be decoded (unescape). The
+ * text must contain exactly one value, containers are allocated with
+ * their exact size and there is no limit on size or nesting.
  */
 has_t *has_json_parse(const char *buffer, bool decode);
 
+#define HAS_JSON_PARSE_DECODE   (1 << 0)
+#define HAS_JSON_PARSE_PARALLEL (1 << 1)
+#define HAS_JSON_PARSE_LINES    (1 << 2)
+#define HAS_JSON_PARSE_LAZY     (1 << 3)
+#define HAS_JSON_PARSE_RAW      (1 << 4)
+#define HAS_JSON_PARSE_UTF8     (1 << 5)
+
+/**
+ * @brief Parses JSON-encoded text of known length
+ * @param buffer Text, not necessarily <tt>NULL</tt>-terminated
+ * @param length Length of text
+ * @param flags  #HAS_JSON_PARSE_DECODE to decode strings,
+ * #HAS_JSON_PARSE_PARALLEL to use several threads,
+ * #HAS_JSON_PARSE_LINES to parse newline-delimited JSON into an array of
+ * records with has_ndjson_parse_array(), #HAS_JSON_PARSE_LAZY to build
+ * containers on first access, #HAS_JSON_PARSE_RAW to keep numbers as
+ * text, #HAS_JSON_PARSE_UTF8 to reject strings and keys that are not
+ * valid UTF-8
+ * @return A pointer to a has_t structure or @c NULL in case of failure.
+ *
+ * Strings that are not decoded point into buffer, which must outlive
+ * the result. With #HAS_JSON_PARSE_LAZY the text is validated but only
+ * the extent of each container is recorded: a hash or array is built
+ * (see #HAS_LAZY) when a function first accesses it, its own containers
+ * remaining lazy. The buffer must then outlive the result even when
+ * strings are decoded.
+ *
+ * With #HAS_JSON_PARSE_RAW numbers are validated but not converted:
+ * they are has_number elements pointing into buffer, converted by
+ * has_int_get(), has_int64_get() or has_double_get() and serialized
+ * unchanged. With #HAS_JSON_PARSE_UTF8 strings and keys are checked
+ * with has_json_utf8_valid() once decoded, which also rejects escaped
+ * lone surrogates. Both apply to #HAS_JSON_PARSE_PARALLEL, each
+ * thread checking the members it parses.
+ */
+has_t *has_json_parse_n(const char *buffer, size_t length, int flags);
+
+/**
+ * @brief Parses JSON-encoded text, decoding strings in place
+ * @param buffer Text, not necessarily <tt>NULL</tt>-terminated, which is
+ * modified
+ * @param length Length of text
+ * @param flags  #HAS_JSON_PARSE_RAW to keep numbers as text, other
+ * flags are ignored
+ * @return A pointer to a has_t structure or @c NULL in case of failure.
+ *
+ * Strings are always decoded: escaped strings are rewritten in buffer,
+ * a decoded string being never longer than its text, so that no string
+ * is allocated. All strings point into buffer, which must outlive the
+ * result, and its content is undefined after the call.
+ */
+has_t *has_json_parse_insitu(char *buffer, size_t length, int flags);
+
+/**
+ * @brief Parses only selected parts of JSON-encoded text
+ * @param buffer Text, not necessarily <tt>NULL</tt>-terminated
+ * @param length Length of text
+ * @param paths  <tt>NULL</tt>-terminated array of at most 64 JSON
+ * Pointers (RFC 6901), such as <tt>/user/id</tt> or <tt>/items/0</tt>
+ * @param flags  #HAS_JSON_PARSE_DECODE to decode strings,
+ * #HAS_JSON_PARSE_RAW to keep numbers as text
+ * @return A pointer to a has_t structure or @c NULL if the text or a
+ * path is invalid, in case of failure, or if the root is not a
+ * container and not selected.
+ *
+ * The result only contains the selected values and the containers
+ * leading to them, with their selected members only. Array entries
+ * keep their position, entries before a selected one being null, so
+ * the paths also locate the values in the result. Everything else is
+ * skipped without decoding nor allocation: only its brackets are
+ * counted, so errors inside skipped values may not be detected.
+ */
+has_t *has_json_parse_select(const char *buffer, size_t length,
+                             const char **paths, int flags);
+
+/**
+ * @struct has_json_ctx_t
+ * @brief Parsing state reused from one document to the next
+ */
+typedef struct has_json_ctx_t has_json_ctx_t;
+
+/**
+ * @brief Allocates a parsing context
+ * @return A pointer to the context or @c NULL in case of failure.
+ *
+ * A context is used by one thread at a time.
+ */
+has_json_ctx_t *has_json_ctx_new(void);
+
+/**
+ * @brief Parses JSON-encoded text of known length with a context
+ * @param ctx    Pointer to the context
+ * @param buffer Text, not necessarily <tt>NULL</tt>-terminated
+ * @param length Length of text
+ * @param flags  Parsing options, see has_json_parse_n()
+ * @return A pointer to a has_t structure or @c NULL in case of failure.
+ *
+ * Same as has_json_parse_n(), but the container stacks grown by
+ * previous documents are kept, so that repeated parses only allocate
+ * the elements of the result. #HAS_JSON_PARSE_PARALLEL,
+ * #HAS_JSON_PARSE_LINES and #HAS_JSON_PARSE_LAZY do not use the
+ * context.
+ */
+has_t *has_json_ctx_parse(has_json_ctx_t *ctx, const char *buffer,
+                          size_t length, int flags);
+
+/**
+ * @brief Frees a parsing context
+ * @param ctx Pointer to the context
+ */
+void has_json_ctx_free(has_json_ctx_t *ctx);
+
+/**
+ * @struct has_json_file_t
+ * @brief JSON file mapped in memory with its parsed structure
+ */
+typedef struct has_json_file_t has_json_file_t;
+
+/**
+ * @brief Maps and parses a JSON file
+ * @param path  Path of the file
+ * @param flags Parsing options, see has_json_parse_n()
+ * @return A pointer to the file or @c NULL in case of failure.
+ *
+ * The mapping is kept until has_json_file_close() so that strings of
+ * the structure can point into it without being copied.
+ */
+has_json_file_t *has_json_parse_file(const char *path, int flags);
+
+/**
+ * @brief Retrieves the root element of a parsed file
+ * @param file Pointer to the file
+ * @return Pointer to the root has_t element, valid until
+ * has_json_file_close() is called.
+ */
+has_t *has_json_file_root(has_json_file_t *file);
+
+/**
+ * @brief Frees the structure of a parsed file and unmaps it
+ * @param file Pointer to the file
+ */
+void has_json_file_close(has_json_file_t *file);
+
+/**
+ * @brief Parses JSON-encoded text into events without building a tree
+ * @param buffer  Text, not necessarily <tt>NULL</tt>-terminated
+ * @param length  Length of text
+ * @param flags   #HAS_JSON_PARSE_DECODE to decode strings
+ * @param f       Callback function, as for has_walk()
+ * @param pointer Pointer passed to the callback function
+ * @return 0 if the text was valid and completely parsed, the non-zero
+ * value returned by the callback if aborted, -1 if the text is invalid
+ * or in case of failure.
+ *
+ * The events follow those has_walk() sends for the structure that
+ * has_json_parse() would return (duplicate keys excepted), with the
+ * same effect of #HAS_WALK_SKIP. Containers are passed as @p cur with
+ * their type but no members: their count is that of the members up to
+ * the current one, the total for the end event. The @p element of
+ * member events is @c NULL, and #has_walk_other also receives the text
+ * of the value. Callbacks relying on the count of members ahead, or on
+ * the members themselves, only work with has_walk().
+ *
+ * Elements and strings passed are only valid during the call. Memory
+ * use only depends on nesting.
+ */
+int has_json_walk(const char *buffer, size_t length, int flags,
+                  has_walk_function_t f, void *pointer);
+
+/**
+ * @struct has_json_parser_t
+ * @brief Streaming parser state
+ */
+typedef struct has_json_parser_t has_json_parser_t;
+
+/**
+ * @brief Creates a streaming parser for text received in chunks
+ * @param flags #HAS_JSON_PARSE_DECODE to decode strings
+ * @return A pointer to the parser or @c NULL in case of failure.
+ */
+has_json_parser_t *has_json_parser_new(int flags);
+
+/**
+ * @brief Parses the next chunk of text
+ * @param parser Pointer to the parser
+ * @param chunk  Chunk of text, may be reused after the call
+ * @param length Length of chunk
+ * @return 0 if success, -1 if the text is invalid so far or in case of
+ * failure (the parser must still be finished).
+ *
+ * Chunks may be cut anywhere, even inside a string or an escape.
+ * Strings are copied.
+ */
+int has_json_parser_feed(has_json_parser_t *parser, const char *chunk,
+                         size_t length);
+
+/**
+ * @brief Ends the text and frees the parser
+ * @param parser Pointer to the parser
+ * @return A pointer to a has_t structure or @c NULL if the text is
+ * invalid or incomplete or in case of failure.
+ */
+has_t *has_json_parser_finish(has_json_parser_t *parser);
+
+/**
+ * @brief Parses JSON-encoded text using several threads
+ * @param buffer  Text, not necessarily <tt>NULL</tt>-terminated
+ * @param length  Length of text
+ * @param decode  Decode strings
+ * @param threads Number of threads, 0 for the number of processors
+ * @return A pointer to a has_t structure or @c NULL in case of failure.
+ *
+ * The members of the root array or object are split between threads
+ * and parsed concurrently. Texts too small to benefit from it (less than
+ * 1 MB per thread) or whose root is not a container are parsed by the
+ * calling thread. The result is the same as with has_json_parse().
+ */
+has_t *has_json_parse_parallel(const char *buffer, size_t length, bool decode,
+                               int threads);
+
 /**
  * @brief Serializes a has_t structure into JSON text
  * @param input  has_t structure to serialize
@@ -40,6 +263,110 @@ has_t *has_json_parse(const char *buffer, bool decode);
 
 int has_json_serialize(has_t *input, char **output, size_t *size, int flags);
 
+/**
+ * @typedef has_json_outputter
+ * @brief Sink receiving serialized text
+ * @param [in] pointer Pointer passed to has_json_serialize_to()
+ * @param [in] value   Text, not <tt>NULL</tt>-terminated
+ * @param [in] size    Length of text
+ * @return 0 if success, -1 to stop with an error.
+ */
+typedef int (*has_json_outputter)(void *pointer, const char *value,
+                                  size_t size);
+
+/**
+ * @brief Serializes a has_t structure into a custom sink
+ * @param input     has_t structure to serialize
+ * @param outputter Sink called with consecutive pieces of text
+ * @param pointer   Pointer passed to the sink
+ * @param flags     Serialization options
+ * @return 0 if success, -1 in case of failure.
+ *
+ * The text is produced in small pieces and never fully buffered. No
+ * terminating <tt>NULL</tt> character is output.
+ */
+int has_json_serialize_to(has_t *input, has_json_outputter outputter,
+                          void *pointer, int flags);
+
+/**
+ * @brief Serializes a has_t structure into a file descriptor
+ * @param input  has_t structure to serialize
+ * @param fd     File descriptor open for writing
+ * @param flags  Serialization options
+ * @return 0 if success, -1 in case of failure.
+ *
+ * Pieces of text are gathered in a fixed staging buffer and written
+ * in batches with writev(), large pieces are written without copy.
+ * Partial writes and interrupted calls are resumed.
+ */
+int has_json_serialize_fd(has_t *input, int fd, int flags);
+
+/**
+ * @brief Serializes a has_t structure into a stream
+ * @param input  has_t structure to serialize
+ * @param file   Stream open for writing
+ * @param flags  Serialization options
+ * @return 0 if success, -1 in case of failure.
+ *
+ * The stream is flushed before returning.
+ */
+int has_json_serialize_file(has_t *input, FILE *file, int flags);
+
+/**
+ * @typedef has_ndjson_function_t
+ * @brief Callback receiving the records of newline-delimited JSON
+ * @param [in] index   Index of the record
+ * @param [in] record  Parsed record, @c NULL if the line is invalid. It
+ * belongs to the callback which must free it.
+ * @param [in] pointer Pointer passed to has_ndjson_parse()
+ * @return 0 to continue, a positive value to stop or a negative value
+ * to stop with an error.
+ */
+typedef int (*has_ndjson_function_t)(size_t index, has_t *record,
+                                     void *pointer);
+
+/**
+ * @brief Parses newline-delimited JSON (JSON Lines) using several threads
+ * @param buffer  Text, not necessarily <tt>NULL</tt>-terminated
+ * @param length  Length of text
+ * @param flags   #HAS_JSON_PARSE_DECODE to decode strings
+ * @param threads Number of threads, 0 for the number of processors
+ * @param f       Callback receiving each record
+ * @param pointer Pointer passed to the callback
+ * @return 0 if success, -1 if the callback returned a negative value or
+ * in case of failure.
+ *
+ * Each line holds one record, blank lines are skipped. Batches of lines
+ * are parsed by a pool of threads, the callback is called from the
+ * calling thread in the order of the lines.
+ */
+int has_ndjson_parse(const char *buffer, size_t length, int flags, int threads,
+                     has_ndjson_function_t f, void *pointer);
+
+/**
+ * @brief Parses newline-delimited JSON into an array of records
+ * @param buffer  Text, not necessarily <tt>NULL</tt>-terminated
+ * @param length  Length of text
+ * @param flags   #HAS_JSON_PARSE_DECODE to decode strings
+ * @param threads Number of threads, 0 for the number of processors
+ * @return A pointer to a has_t array or @c NULL if a line is invalid or
+ * in case of failure.
+ */
+has_t *has_ndjson_parse_array(const char *buffer, size_t length, int flags,
+                              int threads);
+
+/**
+ * @brief Tests if a string is valid UTF-8
+ * @param input  String
+ * @param length Length of string
+ * @return @c true if input only contains well-formed UTF-8 sequences
+ * (no overlong forms, surrogates or code points above U+10FFFF).
+ *
+ * Vector instructions (SSE4.2/AVX2) are used when available, blocks of
+ * ASCII being skipped.
+ */
+bool has_json_utf8_valid(const char *input, size_t length);
+
 #ifdef __cplusplus
 };
 #endif
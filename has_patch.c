@@ -0,0 +1,503 @@
+/*
+ * Copyright 2016 Mathias Brossard <mathias@brossard.org>
+ */
+/**
+ * @file has_patch.c
+ */
+
+#include "has_patch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    has_t  *patch;
+    char   *path;    /* JSON pointer of the current location */
+    size_t  size;
+    size_t  length;
+} has_diff_t;
+
+static int has_diff_reserve(has_diff_t *d, size_t l)
+{
+    if(d->length + l > d->size) {
+        char *t;
+        size_t s = d->size ? d->size * 2 : 256;
+        while(s < d->length + l) s = s * 2;
+        if((t = has_mem_realloc(d->path, s)) == NULL) {
+            return -1;
+        }
+        d->path = t;
+        d->size = s;
+    }
+    return 0;
+}
+
+/* Appends a reference token, escaping '~' and '/' */
+static int has_diff_push_key(has_diff_t *d, const char *key, size_t size)
+{
+    size_t i;
+
+    if(has_diff_reserve(d, 2 * size + 1) < 0) {
+        return -1;
+    }
+    d->path[d->length++] = '/';
+    for(i = 0; i < size; i++) {
+        if(key[i] == '~' || key[i] == '/') {
+            d->path[d->length++] = '~';
+            d->path[d->length++] = (key[i] == '~') ? '0' : '1';
+        } else {
+            d->path[d->length++] = key[i];
+        }
+    }
+    return 0;
+}
+
+static int has_diff_push_index(has_diff_t *d, size_t index)
+{
+    char buffer[32];
+    int l = snprintf(buffer, sizeof(buffer), "%lu", (unsigned long)index);
+    return (l > 0) ? has_diff_push_key(d, buffer, l) : -1;
+}
+
+static int has_diff_op(has_diff_t *d, char *op, has_t *value)
+{
+    has_t *o = has_hash_new(3), *t = has_string_new_str(op), *p = NULL;
+    char *path;
+
+    if((path = has_mem_alloc(d->length + 1)) != NULL) {
+        if(d->length) {
+            memcpy(path, d->path, d->length);
+        }
+        path[d->length] = '\0';
+        if((p = has_string_new_o(path, d->length, true)) == NULL) {
+            has_mem_free(path);
+        }
+    }
+
+    /* Elements added to the operation are freed with it */
+    if(o && t && p && has_hash_set_str(o, "op", t)) {
+        t = NULL;
+        if(has_hash_set_str(o, "path", p)) {
+            p = NULL;
+            if(value == NULL || has_hash_set_str(o, "value", value)) {
+                value = NULL;
+                if(has_array_push(d->patch, o)) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    has_free(t);
+    has_free(p);
+    has_free(value);
+    has_free(o);
+    return -1;
+}
+
+/* Value of an add or replace operation: a copy sharing strings */
+static has_t *has_diff_value(has_t *e)
+{
+    return e ? has_copy(e, false) : has_null_new();
+}
+
+/* Identical subtrees: the same element, or equal current memoized
+   digests confirmed by a comparison (digests may collide) */
+static bool has_diff_same(has_t *a, has_t *b)
+{
+    has_digest_t da, db;
+
+    if(a == b) {
+        return true;
+    }
+    return has_digest_memoized(a, &da) && has_digest_memoized(b, &db) &&
+        da.low == db.low && da.high == db.high && has_equal(a, b);
+}
+
+static int has_diff_element(has_diff_t *d, has_t *a, has_t *b);
+
+static int has_diff_hash(has_diff_t *d, has_t *a, has_t *b)
+{
+    size_t i = 0, l, n = d->length;
+    const char *k;
+    has_t *v, *w;
+
+    /* Removed or modified keys */
+    while(has_hash_iterate(a, &i, &k, &l, &v)) {
+        if(has_diff_push_key(d, k, l) < 0) {
+            return -1;
+        }
+        w = has_hash_get(b, k, l);
+        if(w == NULL && !has_hash_exists(b, k, l)) {
+            if(has_diff_op(d, "remove", NULL) < 0) {
+                return -1;
+            }
+        } else if(has_diff_element(d, v, w) < 0) {
+            return -1;
+        }
+        d->length = n;
+    }
+
+    /* Added keys */
+    i = 0;
+    while(has_hash_iterate(b, &i, &k, &l, &w)) {
+        if(has_hash_exists(a, k, l)) {
+            continue;
+        }
+        if(has_diff_push_key(d, k, l) < 0 ||
+           has_diff_op(d, "add", has_diff_value(w)) < 0) {
+            return -1;
+        }
+        d->length = n;
+    }
+    return 0;
+}
+
+static int has_diff_array(has_diff_t *d, has_t *a, has_t *b)
+{
+    size_t la = has_array_count(a), lb = has_array_count(b);
+    size_t p = 0, s = 0, i, m, n = d->length;
+
+    /* Trim common prefix and suffix, so that insertions or deletions
+       do not turn into replacements of the following entries */
+    while(p < la && p < lb && has_equal(has_array_get(a, p), has_array_get(b, p))) {
+        p++;
+    }
+    while(s < la - p && s < lb - p &&
+          has_equal(has_array_get(a, la - s - 1), has_array_get(b, lb - s - 1))) {
+        s++;
+    }
+    la -= p + s;
+    lb -= p + s;
+    m = (la < lb) ? la : lb;
+
+    for(i = 0; i < m; i++) {
+        if(has_diff_push_index(d, p + i) < 0 ||
+           has_diff_element(d, has_array_get(a, p + i), has_array_get(b, p + i)) < 0) {
+            return -1;
+        }
+        d->length = n;
+    }
+    /* Removing at the same position shifts the following entries */
+    for(i = m; i < la; i++) {
+        if(has_diff_push_index(d, p + m) < 0 ||
+           has_diff_op(d, "remove", NULL) < 0) {
+            return -1;
+        }
+        d->length = n;
+    }
+    for(i = m; i < lb; i++) {
+        if(has_diff_push_index(d, p + i) < 0 ||
+           has_diff_op(d, "add", has_diff_value(has_array_get(b, p + i))) < 0) {
+            return -1;
+        }
+        d->length = n;
+    }
+    return 0;
+}
+
+static int has_diff_element(has_diff_t *d, has_t *a, has_t *b)
+{
+    if(has_diff_same(a, b)) {
+        return 0;
+    }
+    if(has_is_hash(a) && has_is_hash(b)) {
+        return has_diff_hash(d, a, b);
+    }
+    if(has_is_array(a) && has_is_array(b)) {
+        return has_diff_array(d, a, b);
+    }
+    if(has_equal(a, b)) {
+        return 0;
+    }
+    return has_diff_op(d, "replace", has_diff_value(b));
+}
+
+has_t *has_diff(has_t *from, has_t *to)
+{
+    has_diff_t d;
+
+    memset(&d, 0, sizeof(d));
+    if((d.patch = has_array_new(8)) == NULL) {
+        return NULL;
+    }
+
+    if(has_diff_element(&d, from, to) < 0) {
+        has_free(d.patch);
+        d.patch = NULL;
+    }
+    has_mem_free(d.path);
+    return d.patch;
+}
+
+/* Decodes the reference token starting at p ('/' excluded), returns
+   its end in the pointer */
+static const char *has_patch_token(const char *p, const char *end,
+                                   char **token, size_t *size)
+{
+    const char *e = memchr(p, '/', end - p);
+    char *t;
+    size_t l = 0;
+
+    if(e == NULL) {
+        e = end;
+    }
+    if((t = has_mem_alloc(e - p + 1)) == NULL) {
+        return NULL;
+    }
+    for(; p < e; p++) {
+        if(*p == '~') {
+            if(p + 1 == e || (p[1] != '0' && p[1] != '1')) {
+                has_mem_free(t);
+                return NULL;
+            }
+            p++;
+            t[l++] = (*p == '0') ? '~' : '/';
+        } else {
+            t[l++] = *p;
+        }
+    }
+    t[l] = '\0';
+    *token = t;
+    *size = l;
+    return e;
+}
+
+/* Array index: digits without leading zero, "-" is one past the end */
+static bool has_patch_index(has_t *array, const char *token, size_t size,
+                            size_t *index)
+{
+    size_t i, r = 0;
+
+    if(size == 1 && token[0] == '-') {
+        *index = has_array_count(array);
+        return true;
+    }
+    if(size == 0 || (size > 1 && token[0] == '0') || size > 18) {
+        return false;
+    }
+    for(i = 0; i < size; i++) {
+        if(token[i] < '0' || token[i] > '9') {
+            return false;
+        }
+        r = r * 10 + (token[i] - '0');
+    }
+    *index = r;
+    return true;
+}
+
+/* Resolves the container holding the location designated by pointer,
+   the last reference token is returned (to be freed) in token. The
+   parent is NULL for the root. */
+static int has_patch_locate(has_t *document, const char *pointer, size_t length,
+                            has_t **parent, char **token, size_t *size)
+{
+    const char *p = pointer, *end = pointer + length;
+    has_t *cur = document;
+
+    *parent = NULL;
+    *token = NULL;
+    *size = 0;
+    if(length == 0) {
+        return 0;
+    }
+    if(*p != '/') {
+        return -1;
+    }
+
+    for(;;) {
+        size_t i;
+        if((p = has_patch_token(p + 1, end, token, size)) == NULL) {
+            return -1;
+        }
+        if(p == end) {
+            *parent = cur;
+            return (has_is_hash(cur) || has_is_array(cur)) ? 0 : -1;
+        }
+        if(has_is_hash(cur)) {
+            cur = has_hash_get(cur, *token, *size);
+        } else if(has_is_array(cur) && has_patch_index(cur, *token, *size, &i)) {
+            cur = has_array_get(cur, i);
+        } else {
+            cur = NULL;
+        }
+        has_mem_free(*token);
+        *token = NULL;
+        if(cur == NULL) {
+            return -1;
+        }
+    }
+}
+
+static has_t *has_patch_get(has_t *document, const char *pointer, size_t length)
+{
+    has_t *parent, *r = NULL;
+    char *token;
+    size_t size, i;
+
+    if(has_patch_locate(document, pointer, length, &parent, &token, &size) < 0) {
+        return NULL;
+    }
+    if(parent == NULL) {
+        r = document;
+    } else if(has_is_hash(parent)) {
+        r = has_hash_get(parent, token, size);
+    } else if(has_patch_index(parent, token, size, &i)) {
+        r = has_array_get(parent, i);
+    }
+    has_mem_free(token);
+    return r;
+}
+
+/* Detaches the element at pointer from the document */
+static int has_patch_remove(has_t **document, const char *pointer,
+                            size_t length, has_t **removed)
+{
+    has_t *parent;
+    char *token;
+    size_t size, i;
+    int r = -1;
+
+    if(has_patch_locate(*document, pointer, length, &parent, &token, &size) < 0) {
+        return -1;
+    }
+    if(parent == NULL) {
+        *removed = *document;
+        *document = NULL;
+        r = 0;
+    } else if(has_is_hash(parent)) {
+        if(has_hash_exists(parent, token, size)) {
+            *removed = has_hash_remove(parent, token, size);
+            r = 0;
+        }
+    } else if(has_patch_index(parent, token, size, &i) &&
+              i < has_array_count(parent)) {
+        *removed = has_array_remove(parent, i);
+        r = 0;
+    }
+    has_mem_free(token);
+    return r;
+}
+
+/* Inserts value at pointer, replace requires an existing location. The
+   value belongs to the document, even on failure. */
+static int has_patch_add(has_t **document, const char *pointer, size_t length,
+                         has_t *value, bool replace)
+{
+    has_t *parent;
+    char *token;
+    size_t size, i;
+    int r = -1;
+
+    if(has_patch_locate(*document, pointer, length, &parent, &token, &size) < 0) {
+        has_free(value);
+        return -1;
+    }
+
+    if(parent == NULL) {
+        has_free(*document);
+        *document = value;
+        return 0;
+    }
+
+    if(has_is_hash(parent)) {
+        if((!replace || has_hash_exists(parent, token, size)) &&
+           has_hash_set_o(parent, token, size, value, true) != NULL) {
+            return 0;
+        }
+    } else if(has_patch_index(parent, token, size, &i)) {
+        if(replace) {
+            has_t *old = has_array_get(parent, i);
+            if(i < has_array_count(parent) &&
+               has_array_set(parent, i, value) != NULL) {
+                has_free(old);
+                r = 0;
+            }
+        } else if(has_array_insert(parent, i, value) != NULL) {
+            r = 0;
+        }
+    }
+
+    has_mem_free(token);
+    if(r < 0) {
+        has_free(value);
+    }
+    return r;
+}
+
+static bool has_patch_is(has_t *string, const char *value)
+{
+    size_t l;
+    const char *s = has_string_get(string, &l);
+    return s && l == strlen(value) && memcmp(s, value, l) == 0;
+}
+
+static has_t *has_patch_value(has_t *operation)
+{
+    has_t *v;
+    if(!has_hash_exists_str(operation, "value")) {
+        return NULL;
+    }
+    v = has_hash_remove_str(operation, "value");
+    return v ? v : has_null_new();
+}
+
+int has_patch_apply(has_t **document, has_t *patch)
+{
+    int i, n = has_array_count(patch);
+
+    if(document == NULL || !has_is_array(patch)) {
+        return -1;
+    }
+
+    for(i = 0; i < n; i++) {
+        has_t *o = has_array_get(patch, i), *op, *v;
+        const char *path, *from = NULL;
+        size_t pl, fl = 0;
+
+        if((op = has_hash_get_str(o, "op")) == NULL ||
+           (path = has_string_get(has_hash_get_str(o, "path"), &pl)) == NULL) {
+            return -1;
+        }
+
+        if(has_patch_is(op, "add") || has_patch_is(op, "replace")) {
+            if((v = has_patch_value(o)) == NULL ||
+               has_patch_add(document, path, pl, v, has_patch_is(op, "replace")) < 0) {
+                return -1;
+            }
+        } else if(has_patch_is(op, "remove")) {
+            if(has_patch_remove(document, path, pl, &v) < 0) {
+                return -1;
+            }
+            has_free(v);
+        } else if(has_patch_is(op, "move") || has_patch_is(op, "copy")) {
+            if((from = has_string_get(has_hash_get_str(o, "from"), &fl)) == NULL) {
+                return -1;
+            }
+            if(has_patch_is(op, "move")) {
+                /* A location can not be moved into one of its children */
+                if(pl > fl && memcmp(path, from, fl) == 0 && path[fl] == '/') {
+                    return -1;
+                }
+                if(has_patch_remove(document, from, fl, &v) < 0) {
+                    return -1;
+                }
+            } else if((v = has_copy(has_patch_get(*document, from, fl), true)) == NULL) {
+                return -1;
+            }
+            if(has_patch_add(document, path, pl, v, false) < 0) {
+                return -1;
+            }
+        } else if(has_patch_is(op, "test")) {
+            if(!has_hash_exists_str(o, "value") ||
+               !has_equal(has_patch_get(*document, path, pl),
+                          has_hash_get_str(o, "value"))) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2016 Mathias Brossard <mathias@brossard.org>
+ */
+/**
+ * @file has_patch.h
+ */
+
+#ifndef _HAS_PATCH_H
+#define	_HAS_PATCH_H
+
+#include "has.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Computes the differences between two has_t structures
+ * @param from Pointer to the original has_t structure
+ * @param to   Pointer to the modified has_t structure
+ * @return A has_t array of JSON Patch (RFC 6902) operations
+ * transforming from into to, or @c NULL in case of failure.
+ *
+ * The operations produced are @c add, @c remove and @c replace. Values
+ * in the patch reference the strings of to, the patch must be freed
+ * (or serialized) before to. Identical subtrees are skipped without
+ * being visited when they are the same element. Subtrees with equal
+ * memoized digests (see has_digest()) are compared with has_equal()
+ * instead of being diffed.
+ */
+has_t *has_diff(has_t *from, has_t *to);
+
+/**
+ * @brief Applies a JSON Patch (RFC 6902) to a has_t structure
+ * @param document Pointer to the has_t structure to modify, updated
+ * if the root element is replaced
+ * @param patch    has_t array of operations
+ * @return 0 if success, -1 in case of failure.
+ *
+ * Supports all operations: @c add, @c remove, @c replace, @c move,
+ * @c copy and @c test. The document is modified in place. Values are
+ * moved out of the patch (their @c value entry is removed) instead of
+ * being copied, the patch must be freed afterwards. Hash keys
+ * are duplicated. Operations are applied in order, if one fails the
+ * preceding ones are not reverted.
+ */
+int has_patch_apply(has_t **document, has_t *patch);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,307 @@
+/*
+ * Copyright 2016 Mathias Brossard <mathias@brossard.org>
+ */
+/**
+ * @file has_path.c
+ */
+
+#include "has_path.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+typedef enum {
+    has_path_key,
+    has_path_index,
+    has_path_wildcard
+} has_path_step_type;
+
+typedef struct {
+    has_path_step_type type;
+    char     *key;
+    size_t    size;
+    uint32_t  hash;
+    long      index;
+} has_path_step_t;
+
+struct has_path_t {
+    has_path_step_t *steps;
+    size_t           count;
+    bool             wildcard;
+};
+
+typedef struct {
+    has_t  **values;
+    size_t   size;
+    size_t   count;
+    bool     all;
+} has_path_result_t;
+
+static has_path_step_t *has_path_add(has_path_t *p, has_path_step_type type)
+{
+    has_path_step_t *t;
+
+    if((t = has_mem_realloc(p->steps, (p->count + 1) * sizeof(has_path_step_t))) == NULL) {
+        return NULL;
+    }
+    p->steps = t;
+    t = &(p->steps[p->count++]);
+    memset(t, 0, sizeof(has_path_step_t));
+    t->type = type;
+    if(type == has_path_wildcard) {
+        p->wildcard = true;
+    }
+    return t;
+}
+
+static int has_path_add_key(has_path_t *p, const char *key, size_t size,
+                            bool quoted)
+{
+    has_path_step_t *t;
+    size_t i, j;
+
+    if((t = has_path_add(p, has_path_key)) == NULL ||
+       (t->key = has_mem_alloc(size + 1)) == NULL) {
+        return -1;
+    }
+
+    for(i = 0, j = 0; i < size; i++) {
+        if(quoted && key[i] == '\\' && (i + 1) < size) {
+            i++;
+        }
+        t->key[j++] = key[i];
+    }
+    t->key[j] = '\0';
+    t->size = j;
+    t->hash = has_hash_function(t->key, j);
+    return 0;
+}
+
+has_path_t *has_path_compile(const char *expression)
+{
+    has_path_t *p;
+    const char *c = expression;
+
+    if(expression == NULL || (p = has_mem_calloc(sizeof(has_path_t), 1)) == NULL) {
+        return NULL;
+    }
+
+    if(*c == '$') {
+        c++;
+    } else if(*c != '.' && *c != '[' && *c != '\0') {
+        /* Implicit leading dot: "a.b" */
+        size_t l = strcspn(c, ".[");
+        if(has_path_add_key(p, c, l, false) < 0) {
+            goto error;
+        }
+        c += l;
+    }
+
+    while(*c) {
+        if(*c == '.') {
+            size_t l;
+            c++;
+            if(*c == '*') {
+                if(has_path_add(p, has_path_wildcard) == NULL) {
+                    goto error;
+                }
+                c++;
+                continue;
+            }
+            if((l = strcspn(c, ".[")) == 0 ||
+               has_path_add_key(p, c, l, false) < 0) {
+                goto error;
+            }
+            c += l;
+        } else if(*c == '[') {
+            c++;
+            if(*c == '*') {
+                if(has_path_add(p, has_path_wildcard) == NULL) {
+                    goto error;
+                }
+                c++;
+            } else if(*c == '\'' || *c == '"') {
+                char q = *c;
+                const char *s = ++c;
+                while(*c && *c != q) {
+                    if(*c == '\\' && c[1]) {
+                        c++;
+                    }
+                    c++;
+                }
+                if(*c != q || has_path_add_key(p, s, c - s, true) < 0) {
+                    goto error;
+                }
+                c++;
+            } else {
+                has_path_step_t *t;
+                char *end;
+                long index = strtol(c, &end, 10);
+                if(end == c || index == LONG_MIN || index == LONG_MAX ||
+                   (t = has_path_add(p, has_path_index)) == NULL) {
+                    goto error;
+                }
+                t->index = index;
+                c = end;
+            }
+            if(*c != ']') {
+                goto error;
+            }
+            c++;
+        } else {
+            goto error;
+        }
+    }
+    return p;
+
+ error:
+    has_path_free(p);
+    return NULL;
+}
+
+void has_path_free(has_path_t *path)
+{
+    size_t i;
+
+    if(path == NULL) {
+        return;
+    }
+    for(i = 0; i < path->count; i++) {
+        has_mem_free(path->steps[i].key);
+    }
+    has_mem_free(path->steps);
+    has_mem_free(path);
+}
+
+bool has_path_is_wildcard(has_path_t *path)
+{
+    return (path && path->wildcard) ? true : false;
+}
+
+static has_t *has_path_step(has_t *e, has_path_step_t *t)
+{
+    if(t->type == has_path_key) {
+        return has_hash_get_hashed(e, t->key, t->size, t->hash);
+    } else {
+        long i = t->index, n = has_array_count(e);
+        if(i < 0) {
+            i += n;
+        }
+        return (i < 0) ? NULL : has_array_get(e, i);
+    }
+}
+
+static int has_path_collect(has_path_result_t *r, has_t *e)
+{
+    if(r->count == r->size) {
+        size_t s = r->size ? r->size * 2 : 16;
+        has_t **t = has_mem_realloc(r->values, (s + 1) * sizeof(has_t *));
+        if(t == NULL) {
+            return -1;
+        }
+        r->values = t;
+        r->size = s;
+    }
+    r->values[r->count++] = e;
+    return 0;
+}
+
+/* Returns -1 on failure, 1 to stop (first match found) and 0 to go on */
+static int has_path_evaluate(has_path_result_t *r, has_path_t *p,
+                             size_t step, has_t *e)
+{
+    for(; e && step < p->count; step++) {
+        has_path_step_t *t = &(p->steps[step]);
+        if(t->type == has_path_wildcard) {
+            has_t *v;
+            int s;
+            if(has_is_hash(e)) {
+                size_t i = 0;
+                while(has_hash_iterate(e, &i, NULL, NULL, &v)) {
+                    if((s = has_path_evaluate(r, p, step + 1, v)) != 0) {
+                        return s;
+                    }
+                }
+            } else if(has_is_array(e)) {
+                int i, n = has_array_count(e);
+                for(i = 0; i < n; i++) {
+                    v = has_array_get(e, i);
+                    if((s = has_path_evaluate(r, p, step + 1, v)) != 0) {
+                        return s;
+                    }
+                }
+            }
+            return 0;
+        }
+        e = has_path_step(e, t);
+    }
+
+    if(e == NULL) {
+        return 0;
+    }
+    if(has_path_collect(r, e) < 0) {
+        return -1;
+    }
+    return r->all ? 0 : 1;
+}
+
+has_t *has_path_get(has_t *root, has_path_t *path)
+{
+    size_t i;
+
+    if(path == NULL) {
+        return NULL;
+    }
+
+    if(!path->wildcard) {
+        /* Straight descent, no allocation */
+        for(i = 0; root && i < path->count; i++) {
+            root = has_path_step(root, &(path->steps[i]));
+        }
+        return root;
+    } else {
+        has_path_result_t r;
+        has_t *e = NULL;
+        memset(&r, 0, sizeof(r));
+        if(has_path_evaluate(&r, path, 0, root) > 0) {
+            e = r.values[0];
+        }
+        has_mem_free(r.values);
+        return e;
+    }
+}
+
+int has_path_get_all(has_t *root, has_path_t *path,
+                     has_t ***values, int *count)
+{
+    has_path_result_t r;
+
+    if(path == NULL || values == NULL) {
+        return -1;
+    }
+
+    memset(&r, 0, sizeof(r));
+    r.all = true;
+    if(has_path_evaluate(&r, path, 0, root) < 0 ||
+       (r.values == NULL &&
+        (r.values = has_mem_calloc(sizeof(has_t *), 1)) == NULL)) {
+        has_mem_free(r.values);
+        return -1;
+    }
+    r.values[r.count] = NULL;
+
+    *values = r.values;
+    if(count) {
+        *count = r.count;
+    }
+    return 0;
+}
+
+has_t *has_path_get_str(has_t *root, const char *expression)
+{
+    has_path_t *path = has_path_compile(expression);
+    has_t *r = has_path_get(root, path);
+    has_path_free(path);
+    return r;
+}
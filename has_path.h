@@ -0,0 +1,95 @@
+/*
+ * Copyright 2016 Mathias Brossard <mathias@brossard.org>
+ */
+/**
+ * @file has_path.h
+ */
+
+#ifndef _HAS_PATH_H
+#define	_HAS_PATH_H
+
+#include "has.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @struct has_path_t
+ * @brief Compiled path expression
+ */
+typedef struct has_path_t has_path_t;
+
+/**
+ * @brief Compiles a path expression
+ * @param expression <tt>NULL</tt>-terminated path expression
+ * @return A pointer to the compiled path or @c NULL if the expression
+ * is invalid or in case of memory allocation failure.
+ *
+ * Expressions are a sequence of steps, optionally preceded by @c $
+ * for the root element:
+ *  - <tt>.name</tt> or <tt>['name']</tt> selects a hash entry (quoted
+ *    keys support <tt>\\'</tt> and <tt>\\\\</tt> escapes),
+ *  - <tt>[3]</tt> selects an array entry, negative indexes count from
+ *    the end,
+ *  - <tt>.*</tt> or <tt>[*]</tt> selects all values of a hash or all
+ *    entries of an array.
+ *
+ * For example <tt>$.delivery.items[*].sku</tt> or <tt>a.b[3].c</tt>.
+ * Key digests are computed at compilation, a compiled path can be
+ * evaluated against any number of has_t structures.
+ */
+has_path_t *has_path_compile(const char *expression);
+
+/**
+ * @brief Frees a compiled path
+ * @param path Pointer to compiled path
+ */
+void has_path_free(has_path_t *path);
+
+/**
+ * @brief Tests if a compiled path contains wildcard steps
+ * @param path Pointer to compiled path
+ * @return @c true if the path can match several elements.
+ */
+bool has_path_is_wildcard(has_path_t *path);
+
+/**
+ * @brief Evaluates a compiled path
+ * @param root Pointer to the has_t structure to search
+ * @param path Pointer to compiled path
+ * @return The first element matching the path or @c NULL if none.
+ */
+has_t *has_path_get(has_t *root, has_path_t *path);
+
+/**
+ * @brief Evaluates a compiled path and retrieves all matches
+ * @param root   Pointer to the has_t structure to search
+ * @param path   Pointer to compiled path
+ * @param values Pointer receiving a <tt>NULL</tt>-terminated C array
+ * of matching elements, to be freed by the caller.
+ * @param count  Pointer receiving the number of matches (can be
+ * @c NULL)
+ * @return 0 if success, -1 in case of failure.
+ *
+ * Elements are retrieved in document order. The array only references
+ * elements of root, which must not be freed while it is used.
+ */
+int has_path_get_all(has_t *root, has_path_t *path,
+                     has_t ***values, int *count);
+
+/**
+ * @brief Compiles and evaluates a path expression once
+ * @param root       Pointer to the has_t structure to search
+ * @param expression <tt>NULL</tt>-terminated path expression
+ * @return The first element matching the path or @c NULL if none.
+ *
+ * Prefer has_path_compile() for expressions evaluated repeatedly.
+ */
+has_t *has_path_get_str(has_t *root, const char *expression);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
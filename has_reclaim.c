@@ -0,0 +1,184 @@
+/*
+ * Copyright 2016 Mathias Brossard <mathias@brossard.org>
+ */
+/**
+ * @file has_reclaim.c
+ */
+
+#include "has_reclaim.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct {
+    has_t  *e;  /* Element being freed */
+    size_t  i;  /* Next entry or element to release */
+} has_reclaim_frame_t;
+
+static struct {
+    pthread_mutex_t      lock;
+    pthread_cond_t       cond;
+    pthread_t            thread;
+    bool                 running;
+    bool                 stopping;
+    /* Stack of elements being freed, deferred trees are pushed on it */
+    has_reclaim_frame_t *frames;
+    size_t               size;
+    size_t               count;
+} reclaimer = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+/* Called with the lock held */
+static int has_reclaim_push(has_t *e)
+{
+    if(reclaimer.count == reclaimer.size) {
+        size_t s = reclaimer.size ? reclaimer.size * 2 : 64;
+        has_reclaim_frame_t *t = has_mem_realloc(reclaimer.frames,
+                                                 s * sizeof(has_reclaim_frame_t));
+        if(t == NULL) {
+            return -1;
+        }
+        reclaimer.frames = t;
+        reclaimer.size = s;
+    }
+    reclaimer.frames[reclaimer.count].e = e;
+    reclaimer.frames[reclaimer.count].i = 0;
+    reclaimer.count++;
+    return 0;
+}
+
+static void has_reclaim_child(has_t *e)
+{
+    if(e && !(e->flags & HAS_FROZEN) && has_reclaim_push(e) < 0) {
+        has_free(e);
+    }
+}
+
+/* Same release order as has_free(), children are pushed on the stack
+   instead of recursing. Once they are released the element itself is
+   passed to has_free(). Called with the lock held. */
+static void has_reclaim_step(size_t budget)
+{
+    while(budget > 0 && reclaimer.count > 0) {
+        has_reclaim_frame_t *fr = &(reclaimer.frames[reclaimer.count - 1]);
+        has_t *e = fr->e;
+        budget--;
+
+        if(e->flags & HAS_LAZY) {
+            /* No children, has_free() releases the source */
+        } else if(e->type == has_hash) {
+            if(fr->i < e->value.hash.size) {
+                has_hash_entry_t *l = &(e->value.hash.entries[fr->i++]);
+                if(l->key.pointer) {
+                    if(l->key.owner) {
+                        has_mem_free(l->key.pointer);
+                    }
+                    has_reclaim_child(l->value);
+                }
+                continue;
+            }
+            e->value.hash.size = 0;   /* Entries were released */
+        } else if(e->type == has_array) {
+            if(fr->i < e->value.array.count) {
+                has_reclaim_child(e->value.array.elements[fr->i++]);
+                continue;
+            }
+            e->value.array.count = 0; /* Elements were released */
+        }
+
+        /* Nothing was pushed, fr is still the top of the stack */
+        reclaimer.count--;
+        has_free(e);
+    }
+}
+
+void has_free_deferred(has_t *e)
+{
+    if(e == NULL || (e->flags & HAS_FROZEN)) {
+        return;
+    }
+
+    pthread_mutex_lock(&reclaimer.lock);
+    if(has_reclaim_push(e) < 0) {
+        pthread_mutex_unlock(&reclaimer.lock);
+        has_free(e);
+        return;
+    }
+    pthread_cond_signal(&reclaimer.cond);
+    pthread_mutex_unlock(&reclaimer.lock);
+}
+
+bool has_reclaim(size_t budget)
+{
+    bool r;
+
+    pthread_mutex_lock(&reclaimer.lock);
+    has_reclaim_step(budget);
+    r = reclaimer.count > 0;
+    pthread_mutex_unlock(&reclaimer.lock);
+    return r;
+}
+
+static void *has_reclaimer_main(void *arg)
+{
+    pthread_mutex_lock(&reclaimer.lock);
+    for(;;) {
+        while(reclaimer.count == 0 && !reclaimer.stopping) {
+            pthread_cond_wait(&reclaimer.cond, &reclaimer.lock);
+        }
+        if(reclaimer.count == 0) {
+            break;
+        }
+        has_reclaim_step(HAS_RECLAIM_CHUNK);
+
+        /* Let other threads queue structures between chunks */
+        pthread_mutex_unlock(&reclaimer.lock);
+        pthread_mutex_lock(&reclaimer.lock);
+    }
+    pthread_mutex_unlock(&reclaimer.lock);
+    return NULL;
+}
+
+int has_reclaimer_start(void)
+{
+    int r = 0;
+
+    pthread_mutex_lock(&reclaimer.lock);
+    if(!reclaimer.running) {
+        if(pthread_create(&reclaimer.thread, NULL,
+                          has_reclaimer_main, NULL) == 0) {
+            reclaimer.running = true;
+        } else {
+            r = -1;
+        }
+    }
+    pthread_mutex_unlock(&reclaimer.lock);
+    return r;
+}
+
+void has_reclaimer_stop(void)
+{
+    bool running;
+
+    pthread_mutex_lock(&reclaimer.lock);
+    running = reclaimer.running;
+    reclaimer.stopping = true;
+    pthread_cond_signal(&reclaimer.cond);
+    pthread_mutex_unlock(&reclaimer.lock);
+
+    if(running) {
+        pthread_join(reclaimer.thread, NULL);
+    }
+
+    pthread_mutex_lock(&reclaimer.lock);
+    while(reclaimer.count > 0) {
+        has_reclaim_step(HAS_RECLAIM_CHUNK);
+    }
+    has_mem_free(reclaimer.frames);
+    reclaimer.frames = NULL;
+    reclaimer.size = 0;
+    reclaimer.running = false;
+    reclaimer.stopping = false;
+    pthread_mutex_unlock(&reclaimer.lock);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2016 Mathias Brossard <mathias@brossard.org>
+ */
+/**
+ * @file has_reclaim.h
+ */
+
+#ifndef _HAS_RECLAIM_H
+#define	_HAS_RECLAIM_H
+
+#include "has.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Number of entries or elements processed by the background
+ * reclaimer each time it acquires the reclaimer lock.
+ */
+#define HAS_RECLAIM_CHUNK 4096
+
+/**
+ * @brief Queues a has_t structure to be freed later
+ * @param e Pointer to has_t structure
+ *
+ * The structure is freed like has_free() would, either by the
+ * background thread (see has_reclaimer_start()) or by calls to
+ * has_reclaim(). It must not be used anymore by the caller. Falls back
+ * to has_free() if the queue can not be extended.
+ */
+void has_free_deferred(has_t *e);
+
+/**
+ * @brief Frees a bounded amount of queued structures
+ * @param budget Maximum number of entries, elements and strings to
+ * process
+ * @return @c true if structures remain queued, @c false otherwise.
+ *
+ * Allows a latency-sensitive thread to free large structures in
+ * chunks of bounded duration, e.g. between requests.
+ */
+bool has_reclaim(size_t budget);
+
+/**
+ * @brief Starts the background reclaimer thread
+ * @return 0 if success (or already started), -1 in case of failure.
+ */
+int has_reclaimer_start(void);
+
+/**
+ * @brief Stops the background reclaimer thread
+ *
+ * Frees all queued structures, waits for the thread to terminate and
+ * releases the memory used by the queue.
+ */
+void has_reclaimer_stop(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -38,7 +38,7 @@ static int time2string(ASN1_TIME *t, char **r, int *l) {
 
     ASN1_TIME_print(buf, t);
     s = BIO_get_mem_data(buf, &b);
-    if((data = calloc(s, 1)) == NULL) {
+    if((data = has_mem_calloc(s, 1)) == NULL) {
         return -1;
     }
     
@@ -57,7 +57,7 @@ char *oid2string(ASN1_OBJECT *oid)
     } else {
         int l = OBJ_obj2txt(NULL, 0, oid, 0);
         char *s;
-        s = malloc(l + 2);
+        s = has_mem_alloc(l + 2);
         OBJ_obj2txt(s, l + 1, oid, 0);
         return s;
     }
@@ -73,7 +73,7 @@ char *asn1string(ASN1_STRING *val)
                          /* ASN1_STRFLGS_ESC_MSB */
                          );
     l = BIO_get_mem_data(buf, &t);
-    str = calloc(l + 1, 1);
+    str = has_mem_calloc(l + 1, 1);
     memcpy(str, t, l);
     BIO_free(buf);
     return str;
@@ -118,14 +118,14 @@ static has_t *pkey_dump(EVP_PKEY *pkey, has_t *crt)
 #endif
 
     l = BIO_get_mem_data(buf, &t);
-    str = calloc(l + 1, 1);
+    str = has_mem_calloc(l + 1, 1);
     memcpy(str, t, l);
     has_hash_set_str(crt, "pubkey-text", has_string_new_str_o(str, 1));
     
     (void)BIO_reset(buf);
     PEM_write_bio_PUBKEY(buf, pkey);
     l = BIO_get_mem_data(buf, &t);
-    str = calloc(l + 1, 1);
+    str = has_mem_calloc(l + 1, 1);
     memcpy(str, t, l);
     has_hash_set_str(crt, "pubkey", has_string_new_str_o(str, 1));
 
@@ -139,11 +139,11 @@ static has_t *pkey_dump(EVP_PKEY *pkey, has_t *crt)
             BN_print(buf, pkey->pkey.rsa->n);
 
             l = BIO_get_mem_data(buf, &t);
-            str = calloc(l + 1, 1);
+            str = has_mem_calloc(l + 1, 1);
             memcpy(str, t, l);
             has_hash_set_str(crt, "pk_modulus_hex", has_string_new_str_o(str, 1));
 
-            str = calloc(l + l/2 + 4, 1);
+            str = has_mem_calloc(l + l/2 + 4, 1);
             strcpy(str, "00");
             for (i=0; i<l; i+=2)
                     sprintf(str + strlen(str), ":%c%c", *(t+i), *(t+i+1));
@@ -166,7 +166,7 @@ char *ext_dump(X509_EXTENSION *ex)
     X509V3_EXT_print(buf, ex, 0, 0);
     l = BIO_get_mem_data(buf, &t);
     while(l > 0 && isspace(t[l - 1])) l--;
-    str = calloc(l + 1, 1);
+    str = has_mem_calloc(l + 1, 1);
     memcpy(str, t, l);
     BIO_free(buf);
     return str;
@@ -207,7 +207,7 @@ char *dn2string(X509_NAME *dn)
                        XN_FLAG_FN_SN |
                        XN_FLAG_DUMP_UNKNOWN_FIELDS );
     l = BIO_get_mem_data(buf, &t);
-    str = calloc(l + 1, 1);
+    str = has_mem_calloc(l + 1, 1);
     memcpy(str, t, l);
     BIO_free(buf);
     return str;
@@ -280,7 +280,7 @@ has_t *has_x509_new(X509 *x509)
     /* Serial number */
     if(r) {
         ASN1_INTEGER *sn = X509_get_serialNumber(x509);
-        char *serial = calloc(2 * sn->length + 1, 1);
+        char *serial = has_mem_calloc(2 * sn->length + 1, 1);
         hexdump(serial, sn->data, sn->length);
         r = has_hash_set_str(crt, "serial", has_string_new_str_o(serial, 1));
     }
@@ -291,7 +291,7 @@ has_t *has_x509_new(X509 *x509)
         char *keyalg;
         EVP_PKEY *pkey = NULL;
         i = OBJ_obj2txt(NULL, 0, ci->key->algor->algorithm, 0);
-        keyalg =  malloc(i + 2);
+        keyalg =  has_mem_alloc(i + 2);
         j = OBJ_obj2txt(keyalg, i + 1, ci->key->algor->algorithm, 0);
         r = has_hash_set_str(crt, "pk_algorithm", has_string_new_str_o(keyalg, 1));
         if((pkey = X509_get_pubkey(x509))) {
@@ -304,7 +304,7 @@ has_t *has_x509_new(X509 *x509)
     if(r) {
         char *sigalg;
         i = OBJ_obj2txt(NULL, 0, ci->signature->algorithm, 0);
-        sigalg =  malloc(i + 2);
+        sigalg =  has_mem_alloc(i + 2);
         j = OBJ_obj2txt(sigalg, i + 1, ci->signature->algorithm, 0);
         r = has_hash_set_str(crt, "sig_algorithm", has_string_new_str_o(sigalg, 1));
     }
@@ -343,10 +343,13 @@ has_t *has_x509_new(X509 *x509)
     }
 
     if (r) {
-        char md[16];
+        char md[16], *s;
 
         snprintf(md, sizeof(md),"%08lx", X509_subject_name_hash(x509));
-        r = has_hash_set_str(crt, "hash_subject", has_string_new_o(strdup(md), strlen(md), 1));
+        if((s = has_mem_alloc(strlen(md) + 1)) != NULL) {
+            strcpy(s, md);
+        }
+        r = has_hash_set_str(crt, "hash_subject", has_string_new_o(s, strlen(md), 1));
     }
 
     return crt;
@@ -371,7 +374,7 @@ has_t *has_pkcs10_new(X509_REQ *pkcs10)
     if(r) {
         char *keyalg;
         i = OBJ_obj2txt(NULL, 0, ri->pubkey->algor->algorithm, 0);
-        keyalg =  malloc(i + 2);
+        keyalg =  has_mem_alloc(i + 2);
         j = OBJ_obj2txt(keyalg, i + 1, ri->pubkey->algor->algorithm, 0);
         r = has_hash_set_str(p10, "pk_algorithm", has_string_new_str_o(keyalg, 1));
         if (r)
@@ -382,7 +385,7 @@ has_t *has_pkcs10_new(X509_REQ *pkcs10)
     if(r) {
         char *sigalg;
         i = OBJ_obj2txt(NULL, 0, pkcs10->sig_alg->algorithm, 0);
-        sigalg =  malloc(i + 2);
+        sigalg =  has_mem_alloc(i + 2);
         j = OBJ_obj2txt(sigalg, i + 1, pkcs10->sig_alg->algorithm, 0);
         r = has_hash_set_str(p10, "sig_algorithm", has_string_new_str_o(sigalg, 1));
     }
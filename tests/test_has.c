@@ -24,8 +24,27 @@ int main(int argc, char **argv)
 #ifndef BENCH
     has_t* vals = has_new(j);
 #endif
+    has_t e;
     double t1, t2;
 
+    /* Four words of value and the type, owner and flags bytes */
+    assert(sizeof(has_t) <= 5 * sizeof(void *));
+
+    /* Initializing does not depend on the previous content */
+    memset(&e, 0xFF, sizeof(e));
+    assert(has_hash_init(&e, 4) == &e && e.flags == 0);
+    assert(has_hash_set_str(&e, "a", has_int_new(1)) != NULL);
+    assert(has_int_get(has_hash_get_str(&e, "a")) == 1);
+    e.owner = false;
+    has_free(&e);
+    memset(&e, 0xFF, sizeof(e));
+    assert(has_array_init(&e, 1) == &e && e.flags == 0);
+    assert(has_array_push(&e, has_int_new(2)) != NULL);
+    e.owner = false;
+    has_free(&e);
+    memset(&e, 0xFF, sizeof(e));
+    assert(has_int_init(&e, 1) == &e && e.flags == 0);
+
     t1 = epoch_double();
     for(i = 0; i < j; i++) {
         sprintf(buffer + i * 8, "%08x", i);
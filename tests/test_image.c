@@ -0,0 +1,104 @@
+/*
+  (c) Mathias Brossard <mathias@brossard.org>
+*/
+
+#include "has.c"
+#include "has_json.c"
+#include "has_image.c"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+int main(int argc, char **argv)
+{
+    char *buffer =
+        "{ \"alpha\": 1, \"bravo\": null,"
+        "\"x-ray\": [0, 1, 2, 3, \"four\"], "
+        "\"delta\": { "
+        "\"echo\": 1.0,"
+        "\"foxtrot\": 3.1415,"
+        "\"golf\":\"éé\""
+        "}, \"hotel\": [], \"india\": {}}";
+    char *path = (argc > 1) ? argv[1] : "test_image.has";
+    has_t *json, *root, *cur;
+    has_image_t *image;
+    char *out1 = NULL, *out2 = NULL, *frozen = NULL;
+    size_t l1, l2, fl;
+    const char *s;
+
+    assert((json = has_json_parse(buffer, false)) != NULL);
+    assert((has_json_serialize(json, &out1, &l1, 0) == 0));
+
+    /* In-memory image */
+    assert(has_freeze(json, &frozen, &fl) == 0);
+    assert((root = has_thaw(frozen, fl)) != NULL);
+    assert(has_thaw(frozen, 16) == NULL);
+    assert((has_json_serialize(root, &out2, &l2, 0) == 0));
+    assert(l1 == l2);
+    assert(memcmp(out1, out2, l1) == 0);
+    free(out2); out2 = NULL;
+
+    /* Mapped image */
+    assert(has_image_save(json, path) == 0);
+    assert((image = has_image_open(path)) != NULL);
+    assert((root = has_image_root(image)) != NULL);
+    assert((has_json_serialize(root, &out2, &l2, 0) == 0));
+    assert(l1 == l2);
+    assert(memcmp(out1, out2, l1) == 0);
+
+    /* Read accessors */
+    assert(has_is_hash(root) && has_hash_count(root) == 6);
+    assert(has_int_get(has_hash_get_str(root, "alpha")) == 1);
+    assert(has_is_null(has_hash_get_str(root, "bravo")));
+    assert(has_hash_exists_str(root, "hotel"));
+    assert(!has_hash_exists_str(root, "juliett"));
+    cur = has_hash_get_str(root, "x-ray");
+    assert(has_array_count(cur) == 5);
+    assert(has_int_get(has_array_get(cur, 3)) == 3);
+    assert((s = has_string_get(has_array_get(cur, 4), &l2)) != NULL);
+    assert(l2 == 4 && memcmp(s, "four", 4) == 0);
+    assert(has_array_get(cur, 5) == NULL);
+    cur = has_hash_get_str(root, "delta");
+    assert(has_double_get(has_hash_get_str(cur, "foxtrot")) == 3.1415);
+    assert(has_hash_count(has_hash_get_str(root, "india")) == 0);
+    assert(has_hash_get_str(has_hash_get_str(root, "india"), "x") == NULL);
+
+    /* Numbers kept as text */
+    assert((cur = has_json_parse_n("[1.50]", 6, HAS_JSON_PARSE_RAW)) != NULL);
+    free(frozen);
+    assert(has_freeze(cur, &frozen, &fl) == 0);
+    has_free(cur);
+    assert((cur = has_array_get(has_thaw(frozen, fl), 0)) != NULL);
+    assert((s = has_number_get(cur, &l2)) != NULL);
+    assert(l2 == 4 && memcmp(s, "1.50", 4) == 0);
+    assert(has_double_get(cur) == 1.5);
+
+    /* Frozen elements are read-only */
+    assert(has_hash_set_str(root, "kilo", NULL) == NULL);
+    assert(has_array_push(has_hash_get_str(root, "hotel"), NULL) == NULL);
+    assert(has_hash_remove_str(root, "alpha") == NULL);
+    has_free(root);
+
+    /* Replacing the file leaves the mapped image intact */
+    assert((cur = has_json_parse("[true]", false)) != NULL);
+    assert(has_image_save(cur, path) == 0);
+    has_free(cur);
+    root = has_image_root(image);
+    assert(has_int_get(has_hash_get_str(root, "alpha")) == 1);
+    assert(has_array_count(has_hash_get_str(root, "x-ray")) == 5);
+    has_image_close(image);
+    assert((image = has_image_open(path)) != NULL);
+    root = has_image_root(image);
+    assert(has_array_count(root) == 1 && has_bool_get(has_array_get(root, 0)));
+
+    /* Cleanup */
+    has_image_close(image);
+    unlink(path);
+    has_free(json);
+    free(frozen);
+    free(out1);
+    free(out2);
+    return 0;
+}
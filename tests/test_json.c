@@ -2,6 +2,10 @@
   (c) Mathias Brossard <mathias@brossard.org>
 */
 
+/* Small chunks so that tests are split between threads */
+#define HAS_JSON_CHUNK_MIN 4096
+#define HAS_NDJSON_BATCH 256
+
 #include "has.c"
 #include "has_json.c"
 
@@ -9,6 +13,1346 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <unistd.h>
+
+/* Counts elements, skipping the value of key "delta" */
+int count_walker(has_t *cur, has_walk_t type, int index,
+                 const char *string, size_t size, has_t *element,
+                 void *pointer)
+{
+    static bool skip = false;
+    int *count = pointer;
+
+    if(type == has_walk_hash_key) {
+        skip = (size == 5 && memcmp(string, "delta", 5) == 0);
+    } else if(type == has_walk_hash_value_begin && skip) {
+        return HAS_WALK_SKIP;
+    } else if(type == has_walk_string || type == has_walk_other ||
+              type == has_walk_hash_begin || type == has_walk_array_begin) {
+        (*count)++;
+    }
+    return 0;
+}
+
+void test_walk(has_t *json)
+{
+    has_walker_t *w;
+    has_t *deep, *cur;
+    int i, count = 0;
+
+    assert(has_walk(json, count_walker, &count) == 0);
+    assert(count == 8);
+
+    /* Nesting deeper than the initial stack */
+    assert((deep = cur = has_array_new(1)) != NULL);
+    for(i = 0; i < 1000; i++) {
+        has_t *n = has_array_new(1);
+        assert(n && has_array_push(cur, n));
+        cur = n;
+    }
+    assert((w = has_walker_new()) != NULL);
+    for(i = 0; i < 2; i++) {
+        count = 0;
+        assert(has_walker_walk(w, deep, count_walker, &count) == 0);
+        assert(count == 1001);
+    }
+    has_walker_free(w);
+    has_free(deep);
+}
+
+/* Records events in a string, skipping values of keys "delta" and the
+   entries of hashes of key "golf" */
+typedef struct {
+    char   trace[4096];
+    size_t length;
+    int    skip;
+    int    abort;
+} trace_t;
+
+int trace_walker(has_t *cur, has_walk_t type, int index,
+                 const char *string, size_t size, has_t *element,
+                 void *pointer)
+{
+    trace_t *t = pointer;
+    int r = 0;
+
+    if(--t->abort == 0) {
+        return 7;
+    }
+    if(type == has_walk_hash_key) {
+        t->skip = (size == 5 && memcmp(string, "delta", 5) == 0) ? 1 :
+            (size == 4 && memcmp(string, "golf", 4) == 0) ? 2 : 0;
+    } else if(type == has_walk_hash_value_begin && t->skip == 1) {
+        r = HAS_WALK_SKIP;
+    } else if(type == has_walk_hash_begin && t->skip == 2) {
+        r = HAS_WALK_SKIP;
+    }
+    t->length += snprintf(t->trace + t->length, sizeof(t->trace) - t->length,
+                          "%d:%d:%d:%d:%.*s ", type, index, cur->type,
+                          (type == has_walk_hash_end) ?
+                          (int)cur->value.hash.count :
+                          (type == has_walk_array_end) ?
+                          (int)cur->value.array.count : -1,
+                          (type == has_walk_other) ? 0 : (int)size,
+                          string ? string : "");
+    assert(t->length < sizeof(t->trace));
+    return r;
+}
+
+void test_events(void)
+{
+    const char *doc =
+        "{\"a\": [1, 2.5, \"s\\u00e9\", null, true, {}, []], "
+        "\"delta\": {\"x\": [1]}, \"golf\": {\"y\": 2}, "
+        "\"hotel\": [[{\"delta\": \"z\"}], false]}";
+    size_t n = strlen(doc);
+    trace_t t1, t2;
+    has_json_serializer_buffer_t sb;
+    has_json_serializer_t s;
+    has_t *json;
+    char *deep, *text = NULL, out[256];
+    size_t length;
+    int i;
+
+    /* Same events as the traversal of the tree */
+    memset(&t1, 0, sizeof(t1));
+    memset(&t2, 0, sizeof(t2));
+    assert((json = has_json_parse(doc, true)) != NULL);
+    assert(has_walk(json, trace_walker, &t1) == 0);
+    assert(has_json_serialize(json, &text, &length, 0) == 0);
+    has_free(json);
+    assert(has_json_walk(doc, n, HAS_JSON_PARSE_DECODE, trace_walker, &t2) == 0);
+    assert(t1.length == t2.length);
+    assert(memcmp(t1.trace, t2.trace, t1.length) == 0);
+
+    /* Serialized from the events as from the tree */
+    sb.buffer = out;
+    sb.size = sizeof(out);
+    sb.current = 0;
+    sb.owner = false;
+    s.outputter = has_json_serializer_buffer_outputter;
+    s.pointer = &sb;
+    s.flags = 0;
+    s.indent = 0;
+    assert(has_json_walk(doc, n, HAS_JSON_PARSE_DECODE,
+                         has_json_serializer_walker, &s) == 0);
+    assert(sb.current == length && memcmp(out, text, length) == 0);
+    free(text);
+
+    /* Aborted by the callback, invalid text */
+    memset(&t2, 0, sizeof(t2));
+    t2.abort = 5;
+    assert(has_json_walk(doc, n, 0, trace_walker, &t2) == 7);
+    memset(&t2, 0, sizeof(t2));
+    assert(has_json_walk(doc, n - 1, 0, trace_walker, &t2) == -1);
+    memset(&t2, 0, sizeof(t2));
+    assert(has_json_walk("[1] 2", 5, 0, trace_walker, &t2) == -1);
+
+    /* Nesting deeper than the initial stack */
+    n = 1000;
+    assert((deep = malloc(2 * n)) != NULL);
+    for(i = 0; i < n; i++) {
+        deep[i] = '[';
+        deep[n + i] = ']';
+    }
+    i = 0;
+    assert(has_json_walk(deep, 2 * n, 0, count_walker, &i) == 0);
+    assert(i == n);
+    free(deep);
+}
+
+void test_equal(void)
+{
+    has_t *a, *b, *c, *d;
+    has_digest_t da, db;
+
+    assert((a = has_json_parse("{\"a\": [1, 2.5, \"x\"], \"b\": {\"c\": true,"
+                               "\"d\": null}}", false)) != NULL);
+    assert((b = has_json_parse("{\"b\": {\"d\": null, \"c\": true},"
+                               "\"a\": [1, 2.5, \"x\"]}", false)) != NULL);
+    assert(has_equal(a, b) && has_equal(b, a) && has_equal(a, a));
+    assert(has_digest(a, &da) == 0 && has_digest(b, &db) == 0);
+    assert(da.low == db.low && da.high == db.high);
+    /* Memoized */
+    assert(has_digest(a, &db) == 0);
+    assert(da.low == db.low && da.high == db.high);
+
+    /* Modification of a container resets its digest */
+    assert(has_hash_set_str(b, "e", has_int_new(1)) != NULL);
+    assert(!has_equal(a, b));
+    assert(has_digest(b, &db) == 0);
+    assert(da.low != db.low || da.high != db.high);
+    assert(has_hash_delete_str(b, "e"));
+    assert(has_equal(a, b));
+    assert(has_digest(b, &db) == 0);
+    assert(da.low == db.low && da.high == db.high);
+
+    /* Nested modifications reset the digests of the ancestors */
+    c = has_hash_get_str(b, "a");
+    assert(has_array_push(c, has_null_new()) != NULL);
+    assert(!has_equal(a, b));
+    assert(!has_digest_memoized(b, NULL));
+    assert(has_digest(b, &db) == 0);
+    assert(da.low != db.low || da.high != db.high);
+    assert(has_digest(a, &da) == 0);
+    has_free(has_array_pop(c));
+    assert(has_equal(a, b));
+    assert(has_digest(b, &db) == 0);
+    assert(da.low == db.low && da.high == db.high);
+    /* Replaced scalars */
+    d = has_array_get(c, 0);
+    assert(has_array_set(c, 0, has_int_new(3)) != NULL);
+    has_free(d);
+    assert(!has_equal(a, b) && !has_equal(b, a));
+    assert(has_digest(b, &db) == 0);
+    assert(da.low != db.low || da.high != db.high);
+    d = has_array_get(c, 0);
+    assert(has_array_set(c, 0, has_int_new(1)) != NULL);
+    has_free(d);
+    assert(has_equal(a, b));
+    assert(has_digest(b, &db) == 0 && has_digest(a, &da) == 0);
+    assert(da.low == db.low && da.high == db.high);
+
+    /* Order matters in arrays */
+    c = has_hash_get_str(a, "a");
+    has_free(has_array_pop(c));
+    assert(has_array_push(c, has_double_new(2.5)) != NULL);
+    assert(!has_equal(a, b));
+
+    has_free(a);
+    has_free(b);
+
+    /* Memoized digests do not hide changes two levels down */
+    assert((a = has_json_parse("{\"x\": {\"y\": 1}}", false)) != NULL);
+    assert((b = has_json_parse("{\"x\": {\"y\": 1}}", false)) != NULL);
+    assert(has_digest(a, &da) == 0 && has_digest(b, &db) == 0);
+    assert(has_digest_memoized(b, NULL));
+    assert(has_hash_set_str(has_hash_get_str(b, "x"), "y", has_int_new(2)) != NULL);
+    assert(!has_digest_memoized(b, NULL));
+    assert(!has_equal(a, b));
+    assert(has_digest(a, &da) == 0 && has_digest(b, &db) == 0);
+    assert(da.low != db.low || da.high != db.high);
+    assert(has_hash_set_str(has_hash_get_str(b, "x"), "y", has_int_new(1)) != NULL);
+    assert(has_equal(a, b));
+    assert(has_digest(a, &da) == 0 && has_digest(b, &db) == 0);
+    assert(da.low == db.low && da.high == db.high);
+
+    /* Only the containers above a modification are reset */
+    assert(has_hash_set_str(b, "z", has_int_new(1)) != NULL);
+    assert(has_digest_memoized(a, NULL));
+    assert(has_digest_memoized(has_hash_get_str(b, "x"), NULL));
+    assert(!has_digest_memoized(b, NULL));
+
+    /* A moved container keeps its memo, and is linked to its new
+       holder */
+    assert(has_digest(b, &db) == 0);
+    c = has_hash_remove_str(b, "x");
+    assert(has_digest_memoized(c, NULL) && !has_digest_memoized(b, NULL));
+    assert(has_digest(b, &db) == 0);
+    assert(has_array_push(d = has_array_new(1), c) != NULL);
+    assert(has_digest(d, &db) == 0 && has_digest_memoized(b, NULL));
+    assert(has_hash_set_str(c, "w", has_null_new()) != NULL);
+    assert(!has_digest_memoized(d, NULL) && has_digest_memoized(b, NULL));
+    has_free(d);
+
+    /* A container held twice is linked to one holder only */
+    assert((c = has_array_new(1)) != NULL && (d = has_array_new(1)) != NULL);
+    assert(has_array_push(c, a) != NULL && has_array_push(d, a) != NULL);
+    assert(has_digest(c, &da) == 0 && has_digest(d, &db) == 0);
+    assert(has_digest_memoized(c, NULL) && !has_digest_memoized(d, NULL));
+    assert(has_hash_delete_str(a, "x"));
+    assert(!has_digest_memoized(c, NULL));
+    assert(has_digest(c, &da) == 0 && has_digest(d, &db) == 0);
+    assert(da.low == db.low && da.high == db.high);
+    has_array_pop(d);
+    has_free(d);
+    has_free(c);
+    has_free(b);
+
+    /* A container replaced in place outlives its former holder */
+    assert((c = has_array_new(1)) != NULL && (d = has_hash_new(1)) != NULL);
+    assert(has_array_push(c, d) != NULL && has_digest(c, &da) == 0);
+    assert(has_array_set(c, 0, has_null_new()) != NULL);
+    has_free(c);
+    assert(has_hash_set_str(d, "a", has_int_new(1)) != NULL);
+    assert(has_digest(d, &db) == 0 && has_digest_memoized(d, NULL));
+    assert((c = has_array_new(1)) != NULL && has_array_push(c, d) != NULL);
+    assert(has_digest(c, &da) == 0 && has_digest_memoized(c, NULL));
+    has_free(c);
+}
+
+/* Counts outstanding blocks, the size is stored before each block */
+void * counting_allocate(void *context, size_t size)
+{
+    size_t *r = malloc(size + sizeof(size_t) * 2);
+    if(r) {
+        (*(long *)context)++;
+        *r = size;
+        r += 2;
+    }
+    return r;
+}
+
+void * counting_reallocate(void *context, void *pointer, size_t size)
+{
+    size_t *r = pointer ? (size_t *)pointer - 2 : NULL;
+    if(r == NULL) {
+        (*(long *)context)++;
+    }
+    if((r = realloc(r, size + sizeof(size_t) * 2)) != NULL) {
+        *r = size;
+        r += 2;
+    } else if(pointer == NULL) {
+        (*(long *)context)--;
+    }
+    return r;
+}
+
+void counting_release(void *context, void *pointer)
+{
+    (*(long *)context)--;
+    free((size_t *)pointer - 2);
+}
+
+void test_allocator(const char *buffer)
+{
+    long count = 0;
+    has_allocator_t a = {
+        counting_allocate, counting_reallocate, counting_release, &count
+    };
+    has_t *json, *copy;
+    char *out = NULL;
+    size_t l;
+
+    has_set_allocator(&a);
+    assert((json = has_json_parse(buffer, true)) != NULL);
+    assert(count > 0);
+    assert((copy = has_copy(json, true)) != NULL);
+    assert(has_json_serialize(copy, &out, &l, 0) == 0);
+    has_free(json);
+    has_free(copy);
+    has_mem_free(out);
+    assert(count == 0);
+    has_set_allocator(NULL);
+}
+
+void test_insitu(void)
+{
+    const char escaped[] = "{\"k\\u00e9y\": [\"<a href=\\\"x\\\">\\n\", "
+        "\"{\\\"a\\\": \\\"\\\\\\\"\\\"}\", \"\\ud83d\\ude00\\t\\/\", "
+        "\"plain\", 1.5, null]}";
+    const char plain[] = "{\"key\": [\"a\", \"b\", \"c\", \"plain\", 1.5, null]}"
+        "                                        ";
+    size_t n = sizeof(escaped) - 1, i, l;
+    long count = 0, base, expected;
+    has_allocator_t a = {
+        counting_allocate, counting_reallocate, counting_release, &count
+    };
+    has_t *j1, *j2, *v;
+    char *buffer;
+    const char *str;
+
+    assert((buffer = malloc(n)) != NULL);
+    memcpy(buffer, escaped, n);
+    has_set_allocator(&a);
+    assert((j1 = has_json_parse(escaped, true)) != NULL);
+
+    /* As many live allocations as without escapes */
+    base = count;
+    assert((j2 = has_json_parse(plain, true)) != NULL);
+    expected = count - base;
+    has_free(j2);
+    assert((j2 = has_json_parse_insitu(buffer, n, 0)) != NULL);
+    assert(count - base == expected);
+
+    assert(has_equal(j1, j2));
+    v = has_hash_get(j2, "k\xc3\xa9y", 4);
+    for(i = 0; i < 4; i++) {
+        str = has_string_get(has_array_get(v, i), &l);
+        assert(str >= buffer && str + l <= buffer + n);
+    }
+    assert(memcmp(has_string_get(has_array_get(v, 2), NULL),
+                  "\xf0\x9f\x98\x80\t/", 6) == 0);
+    has_free(j2);
+    has_free(j1);
+    assert(count == 0);
+    has_set_allocator(NULL);
+
+    /* Short text, without structural index */
+    memcpy(buffer, "[\"a\\nb\"]", 8);
+    assert((j1 = has_json_parse_insitu(buffer, 8, 0)) != NULL);
+    assert((str = has_string_get(has_array_get(j1, 0), &l)) == buffer + 2);
+    assert(l == 3 && memcmp(str, "a\nb", 3) == 0);
+    has_free(j1);
+
+    /* Invalid escapes are errors */
+    memcpy(buffer, "[\"\\x\"]", 6);
+    assert(has_json_parse_insitu(buffer, 6, 0) == NULL);
+    free(buffer);
+}
+
+void test_ctx(void)
+{
+    long count = 0, retained;
+    has_allocator_t a = {
+        counting_allocate, counting_reallocate, counting_release, &count
+    };
+    char doc[1024];
+    size_t n = 0;
+    has_json_ctx_t *ctx;
+    has_t *j1, *j2;
+    int i;
+
+    /* Deep and wide enough for the stacks to move to the heap */
+    for(i = 0; i < 40; i++) {
+        doc[n++] = '[';
+    }
+    for(i = 0; i < 100; i++) {
+        n += sprintf(doc + n, "%s%d", i ? "," : "", i);
+    }
+    for(i = 0; i < 40; i++) {
+        doc[n++] = ']';
+    }
+
+    has_set_allocator(&a);
+    assert((ctx = has_json_ctx_new()) != NULL);
+    assert((j1 = has_json_ctx_parse(ctx, doc, n, 0)) != NULL);
+    has_free(j1);
+    retained = count;
+    assert((j1 = has_json_ctx_parse(ctx, doc, n, HAS_JSON_PARSE_DECODE)) != NULL);
+    assert((j2 = has_json_parse_n(doc, n, 0)) != NULL);
+    assert(has_equal(j1, j2));
+    has_free(j1);
+    has_free(j2);
+    assert(count == retained);
+    /* Failures leave the context usable */
+    assert(has_json_ctx_parse(ctx, doc, n - 1, 0) == NULL);
+    assert(has_json_ctx_parse(ctx, "{\"a\": [1, {}]} x", 16, 0) == NULL);
+    assert(count == retained);
+    assert((j1 = has_json_ctx_parse(ctx, "{\"a\": [1, {}]}", 14, 0)) != NULL);
+    assert(has_array_count(has_hash_get_str(j1, "a")) == 2);
+    has_free(j1);
+    has_json_ctx_free(ctx);
+    assert(count == 0);
+    has_set_allocator(NULL);
+}
+
+void test_memory_usage(void)
+{
+    has_t *h, *a;
+    has_memory_usage_t u;
+    has_counters_t before, after;
+    has_digest_t d;
+    char *key = has_mem_alloc(3);
+    int counted = has_counters(&before);
+
+    strcpy(key, "ab");
+    assert((h = has_hash_new(4)) != NULL);
+    assert((a = has_array_new(4)) != NULL);
+    assert(has_array_push(a, has_int_new(1)) != NULL);
+    assert(has_array_push(a, has_int_new(2)) != NULL);
+    assert(has_hash_set_o(h, key, 2, a, true) != NULL);
+    assert(has_hash_set_str(h, "xyz", has_string_new_str("hello")) != NULL);
+    assert(has_hash_set_str(h, "nil", NULL) != NULL);
+
+    assert(has_memory_usage(h, &u) == 0);
+    assert(u.nodes == 5 * sizeof(has_t));
+    assert(u.hash_entries == 4 * sizeof(has_hash_entry_t));
+    assert(u.hash_index == hash_size(4) * sizeof(has_hash_entry_t *) +
+           sizeof(has_hash_header_t));
+    assert(u.array_elements == 2 * sizeof(has_t *));
+    assert(u.array_slack == 2 * sizeof(has_t *));
+    assert(u.owned_strings == 2);
+    assert(u.borrowed_strings == 3 + 3 + 5);
+    assert(u.digests == 0);
+    assert(u.total == u.nodes + u.hash_entries + u.hash_index +
+           u.array_elements + u.array_slack + u.owned_strings);
+    assert(has_digest(h, &d) == 0 && has_memory_usage(h, &u) == 0);
+    assert(u.digests == 2 * sizeof(has_memo_t));
+
+    if(counted == 0) {
+        assert(has_counters(&after) == 0);
+        assert(after.elements[has_hash] - before.elements[has_hash] == 1);
+        assert(after.elements[has_array] - before.elements[has_array] == 1);
+        assert(after.elements[has_integer] - before.elements[has_integer] == 2);
+        assert(after.elements[has_string] - before.elements[has_string] == 1);
+    }
+    has_free(h);
+    if(counted == 0) {
+        assert(has_counters(&after) == 0);
+        assert(memcmp(&before, &after, sizeof(has_counters_t)) == 0);
+    }
+}
+
+void test_parse(void)
+{
+    const char *invalid[] = {
+        "", "{", "[1,]", "{\"a\":1,}", "{\"a\" 1}", "{1:2}", "[1 2]",
+        "[1}", "{\"a\":1]", "\"abc", "\"a\\x\"", "\"\\u12\"", "[nul]",
+        "1 2", "{\"a\"}", "]", NULL
+    };
+    has_t *json;
+    char *dense, *out = NULL;
+    size_t i, l, n = 100000;
+
+    for(i = 0; invalid[i]; i++) {
+        assert(has_json_parse(invalid[i], false) == NULL);
+    }
+
+    assert((json = has_json_parse(" {\"a\\/b\": [ {}, [], \"x\\u00e9\" ], "
+                                  "\"a\": 1, \"a\": true } ", true)) != NULL);
+    assert(has_hash_count(json) == 2);
+    assert(has_bool_get(has_hash_get_str(json, "a")));
+    assert(has_array_count(has_hash_get_str(json, "a/b")) == 3);
+    assert(has_json_serialize(json, &out, &l, 0) == 0);
+    assert(strcmp(out, "{\"a/b\":[{},[],\"x\xc3\xa9\"],\"a\":true}") == 0);
+    has_mem_free(out);
+    has_free(json);
+
+    /* Dense and deep documents are not limited by a token estimate */
+    assert((dense = malloc(2 * n + 2)) != NULL);
+    dense[0] = '[';
+    for(i = 0; i < n; i++) {
+        dense[2 * i + 1] = '0';
+        dense[2 * i + 2] = ',';
+    }
+    dense[2 * n] = ']';
+    dense[2 * n + 1] = '\0';
+    assert((json = has_json_parse(dense, false)) != NULL);
+    assert(has_array_count(json) == n);
+    has_free(json);
+
+    for(i = 0; i < n; i++) {
+        dense[i] = '[';
+        dense[n + i] = ']';
+    }
+    dense[2 * n] = '\0';
+    assert((json = has_json_parse(dense, false)) != NULL);
+    has_free(json);
+    free(dense);
+}
+
+/* Parses with the byte lexer or the indexed lexer */
+has_t *parse_with(const char *buffer, size_t length, bool indexed)
+{
+    has_json_lexer_t *l = calloc(1, sizeof(has_json_lexer_t));
+    has_json_builder_t b;
+    has_json_token_t t;
+    has_t *r = NULL;
+
+    assert(l != NULL);
+    l->buffer = buffer;
+    l->length = length;
+    has_json_builder_init(&b, true, false);
+    for(;;) {
+        if(indexed) {
+            has_json_lex_indexed(l, &t);
+        } else {
+            has_json_lex(l, &t);
+        }
+        if(t.type == has_json_token_end) {
+            if(b.expect == has_json_expect_end) {
+                r = b.root;
+                b.root = NULL;
+            }
+            break;
+        }
+        if(has_json_builder_token(&b, &t) < 0) {
+            break;
+        }
+    }
+    has_json_builder_clear(&b);
+    free(l);
+    return r;
+}
+
+/* Both lexers must accept the same documents with the same result */
+void compare_lexers(const char *buffer, size_t length)
+{
+    has_t *a = parse_with(buffer, length, false);
+    has_t *b = parse_with(buffer, length, true);
+
+    assert((a == NULL) == (b == NULL));
+    assert(has_equal(a, b));
+    has_free(a);
+    has_free(b);
+}
+
+void test_index(void)
+{
+    const char alphabet[] = "{}[]:,\"\"\"\\ \n\t\r 1e\x01\xc3\xa9";
+    has_json_classifier_t classifiers[] = {
+        has_json_classify_scalar,
+#ifdef HAS_JSON_X86
+        has_json_classify_sse42, has_json_classify_avx2,
+#endif
+        NULL
+    };
+    has_json_classifier_t selected = has_json_classifier();
+    char block[HAS_JSON_BLOCK * 4], *doc;
+    has_json_masks_t m1, m2;
+    has_t *j1, *j2 = NULL;
+    size_t i, k, n;
+
+    srand(42);
+    for(k = 0; k < 2000; k++) {
+        for(i = 0; i < sizeof(block); i++) {
+            block[i] = (k % 4) ? alphabet[rand() % (sizeof(alphabet) - 1)] : rand();
+        }
+        has_json_classify_scalar(block, &m1);
+        for(i = 1; classifiers[i]; i++) {
+#ifdef HAS_JSON_X86
+            if(classifiers[i] == has_json_classify_avx2 &&
+               !__builtin_cpu_supports("avx2")) {
+                continue;
+            }
+#endif
+            classifiers[i](block, &m2);
+            assert(memcmp(&m1, &m2, sizeof(m1)) == 0);
+        }
+        compare_lexers(block, sizeof(block));
+    }
+
+    /* Strings and escapes crossing block boundaries */
+    n = 64 * 1024;
+    assert((doc = malloc(n + 1)) != NULL);
+    for(i = 0, k = 0; i + 64 < n; k++) {
+        i += sprintf(doc + i, "%s{\"k%lu\\\\\":[\"%.*s\\\"\\\\\", %lu, true]}",
+                     (k == 0) ? "[" : ",", (unsigned long)k, (int)(k % 70),
+                     "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijklmnopqr",
+                     (unsigned long)k);
+    }
+    doc[i++] = ']';
+    doc[i] = '\0';
+    compare_lexers(doc, i);
+    for(k = 0; classifiers[k]; k++) {
+        has_json_classify = classifiers[k];
+#ifdef HAS_JSON_X86
+        if(classifiers[k] == has_json_classify_avx2 &&
+           !__builtin_cpu_supports("avx2")) {
+            continue;
+        }
+#endif
+        assert((j1 = has_json_parse(doc, true)) != NULL);
+        if(k == 0) {
+            j2 = j1;
+        } else {
+            assert(has_equal(j1, j2));
+            has_free(j1);
+        }
+    }
+    has_json_classify = selected;
+    has_free(j2);
+
+    /* Unterminated string and control character in a string */
+    memset(doc, ' ', 200);
+    doc[100] = '"';
+    doc[200] = '\0';
+    assert(has_json_parse(doc, false) == NULL);
+    doc[150] = '"';
+    doc[120] = '\n';
+    assert(has_json_parse(doc, false) == NULL);
+    doc[120] = ' ';
+    assert((j1 = has_json_parse(doc, false)) != NULL);
+    has_free(j1);
+    free(doc);
+}
+
+void test_parse_n(void)
+{
+    const char text[] = "{\"a\": [1, \"b\\u00e9\", true]}  ";
+    size_t n = sizeof(text) - 1, i;
+    has_t *j1, *j2;
+    char *buffer, *decoded;
+    FILE *f;
+    has_json_file_t *file;
+    const char *path = "test_json.json";
+
+    /* Exactly sized, not terminated */
+    assert((buffer = malloc(n)) != NULL);
+    memcpy(buffer, text, n);
+    assert((j1 = has_json_parse(text, true)) != NULL);
+    assert((j2 = has_json_parse_n(buffer, n, HAS_JSON_PARSE_DECODE)) != NULL);
+    assert(has_equal(j1, j2));
+    has_free(j2);
+    assert((j2 = has_json_parse_n(buffer, n, HAS_JSON_PARSE_PARALLEL)) != NULL);
+    has_free(j2);
+    /* Truncations are invalid, the string can not be read past its end */
+    for(i = 0; i < 27; i++) {
+        assert(has_json_parse_n(buffer, i, HAS_JSON_PARSE_DECODE) == NULL);
+    }
+    assert(has_json_string_decode(buffer + 11, 2, &decoded, &i) < 0);
+    free(buffer);
+
+    /* Mapped file */
+    assert((f = fopen(path, "w")) != NULL);
+    assert(fwrite(text, 1, n, f) == n);
+    fclose(f);
+    assert((file = has_json_parse_file(path, HAS_JSON_PARSE_DECODE)) != NULL);
+    assert(has_equal(j1, has_json_file_root(file)));
+    has_json_file_close(file);
+    assert((f = fopen(path, "w")) != NULL);
+    fclose(f);
+    assert(has_json_parse_file(path, 0) == NULL);
+    unlink(path);
+    assert(has_json_parse_file(path, 0) == NULL);
+    has_free(j1);
+}
+
+void test_numbers(void)
+{
+    const char *invalid[] = {
+        "01", "-01", "1.", "1.e5", "1e", "1e+", "-", ".5", "+1", "1x", "0x10",
+        "--1", "1.5.2", NULL
+    };
+    const char *doubles[] = {
+        "0.1", "-2.5e3", "1e22", "1e-22", "3e30", "123456789012345678901234567890",
+        "2.2250738585072014e-308", "1.7976931348623157e308", "4.9e-324",
+        "0.30000000000000004", "9007199254740993.0", "1e400", NULL
+    };
+    char *out = NULL;
+    size_t l;
+    has_t *j;
+    int i;
+
+    for(i = 0; invalid[i] != NULL; i++) {
+        assert(has_json_parse(invalid[i], false) == NULL);
+    }
+    /* Doubles must match strtod() to the bit */
+    for(i = 0; doubles[i] != NULL; i++) {
+        assert((j = has_json_parse(doubles[i], false)) != NULL);
+        assert(has_is_double(j));
+        assert(has_double_get(j) == strtod(doubles[i], NULL));
+        has_free(j);
+    }
+    assert((j = has_json_parse("[2147483647, -2147483648, 2147483648, "
+                               "9007199254740993, -9223372036854775808, "
+                               "9223372036854775807, 9223372036854775808, "
+                               "-0, 0.0000000000000000000000000000001]",
+                               false)) != NULL);
+    assert(has_is_int(has_array_get(j, 0)));
+    assert(has_int_get(has_array_get(j, 1)) == INT32_MIN);
+    assert(has_is_int64(has_array_get(j, 2)));
+    assert(has_int64_get(has_array_get(j, 2)) == 2147483648LL);
+    assert(has_int64_get(has_array_get(j, 3)) == 9007199254740993LL);
+    assert(has_int64_get(has_array_get(j, 4)) == INT64_MIN);
+    assert(has_int64_get(has_array_get(j, 5)) == INT64_MAX);
+    assert(has_int64_get(has_array_get(j, 0)) == INT32_MAX);
+    assert(has_is_double(has_array_get(j, 6)));
+    assert(has_is_int(has_array_get(j, 7)));
+    assert(has_double_get(has_array_get(j, 8)) == 1e-31);
+    /* 64-bit integers are serialized exactly */
+    assert(has_json_serialize(has_array_get(j, 4), &out, &l, 0) == 0);
+    assert(strcmp(out, "-9223372036854775808") == 0);
+    has_mem_free(out);
+    has_free(j);
+}
+
+/* Shortest decimal string parsing back to v, from strtod() */
+int shortest_length(double v)
+{
+    char buffer[32];
+    int p;
+    for(p = 1; p < 17; p++) {
+        snprintf(buffer, sizeof(buffer), "%.*e", p - 1, v);
+        if(strtod(buffer, NULL) == v) {
+            break;
+        }
+    }
+    return p;
+}
+
+/* Number of significant digits of a formatted double */
+int significant_digits(const char *s)
+{
+    int first = -1, last = -1, i, n = 0;
+    for(i = 0; s[i] != '\0' && s[i] != 'e'; i++) {
+        if(s[i] >= '0' && s[i] <= '9') {
+            if(s[i] != '0') {
+                first = (first < 0) ? n : first;
+                last = n;
+            }
+            n++;
+        }
+    }
+    return (first < 0) ? 1 : last - first + 1;
+}
+
+void test_format(void)
+{
+    const char *expected[][2] = {
+        { "1e-9", "1e-9" }, { "0.1", "0.1" }, { "1.0", "1.0" },
+        { "-0.0", "-0.0" }, { "100.0", "100.0" }, { "1e21", "1e21" },
+        { "0.001", "0.001" }, { "0.0001", "0.0001" }, { "0.00001", "1e-5" }, { "123456.789", "123456.789" },
+        { "1e15", "1e15" }, { "123456789012345.0", "123456789012345.0" },
+        { "5e-324", "5e-324" }, { "1.7976931348623157e308", "1.7976931348623157e308" },
+        { "2.2250738585072014e-308", "2.2250738585072014e-308" },
+        { "0.30000000000000004", "0.30000000000000004" }, { "-2.5e-3", "-0.0025" },
+        { NULL, NULL }
+    };
+    char buffer[32], *out = NULL;
+    double v, w;
+    uint64_t bits;
+    size_t l;
+    has_t *j;
+    int i, n, digits, longer = 0;
+
+    for(i = 0; expected[i][0] != NULL; i++) {
+        n = has_json_format_double(buffer, strtod(expected[i][0], NULL));
+        assert(n == strlen(expected[i][1]));
+        assert(memcmp(buffer, expected[i][1], n) == 0);
+    }
+    assert(has_json_format_double(buffer, HUGE_VAL) == 4);
+    assert(memcmp(buffer, "null", 4) == 0);
+
+    /* Random bit patterns parse back to the same double, in the shortest
+       form except in rare cases where Grisu2 emits a longer one */
+    srand(2);
+    for(i = 0; i < 100000; i++) {
+        bits = ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ rand();
+        memcpy(&v, &bits, sizeof(v));
+        if(v != v || v - v != 0) {
+            continue;
+        }
+        n = has_json_format_double(buffer, v);
+        assert(n < 32);
+        buffer[n] = '\0';
+        w = strtod(buffer, NULL);
+        assert(memcmp(&v, &w, sizeof(v)) == 0);
+        digits = significant_digits(buffer);
+        longer += (digits > shortest_length(v));
+    }
+    assert(longer < 200);
+
+    n = has_json_format_int64(buffer, INT64_MIN);
+    assert(n == 20 && memcmp(buffer, "-9223372036854775808", n) == 0);
+    n = has_json_format_int64(buffer, 0);
+    assert(n == 1 && buffer[0] == '0');
+    n = has_json_format_int64(buffer, 1099);
+    assert(n == 4 && memcmp(buffer, "1099", n) == 0);
+
+    /* Serialized doubles are parsed back as doubles */
+    assert((j = has_json_parse("[1e-9, 2.0, -7, 1e300, 0.5]", false)) != NULL);
+    assert(has_json_serialize(j, &out, &l, 0) == 0);
+    assert(strcmp(out, "[1e-9,2.0,-7,1e300,0.5]") == 0);
+    has_mem_free(out);
+    has_free(j);
+}
+
+/* All scanners must stop at the first byte that may need escaping */
+void test_escape(void)
+{
+    const char *special[][2] = {
+        { "\"", "\\\"" }, { "\\", "\\\\" }, { "\n", "\\n" },
+        { "\x01", "\\u0001" }, { "\x1F", "\\u001F" }, { "\xC3\xA9", "\\u00E9" },
+        { NULL, NULL }
+    };
+    char buffer[256], expected[512], *out;
+    size_t i, j, k, l, n;
+    has_t *str;
+
+    srand(3);
+    for(i = 0; i < 20000; i++) {
+        n = rand() % 200;
+        for(j = 0; j < n; j++) {
+            buffer[j] = (rand() % 64) ? 0x20 + rand() % 0x5F : rand() % 256;
+        }
+        for(k = 0; k < n; k++) {
+            unsigned char c = buffer[k];
+            if(c < 0x20 || c > 0x7F || c == '"' || c == '\\') {
+                break;
+            }
+        }
+        assert(has_json_escape_scan(buffer, n) == k);
+        assert(has_json_escape_scan_scalar(buffer, n) == k);
+#ifdef HAS_JSON_X86
+        if(__builtin_cpu_supports("sse4.2")) {
+            assert(has_json_escape_scan_sse42(buffer, n) == k);
+        }
+        if(__builtin_cpu_supports("avx2")) {
+            assert(has_json_escape_scan_avx2(buffer, n) == k);
+        }
+#endif
+    }
+
+    /* Each special sequence at all positions of a long string */
+    for(i = 0; special[i][0] != NULL; i++) {
+        k = strlen(special[i][0]);
+        for(j = 0; j < 100; j++) {
+            memset(buffer, 'a', 100 + k);
+            memcpy(buffer + j, special[i][0], k);
+            l = sprintf(expected, "\"%.*s%s%.*s\"", (int)j, buffer,
+                        special[i][1], (int)(100 - j), buffer + j + k);
+            assert((str = has_string_new(buffer, 100 + k)) != NULL);
+            out = NULL;
+            assert(has_json_serialize(str, &out, &n, HAS_JSON_SERIALIZE_ENCODE) == 0);
+            assert(n == l && memcmp(out, expected, l) == 0);
+            has_mem_free(out);
+            has_free(str);
+        }
+    }
+}
+
+void test_raw(void)
+{
+    const char doc[] = "{\"a\":1.10,\"b\":[-0.0e+5,123456789012345678901234,"
+        "9007199254740993],\"c\":7,\"d\":true}";
+    size_t n = sizeof(doc) - 1, l;
+    has_t *j, *b, *copy;
+    char *out = NULL;
+    int flags[] = { HAS_JSON_PARSE_RAW, HAS_JSON_PARSE_RAW | HAS_JSON_PARSE_LAZY }, i;
+
+    for(i = 0; i < 2; i++) {
+        assert((j = has_json_parse_n(doc, n, flags[i])) != NULL);
+        assert(has_is_number(has_hash_get_str(j, "a")));
+        assert(has_double_get(has_hash_get_str(j, "a")) == 1.1);
+        assert(has_int_get(has_hash_get_str(j, "a")) == 0);
+        assert(has_int_get(has_hash_get_str(j, "c")) == 7);
+        assert(has_bool_get(has_hash_get_str(j, "d")));
+        b = has_hash_get_str(j, "b");
+        assert(has_number_get(has_array_get(b, 0), &l) == doc + 15 && l == 7);
+        assert(has_int64_get(has_array_get(b, 1)) == 0);
+        assert(has_double_get(has_array_get(b, 1)) == 1.23456789012345678e23);
+        assert(has_int64_get(has_array_get(b, 2)) == 9007199254740993LL);
+        /* Emitted byte for byte, also from an owning copy */
+        assert((copy = has_copy(j, true)) != NULL);
+        assert(has_equal(j, copy));
+        has_free(j);
+        assert(has_json_serialize(copy, &out, &l, 0) == 0);
+        assert(l == n && memcmp(out, doc, n) == 0);
+        has_mem_free(out);
+        out = NULL;
+        has_free(copy);
+    }
+    assert(has_json_parse_n("[01]", 4, HAS_JSON_PARSE_RAW) == NULL);
+    assert(has_json_parse_n("[1.]", 4, HAS_JSON_PARSE_RAW) == NULL);
+    assert(has_json_parse_n("-", 1, HAS_JSON_PARSE_RAW) == NULL);
+
+    /* Streamed text is copied */
+    {
+        has_json_parser_t *p = has_json_parser_new(HAS_JSON_PARSE_RAW);
+        char chunk[4];
+        for(i = 0; i < n; i += l) {
+            l = (n - i < sizeof(chunk)) ? n - i : sizeof(chunk);
+            memcpy(chunk, doc + i, l);
+            assert(has_json_parser_feed(p, chunk, l) == 0);
+        }
+        assert((j = has_json_parser_finish(p)) != NULL);
+        assert(has_json_serialize(j, &out, &l, 0) == 0);
+        assert(l == n && memcmp(out, doc, n) == 0);
+        has_mem_free(out);
+        has_free(j);
+    }
+}
+
+void test_select(void)
+{
+    const char doc[] = "{\"id\": 42, \"user\": {\"name\": \"a\\u00e9\", "
+        "\"tags\": [\"x\", \"y\"], \"age\": 3}, \"items\": [{\"sku\": \"A\"}, "
+        "{\"sku\": \"B\", \"q\": 2}, {\"sku\": \"C\"}], \"a/b\": 1, \"m~n\": 2, "
+        "\"skip\": {\"deep\": [1, [2, {\"x\": \"\\n\"}]]}}";
+    const char *paths[] = {
+        "/id", "/user/name", "/items/1/sku", "/a~1b", "/m~0n", "/nothing/here",
+        "/user/tags/5", "/id/0", NULL
+    };
+    const char *all[] = { "", NULL }, *invalid[] = { "id", NULL };
+    const char *first[] = { "/1", NULL }, *none[] = { NULL };
+    size_t n = sizeof(doc) - 1, l;
+    char *out = NULL;
+    has_t *j1, *j2;
+
+    assert((j1 = has_json_parse_select(doc, n, paths, HAS_JSON_PARSE_DECODE)) != NULL);
+    assert(has_json_serialize(j1, &out, &l, 0) == 0);
+    assert(strcmp(out, "{\"id\":42,\"user\":{\"name\":\"a\xc3\xa9\"},"
+                  "\"items\":[null,{\"sku\":\"B\"}],\"a/b\":1,\"m~n\":2}") == 0);
+    has_mem_free(out);
+    has_free(j1);
+
+    /* The empty pointer is the whole document */
+    assert((j1 = has_json_parse_select(doc, n, all, 0)) != NULL);
+    assert((j2 = has_json_parse_n(doc, n, 0)) != NULL);
+    assert(has_equal(j1, j2));
+    has_free(j1);
+    has_free(j2);
+
+    /* Short text, without structural index */
+    assert((j1 = has_json_parse_select("[0, [1], 2]", 11, first, 0)) != NULL);
+    assert(has_array_count(j1) == 2 && has_is_null(has_array_get(j1, 0)));
+    assert(has_int_get(has_array_get(has_array_get(j1, 1), 0)) == 1);
+    has_free(j1);
+
+    assert(has_json_parse_select(doc, n, invalid, 0) == NULL);
+    assert(has_json_parse_select(doc, n, none, 0) == NULL);
+    assert(has_json_parse_select("{\"id\" 42}", 10, paths, 0) == NULL);
+    assert(has_json_parse_select("{\"s\": [1, 2}", 12, paths, 0) == NULL);
+    assert(has_json_parse_select("{\"id\": 1} 2", 12, paths, 0) == NULL);
+    assert(has_json_parse_select("{\"id\": 01}", 11, paths, 0) == NULL);
+}
+
+/* Feeds copies of chunks of at most step bytes, freed after each call */
+has_t *parse_stream(const char *doc, size_t n, size_t first, size_t step)
+{
+    has_json_parser_t *p = has_json_parser_new(HAS_JSON_PARSE_DECODE);
+    size_t i, k;
+    char *chunk;
+
+    assert(p != NULL);
+    for(i = 0; i < n; i += k) {
+        k = (i == 0) ? first : step;
+        k = (k < n - i) ? k : n - i;
+        assert((chunk = malloc(k ? k : 1)) != NULL);
+        memcpy(chunk, doc + i, k);
+        has_json_parser_feed(p, chunk, k);
+        free(chunk);
+    }
+    return has_json_parser_finish(p);
+}
+
+void test_stream(void)
+{
+    const char *docs[] = {
+        "{\"alpha\": [1, -2.5e3, true, false, null], \"b\\\"r\\\\avo\": "
+        "{\"c\": \"\\u00e9\\ud83d\\ude00\\n\", \"d\": []}, \"e\": {}}",
+        "  12345  ", "\"string\"", "[[[[\"\"]]]]",
+        /* Invalid */
+        "[1, 2", "[1 2]", "\"abc", "\"a\\x\"", "[\"a\tb\"]", "{\"a\" 1}",
+        "[1] 2", "tru", "", NULL
+    };
+    size_t i, k, n;
+    has_t *j1, *j2;
+
+    for(i = 0; docs[i]; i++) {
+        n = strlen(docs[i]);
+        j1 = has_json_parse(docs[i], true);
+        for(k = 1; k <= n; k++) {
+            j2 = parse_stream(docs[i], n, k, n);
+            assert((j1 == NULL) == (j2 == NULL));
+            assert(has_equal(j1, j2));
+            has_free(j2);
+        }
+        j2 = parse_stream(docs[i], n, 1, 1);
+        assert(has_equal(j1, j2));
+        has_free(j2);
+        has_free(j1);
+    }
+}
+
+/* Checks records against the expected array, stops at index stop */
+typedef struct {
+    has_t  *expected;
+    size_t  count;
+    size_t  stop;
+} ndjson_check_t;
+
+int ndjson_checker(size_t index, has_t *record, void *pointer)
+{
+    ndjson_check_t *c = pointer;
+    has_t *e = has_array_get(c->expected, index);
+
+    assert(index == c->count++);
+    assert((e == NULL || has_is_null(e)) ? (record == NULL) :
+           has_equal(e, record));
+    has_free(record);
+    return (index + 1 == c->stop) ? 1 : 0;
+}
+
+void test_ndjson(void)
+{
+    size_t i, l = 0, n = 64 * 1024, invalid = 0;
+    char *doc, *line;
+    ndjson_check_t c;
+    has_t *a;
+    int t;
+
+    assert((doc = malloc(n)) != NULL);
+    assert((c.expected = has_array_new(0)) != NULL);
+    for(i = 0; l + 1024 < n; i++) {
+        line = doc + l;
+        if(i % 50 == 7) {
+            /* Longer than a batch */
+            l += sprintf(line, "{\"long\": \"%0600lu\"}", (unsigned long)i);
+        } else {
+            l += sprintf(line, "[%lu, {\"k\": \"\\u00e9 %lu\"}]",
+                         (unsigned long)i, (unsigned long)i);
+        }
+        doc[l] = '\0';
+        if(i == 100) {
+            invalid = l;
+        }
+        assert(has_array_push(c.expected, has_json_parse(line, true)) != NULL);
+        l += sprintf(doc + l, (i % 7 == 0) ? "\r\n \n" : "\n");
+    }
+    l--; /* No final newline */
+
+    for(t = 0; t <= 8; t += 3) {
+        assert((a = has_ndjson_parse_array(doc, l, HAS_JSON_PARSE_DECODE, t)) != NULL);
+        assert(has_equal(a, c.expected));
+        has_free(a);
+    }
+    assert((a = has_json_parse_n(doc, l, HAS_JSON_PARSE_DECODE |
+                                 HAS_JSON_PARSE_LINES |
+                                 HAS_JSON_PARSE_PARALLEL)) != NULL);
+    assert(has_equal(a, c.expected));
+    has_free(a);
+
+    /* Early stop */
+    c.count = 0;
+    c.stop = 100;
+    assert(has_ndjson_parse(doc, l, HAS_JSON_PARSE_DECODE, 4,
+                            ndjson_checker, &c) == 0);
+    assert(c.count == 100);
+
+    /* Invalid line, reported as NULL */
+    doc[invalid - 1] = ',';
+    has_free(has_array_get(c.expected, 100));
+    has_array_set(c.expected, 100, has_null_new());
+    c.count = 0;
+    c.stop = 0;
+    assert(has_ndjson_parse(doc, l, HAS_JSON_PARSE_DECODE, 4,
+                            ndjson_checker, &c) == 0);
+    assert(c.count == has_array_count(c.expected));
+    assert(has_ndjson_parse_array(doc, l, 0, 4) == NULL);
+    free(doc);
+    has_free(c.expected);
+}
+
+void test_lazy(void)
+{
+    const char *doc =
+        "{\"a\": [1, [2, {\"b\": \"c\\u00e9\"}], {}], \"d\": {\"e\": [[]]},"
+        " \"f\": \"g\", \"h\": [true, null]}";
+    size_t n = strlen(doc);
+    has_t *eager, *lazy, *a, *d;
+    char *out1 = NULL, *out2 = NULL;
+    size_t l1, l2;
+
+    assert((eager = has_json_parse(doc, true)) != NULL);
+    assert((lazy = has_json_parse_n(doc, n, HAS_JSON_PARSE_DECODE |
+                                    HAS_JSON_PARSE_LAZY)) != NULL);
+    assert(lazy->type == has_hash && (lazy->flags & HAS_LAZY));
+
+    /* Only the containers reached are built */
+    assert((a = has_hash_get_str(lazy, "a")) != NULL);
+    assert(!(lazy->flags & HAS_LAZY));
+    assert((a->flags & HAS_LAZY) && has_is_array(a));
+    assert((d = has_hash_get_str(lazy, "d")) != NULL);
+    assert(has_array_count(a) == 3);
+    assert(has_int_get(has_array_get(a, 0)) == 1);
+    assert(has_array_get(has_array_get(a, 1), 1)->flags & HAS_LAZY);
+    assert(d->flags & HAS_LAZY);
+    assert(has_equal(eager, lazy));
+    assert(!(d->flags & HAS_LAZY));
+    assert(has_json_serialize(eager, &out1, &l1, 0) == 0);
+    assert(has_json_serialize(lazy, &out2, &l2, 0) == 0);
+    assert(l1 == l2 && memcmp(out1, out2, l1) == 0);
+    has_free(lazy);
+
+    /* Freed or modified before being built */
+    assert((lazy = has_json_parse_n(doc, n, HAS_JSON_PARSE_LAZY)) != NULL);
+    a = has_hash_get_str(lazy, "a");
+    assert(has_array_push(has_array_get(a, 1), has_int_new(3)) != NULL);
+    assert(has_array_count(has_array_get(a, 1)) == 3);
+    has_free(lazy);
+    assert((lazy = has_json_parse_n(doc, n, HAS_JSON_PARSE_LAZY)) != NULL);
+    has_free(lazy);
+
+    /* Invalid text is rejected by the first pass, scalars are built */
+    assert(has_json_parse_n(doc, n - 1, HAS_JSON_PARSE_LAZY) == NULL);
+    assert(has_json_parse_n("{\"a\": [1,]}", 11, HAS_JSON_PARSE_LAZY) == NULL);
+    assert(has_json_parse_n("{\"a\": \"\\uZZZZ\"}", 15, HAS_JSON_PARSE_LAZY |
+                            HAS_JSON_PARSE_DECODE) == NULL);
+    assert((lazy = has_json_parse_n("12", 2, HAS_JSON_PARSE_LAZY)) != NULL);
+    assert(has_int_get(lazy) == 12);
+    has_free(lazy);
+
+    has_free(eager);
+    free(out1);
+    free(out2);
+}
+
+/* Result must match has_json_parse, invalid documents fail with both */
+void compare_parallel(char *doc, size_t length, int threads)
+{
+    has_t *a, *b;
+    char c = doc[length];
+
+    doc[length] = '\0';
+    a = has_json_parse(doc, true);
+    b = has_json_parse_parallel(doc, length, true, threads);
+    assert((a == NULL) == (b == NULL));
+    assert(has_equal(a, b));
+    has_free(a);
+    has_free(b);
+    doc[length] = c;
+}
+
+void test_parallel(void)
+{
+    size_t i, k, n = 256 * 1024, l;
+    char *doc, *p;
+    has_t *j, *e;
+    int t;
+
+    assert((doc = malloc(n + 64)) != NULL);
+    for(k = 0; k < 2; k++) {
+        /* Separators in strings and nested containers */
+        l = sprintf(doc, "%s\n", k ? "{" : "[");
+        for(i = 0; l + 128 < n; i++) {
+            if(k) {
+                l += sprintf(doc + l, "\"k%lu\": ", (unsigned long)i);
+            }
+            l += sprintf(doc + l, (i % 3 == 0) ? "[%lu, \"a,]\\\\\", {\"b}\": []}],\n" :
+                         (i % 3 == 1) ? "{\"x\\\"y,\": %lu},\n" :
+                         "\"%lu ]}\\\\\",\n", (unsigned long)i);
+        }
+        l -= 2;
+        l += sprintf(doc + l, "\n%s  ", k ? "}" : "]");
+        for(t = 1; t <= 9; t += 2) {
+            compare_parallel(doc, l, t);
+        }
+
+        /* Trailing comma */
+        p = strrchr(doc, k ? '}' : ']');
+        *p = ',';
+        compare_parallel(doc, l, 4);
+        p[0] = ' '; p[1] = k ? '}' : ']';
+        compare_parallel(doc, l, 4);
+        /* Mismatched and missing close */
+        p[1] = k ? ']' : '}';
+        compare_parallel(doc, l, 4);
+        p[1] = ' ';
+        compare_parallel(doc, l, 4);
+        p[1] = k ? '}' : ']';
+        /* Trailing garbage */
+        doc[l - 1] = '1';
+        compare_parallel(doc, l, 4);
+        doc[l - 1] = ' ';
+        /* Empty member and unterminated string in the middle */
+        p = strstr(doc + l / 2, ",\n");
+        p[1] = ',';
+        compare_parallel(doc, l, 4);
+        p[1] = '"';
+        compare_parallel(doc, l, 4);
+        p[1] = '\n';
+        compare_parallel(doc, l, 4);
+    }
+
+    /* Options reach every thread: numbers kept as text, invalid UTF-8
+       rejected in the last segment */
+    l = sprintf(doc, "[");
+    for(i = 0; l + 64 < n; i++) {
+        l += sprintf(doc + l, "[\"s%lu\", %lu.5],\n", (unsigned long)i,
+                     (unsigned long)i);
+    }
+    l -= 2;
+    l += sprintf(doc + l, "]");
+    j = has_json_parse_chunks(doc, l, HAS_JSON_PARSE_RAW | HAS_JSON_PARSE_UTF8,
+                              4);
+    assert(j != NULL && has_array_count(j) == i);
+    e = has_array_get(has_array_get(j, i - 1), 1);
+    assert(has_is_number(e) && has_double_get(e) == (double)(i - 1) + 0.5);
+    has_free(j);
+    strrchr(doc, 's')[0] = '\xFF';
+    assert(has_json_parse_chunks(doc, l, HAS_JSON_PARSE_UTF8, 4) == NULL);
+    assert(has_json_parse_chunks(doc, l, HAS_JSON_PARSE_UTF8, 1) == NULL);
+    assert((j = has_json_parse_chunks(doc, l, 0, 4)) != NULL);
+    has_free(j);
+
+    /* Small or scalar documents */
+    compare_parallel(strcpy(doc, "[1, 2]"), 6, 4);
+    memset(doc, ' ', n);
+    memcpy(doc + n / 2, "\"abc\"", 5);
+    compare_parallel(doc, n, 4);
+    memcpy(doc + n / 2, "[  ]", 4);
+    compare_parallel(doc, n, 4);
+    free(doc);
+}
+
+/* Sink failing once limit bytes have been output */
+int limited_outputter(void *pointer, const char *value, size_t size)
+{
+    size_t *limit = pointer;
+    if(size > *limit) {
+        return -1;
+    }
+    *limit -= size;
+    return 0;
+}
+
+/* Sink failing on whitespace, only output when pretty-printing */
+int layout_outputter(void *pointer, const char *value, size_t size)
+{
+    return (value[0] == ' ' || value[0] == '\n') ? -1 : 0;
+}
+
+void test_sinks(void)
+{
+    size_t i, n = 200000, l, l2, limit;
+    char *doc, *out = NULL, *out2, name[32];
+    has_t *json;
+    FILE *file;
+    int fd;
+
+    /* Many small pieces and a string larger than the staging buffer */
+    assert((doc = malloc(n + 64)) != NULL);
+    l = sprintf(doc, "{\"long\": \"");
+    memset(doc + l, 'a', 100000);
+    l += 100000;
+    l += sprintf(doc + l, "\", \"list\": [");
+    for(i = 0; l + 32 < n; i++) {
+        l += sprintf(doc + l, "%lu, \"\\n\", ", (unsigned long)i);
+    }
+    l += sprintf(doc + l, "null]}");
+    assert((json = has_json_parse_n(doc, l, HAS_JSON_PARSE_DECODE)) != NULL);
+    assert(has_json_serialize(json, &out, &l, HAS_JSON_SERIALIZE_ENCODE |
+                              HAS_JSON_SERIALIZE_PRETTY) == 0);
+    assert((out2 = malloc(l + 1)) != NULL);
+
+    /* File descriptor */
+    strcpy(name, "/tmp/test_json_XXXXXX");
+    assert((fd = mkstemp(name)) >= 0);
+    unlink(name);
+    assert(has_json_serialize_fd(json, fd, HAS_JSON_SERIALIZE_ENCODE |
+                                 HAS_JSON_SERIALIZE_PRETTY) == 0);
+    assert(lseek(fd, 0, SEEK_SET) == 0);
+    for(l2 = 0; (n = read(fd, out2 + l2, l + 1 - l2)) > 0; l2 += n);
+    assert(l2 == l && memcmp(out, out2, l) == 0);
+    close(fd);
+    assert(has_json_serialize_fd(json, -1, 0) == -1);
+    if((fd = open("/dev/full", O_WRONLY)) >= 0) {
+        assert(has_json_serialize_fd(json, fd, 0) == -1);
+        close(fd);
+    }
+
+    /* Stream */
+    assert((file = tmpfile()) != NULL);
+    assert(has_json_serialize_file(json, file, HAS_JSON_SERIALIZE_ENCODE |
+                                   HAS_JSON_SERIALIZE_PRETTY) == 0);
+    rewind(file);
+    assert(fread(out2, 1, l + 1, file) == l);
+    assert(memcmp(out, out2, l) == 0);
+    fclose(file);
+
+    /* Custom sink, errors stop the serialization */
+    limit = l;
+    assert(has_json_serialize_to(json, limited_outputter, &limit,
+                                 HAS_JSON_SERIALIZE_ENCODE |
+                                 HAS_JSON_SERIALIZE_PRETTY) == 0);
+    assert(limit == 0);
+    limit = l / 2;
+    assert(has_json_serialize_to(json, limited_outputter, &limit, 0) == -1);
+    assert(has_json_serialize_to(json, layout_outputter, NULL,
+                                 HAS_JSON_SERIALIZE_ENCODE) == 0);
+    assert(has_json_serialize_to(json, layout_outputter, NULL,
+                                 HAS_JSON_SERIALIZE_ENCODE |
+                                 HAS_JSON_SERIALIZE_PRETTY) == -1);
+    assert(has_json_serialize_to(json, NULL, NULL, 0) == -1);
+
+    has_free(json);
+    free(out);
+    free(out2);
+    free(doc);
+}
 
 int main(int argc, char **argv)
 {
@@ -38,6 +1382,27 @@ int main(int argc, char **argv)
                                HAS_JSON_SERIALIZE_ENCODE) == 0));
     assert(memcmp(out1, out2, l1) != 0);
 
+    test_parse();
+    test_index();
+    test_parallel();
+    test_parse_n();
+    test_numbers();
+    test_format();
+    test_escape();
+    test_raw();
+    test_select();
+    test_stream();
+    test_ndjson();
+    test_lazy();
+    test_walk(json1);
+    test_events();
+    test_equal();
+    test_allocator(buffer);
+    test_memory_usage();
+    test_insitu();
+    test_ctx();
+    test_sinks();
+
     /* Cleanup */
     has_free(json1);
     has_free(json2);
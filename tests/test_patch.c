@@ -0,0 +1,141 @@
+/*
+  (c) Mathias Brossard <mathias@brossard.org>
+*/
+
+#include "has.c"
+#include "has_json.c"
+#include "has_patch.c"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+/* Diffs from and to, applies the result to a copy of from */
+static void test_roundtrip(const char *from, const char *to, int operations)
+{
+    has_t *a, *b, *c, *patch;
+
+    assert((a = has_json_parse(from, false)) != NULL);
+    assert((b = has_json_parse(to, false)) != NULL);
+    assert((patch = has_diff(a, b)) != NULL);
+    assert(operations < 0 || has_array_count(patch) == operations);
+    assert((c = has_copy(a, true)) != NULL);
+    assert(has_patch_apply(&c, patch) == 0);
+    assert(has_equal(c, b));
+    has_free(patch);
+    has_free(c);
+    has_free(b);
+    has_free(a);
+}
+
+/* Applies patch to document, expects result or failure if NULL */
+static void test_apply(const char *document, const char *patch,
+                       const char *result)
+{
+    has_t *d, *p, *r;
+
+    assert((d = has_json_parse(document, false)) != NULL);
+    assert((p = has_json_parse(patch, false)) != NULL);
+    if(result) {
+        assert(has_patch_apply(&d, p) == 0);
+        assert((r = has_json_parse(result, false)) != NULL);
+        assert(has_equal(d, r));
+        has_free(r);
+    } else {
+        assert(has_patch_apply(&d, p) < 0);
+    }
+    has_free(p);
+    has_free(d);
+}
+
+int main(int argc, char **argv)
+{
+    has_t *a, *b, *patch;
+    has_digest_t da, db;
+    char *s, op[128];
+    size_t l;
+    int i;
+
+    /* Diff */
+    test_roundtrip("{\"a\":1,\"b\":[1,2,3]}", "{\"a\":1,\"b\":[1,2,3]}", 0);
+    test_roundtrip("{\"a\":1,\"b\":2}", "{\"a\":1,\"c\":2}", 2);
+    test_roundtrip("[1,2,3,4,5]", "[1,2,4,5]", 1);
+    test_roundtrip("[1,2,3]", "[0,1,2,3,4]", -1);
+    test_roundtrip("[1,2,3,4,5,6]", "[1,6]", 4);
+    test_roundtrip("[1,{\"x\":[1,2]},3]", "[1,{\"x\":[1,5]},3]", 1);
+    test_roundtrip("{\"a/b\":{\"c~d\":1}}", "{\"a/b\":{\"c~d\":2}}", 1);
+    test_roundtrip("{\"a\":[1]}", "[\"a\"]", 1);
+    test_roundtrip("{\"a\":null,\"b\":true}", "{\"a\":false,\"c\":null}", 3);
+
+    assert((a = has_json_parse("{\"a/b\":{\"c~d\":1}}", false)) != NULL);
+    assert((b = has_hash_new(1)) != NULL);
+    assert((patch = has_diff(a, b)) != NULL);
+    assert(has_json_serialize(patch, &s, &l, 0) == 0);
+    assert(strcmp(s, "[{\"op\":\"remove\",\"path\":\"/a~1b\"}]") == 0);
+    free(s);
+    has_free(patch);
+    has_free(b);
+    has_free(a);
+
+    /* Nested change after memoizing digests */
+    assert((a = has_json_parse("{\"x\":{\"y\":1}}", false)) != NULL);
+    assert((b = has_json_parse("{\"x\":{\"y\":1}}", false)) != NULL);
+    assert(has_digest(a, &da) == 0 && has_digest(b, &db) == 0);
+    assert((patch = has_diff(a, b)) != NULL && has_array_count(patch) == 0);
+    has_free(patch);
+    assert(has_hash_set_str(has_hash_get_str(b, "x"), "y", has_int_new(2)) != NULL);
+    assert(has_digest(a, &da) == 0 && has_digest(b, &db) == 0);
+    assert((patch = has_diff(a, b)) != NULL && has_array_count(patch) == 1);
+    has_free(patch);
+    /* Colliding digests do not hide differences */
+    has_memo_set(b, &da);
+    assert(has_digest_memoized(b, &db) && da.low == db.low && da.high == db.high);
+    assert((patch = has_diff(a, b)) != NULL && has_array_count(patch) == 1);
+    has_free(patch);
+    has_free(b);
+    has_free(a);
+
+    /* Apply */
+    test_apply("{\"a\":1}", "[{\"op\":\"add\",\"path\":\"/b\",\"value\":[2]}]",
+               "{\"a\":1,\"b\":[2]}");
+    test_apply("[1,3]", "[{\"op\":\"add\",\"path\":\"/1\",\"value\":2},"
+               "{\"op\":\"add\",\"path\":\"/-\",\"value\":4}]", "[1,2,3,4]");
+    test_apply("[1,2]", "[{\"op\":\"add\",\"path\":\"/3\",\"value\":2}]", NULL);
+    test_apply("[1,2]", "[{\"op\":\"add\",\"path\":\"/01\",\"value\":2}]", NULL);
+    test_apply("{\"a\":1}", "[{\"op\":\"remove\",\"path\":\"/b\"}]", NULL);
+    test_apply("{\"a\":1}", "[{\"op\":\"replace\",\"path\":\"/b\",\"value\":2}]", NULL);
+    test_apply("{\"a\":1}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[]}]", "[]");
+    test_apply("{\"a\":{\"b\":1},\"c\":[]}",
+               "[{\"op\":\"move\",\"from\":\"/a/b\",\"path\":\"/c/0\"}]",
+               "{\"a\":{},\"c\":[1]}");
+    test_apply("{\"a\":{\"b\":1}}",
+               "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/b/c\"}]", NULL);
+    test_apply("{\"a\":{\"b\":[1]}}",
+               "[{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/c\"}]",
+               "{\"a\":{\"b\":[1]},\"c\":{\"b\":[1]}}");
+    test_apply("{\"a\":[1,{\"b\":null}]}",
+               "[{\"op\":\"test\",\"path\":\"/a/1\",\"value\":{\"b\":null}}]",
+               "{\"a\":[1,{\"b\":null}]}");
+    test_apply("{\"a\":[1,2]}",
+               "[{\"op\":\"test\",\"path\":\"/a/1\",\"value\":1}]", NULL);
+    test_apply("{\"a\":1}", "[{\"op\":\"nop\",\"path\":\"/a\"}]", NULL);
+    test_apply("{\"a\":1}", "[{\"op\":\"remove\",\"path\":\"a\"}]", NULL);
+
+    /* Keys added and removed many times, the slots of removed entries
+       are reclaimed */
+    assert((a = has_json_parse("{\"keep\":1,\"x\":2}", false)) != NULL);
+    for(i = 0; i < 1000; i++) {
+        sprintf(op, "[{\"op\":\"add\",\"path\":\"/k%d\",\"value\":%d},"
+                "{\"op\":\"remove\",\"path\":\"/k%d\"}]", i, i, i);
+        assert((patch = has_json_parse(op, false)) != NULL);
+        assert(has_patch_apply(&a, patch) == 0);
+        has_free(patch);
+        assert(has_hash_count(a) == 2 && !has_hash_exists_str(a, "k0"));
+    }
+    assert(has_int_get(has_hash_get_str(a, "keep")) == 1);
+    assert(hash_header(a)->freed < hash_size(a->value.hash.size) - 2);
+    has_free(a);
+
+    return 0;
+}
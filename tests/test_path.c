@@ -0,0 +1,70 @@
+/*
+  (c) Mathias Brossard <mathias@brossard.org>
+*/
+
+#include "has.c"
+#include "has_json.c"
+#include "has_path.c"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+int main(int argc, char **argv)
+{
+    char *buffer =
+        "{ \"id\": 7, \"delivery\": { \"items\": ["
+        "{ \"sku\": \"a1\", \"qty\": 1 },"
+        "{ \"qty\": 2 },"
+        "{ \"sku\": \"c3\", \"qty\": 3 }"
+        "], \"it.em\": { \"x\": [10, 20, 30] } } }";
+    has_t *json, **values;
+    has_path_t *p;
+    int count;
+    size_t l;
+    const char *s;
+
+    assert((json = has_json_parse(buffer, false)) != NULL);
+
+    /* Invalid expressions */
+    assert(has_path_compile("$.") == NULL);
+    assert(has_path_compile("$[1") == NULL);
+    assert(has_path_compile("$['a") == NULL);
+    assert(has_path_compile("$x") == NULL);
+
+    /* Simple paths */
+    assert(has_path_get_str(json, "$") == json);
+    assert(has_int_get(has_path_get_str(json, "$.id")) == 7);
+    assert(has_int_get(has_path_get_str(json, "id")) == 7);
+    assert(has_int_get(has_path_get_str(json, "delivery.items[2].qty")) == 3);
+    assert(has_int_get(has_path_get_str(json, "$.delivery.items[-1].qty")) == 3);
+    assert(has_path_get_str(json, "$.delivery.items[3]") == NULL);
+    assert(has_path_get_str(json, "$.delivery.items[-4]") == NULL);
+    assert(has_path_get_str(json, "$.id.x") == NULL);
+    assert(has_int_get(has_path_get_str(json, "$.delivery['it.em'].x[1]")) == 20);
+
+    /* Wildcards */
+    assert((p = has_path_compile("$.delivery.items[*].sku")) != NULL);
+    assert(has_path_is_wildcard(p));
+    assert((s = has_string_get(has_path_get(json, p), &l)) != NULL);
+    assert(l == 2 && memcmp(s, "a1", 2) == 0);
+    assert(has_path_get_all(json, p, &values, &count) == 0);
+    assert(count == 2 && values[2] == NULL);
+    assert((s = has_string_get(values[1], &l)) != NULL);
+    assert(l == 2 && memcmp(s, "c3", 2) == 0);
+    free(values);
+    has_path_free(p);
+
+    assert((p = has_path_compile("$.delivery.*.x[*]")) != NULL);
+    assert(has_path_get_all(json, p, &values, &count) == 0);
+    assert(count == 3 && has_int_get(values[2]) == 30);
+    free(values);
+    assert(has_path_get_all(NULL, p, &values, &count) == 0);
+    assert(count == 0 && values[0] == NULL);
+    free(values);
+    has_path_free(p);
+
+    has_free(json);
+    return 0;
+}
@@ -0,0 +1,75 @@
+/*
+  (c) Mathias Brossard <mathias@brossard.org>
+*/
+
+#include "has.c"
+#include "has_reclaim.c"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <assert.h>
+
+double epoch_double()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + (t.tv_usec * 1.0) / 1000000.0;
+}
+
+/* Hash of count entries with owned keys, each value being an array
+   holding an owned string */
+has_t *build(int count)
+{
+    has_t *h = has_hash_new(64);
+    int i;
+
+    for(i = 0; i < count; i++) {
+        char *k = malloc(16), *v = malloc(16);
+        has_t *a = has_array_new(2);
+        assert(k && v && a);
+        sprintf(k, "%08x", i);
+        sprintf(v, "%08x", i);
+        assert(has_array_push(a, has_string_new_o(v, 8, true)));
+        assert(has_hash_set_o(h, k, 8, a, true));
+    }
+    return h;
+}
+
+int main(int argc, char **argv)
+{
+    int i, j = 1024 * 128, steps = 0;
+    double t1, t2;
+    has_t *h;
+
+    /* Incremental freeing */
+    h = build(j);
+    has_free_deferred(h);
+    has_free_deferred(build(16));
+    t1 = epoch_double();
+    while(has_reclaim(1024)) {
+        steps++;
+    }
+    t2 = epoch_double();
+    assert(steps > 16);
+    printf("Incremental: %d steps %f\n", steps, t2 - t1);
+
+    /* Background freeing */
+    assert(has_reclaimer_start() == 0);
+    assert(has_reclaimer_start() == 0);
+    for(i = 0; i < 4; i++) {
+        h = build(j);
+        t1 = epoch_double();
+        has_free_deferred(h);
+        t2 = epoch_double();
+        printf("Deferred deleting: %f\n", t2 - t1);
+    }
+    has_reclaimer_stop();
+    assert(!has_reclaim(1));
+
+    /* Queued without thread, released by has_reclaimer_stop() */
+    has_free_deferred(build(1024));
+    has_reclaimer_stop();
+    return 0;
+}
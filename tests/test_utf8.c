@@ -31,8 +31,78 @@ void test_decode_utf8(char *utf8, size_t u8len, int32_t code)
     assert(cp == code);
 }
 
+/* All implementations must agree with the expected result */
+void test_valid(const char *s, size_t l, bool expected)
+{
+    assert(has_json_utf8_scalar(s, l) == expected);
+    assert(has_json_utf8_valid(s, l) == expected);
+#ifdef HAS_JSON_X86
+    if(__builtin_cpu_supports("sse4.2")) {
+        assert(has_json_utf8_sse42(s, l) == expected);
+    }
+    if(__builtin_cpu_supports("avx2")) {
+        assert(has_json_utf8_avx2(s, l) == expected);
+    }
+#endif
+}
+
+void test_validate(void)
+{
+    const char *valid[] = {
+        "", "abc", "\xC2\xA2", "\xE2\x82\xAC", "\xF0\xA4\xAD\xA2",
+        "\xED\x9F\xBF", "\xEE\x80\x80", "\xF4\x8F\xBF\xBF", NULL
+    };
+    const char *invalid[] = {
+        "\x80", "\xBF", "\xC0\x80", "\xC1\xBF", "\xC2", "\xC2\x41",
+        "\xE0\x80\x80", "\xE0\x9F\xBF", "\xED\xA0\x80", "\xED\xBF\xBF",
+        "\xE2\x82", "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF",
+        "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xFF", "\xF0\xA4\xAD",
+        "\xC2\xA2\xA2", NULL
+    };
+    const char *pieces[] = {
+        "a", "\xC2\xA2", "\xE2\x82\xAC", "\xF0\xA4\xAD\xA2", "\xC0\x80",
+        "\xE2\x82", "\xED\xA0\x80"
+    };
+    char buffer[160];
+    size_t i, j, k, l;
+    int v;
+
+    /* Alone and at all offsets of the blocks */
+    for(v = 0; v < 2; v++) {
+        const char **list = v ? invalid : valid;
+        for(i = 0; list[i] != NULL; i++) {
+            l = strlen(list[i]);
+            for(j = 0; j < 70; j++) {
+                memset(buffer, 'x', j);
+                memcpy(buffer + j, list[i], l);
+                for(k = j + l; k < j + l + 34; k++) {
+                    test_valid(buffer, k, v == 0);
+                    buffer[k] = 'y';
+                }
+            }
+        }
+    }
+
+    /* Random sequences, valid when no invalid piece was used */
+    srand(1);
+    for(i = 0; i < 20000; i++) {
+        bool expected = true;
+        for(l = 0; l < 120; l += strlen(pieces[j])) {
+            j = rand() % 7;
+            if(j >= 4 && (rand() % 16) != 0) {
+                j = 0;
+            }
+            expected = expected && (j < 4);
+            memcpy(buffer + l, pieces[j], strlen(pieces[j]));
+        }
+        test_valid(buffer, l, expected);
+    }
+}
+
 int main(int argc, char **argv)
 {
+    has_t *json;
+
     /* Examples from http://en.wikipedia.org/wiki/UTF-16 */
     test_recode_unicode(0x7A,            "\\u007A",  6,             "\x7A", 1);
     test_recode_unicode(0x6C34,          "\\u6C34",  6,     "\xe6\xb0\xb4", 3);
@@ -47,5 +117,17 @@ int main(int argc, char **argv)
     test_decode_utf8("\xE2\x82\xAC",     3,   0x20AC);
     test_decode_utf8("\xF0\xA4\xAD\xA2", 4, 0x024B62);
 
+    test_validate();
+    assert(has_json_parse_n("[\"\xC0\x80\"]", 6, HAS_JSON_PARSE_UTF8) == NULL);
+    assert(has_json_parse_n("{\"\xFF\": 1}", 9, HAS_JSON_PARSE_UTF8) == NULL);
+    /* Escaped lone surrogate */
+    assert((json = has_json_parse_n("[\"\\udc00\"]", 10, HAS_JSON_PARSE_DECODE)) != NULL);
+    has_free(json);
+    assert(has_json_parse_n("[\"\\udc00\"]", 10,
+                            HAS_JSON_PARSE_UTF8 | HAS_JSON_PARSE_DECODE) == NULL);
+    assert((json = has_json_parse_n("{\"\xC3\xA9\": \"\xE2\x82\xAC\"}", 13,
+                                    HAS_JSON_PARSE_UTF8)) != NULL);
+    has_free(json);
+
     return 0;
 }